@@ -3,10 +3,12 @@
 
 #include <vector>
 #include <iostream>
+#include <string>
 
 using namespace std;
 
-// Инструкции виртуальной машины Милана 
+// Инструкции виртуальной машины Милана. Порядок совпадает с operation
+// в vm/vm.h: числовые коды инструкций записываются в объектный файл.
 
 enum Instruction
 {
@@ -19,11 +21,11 @@ enum Instruction
 	PUSH,		// PUSH n - загрузка в стек константы n
 	POP,		// удаление слова с вершины стека
 	DUP,		// копирование слова на вершине стека
+	INVERT,		// изменение знака слова на вершине стека
 	ADD,		// сложение двух слов на вершине стека и запись результата вместо них
 	SUB,		// вычитание двух слов на вершине стека и запись результата вместо них
 	MULT,		// умножение двух слов на вершине стека и запись результата вместо них
 	DIV,		// деление двух слов на вершине стека и запись результата вместо них
-	INVERT,		// изменение знака слова на вершине стека
 	COMPARE,	// COMPARE cmp - сравнение двух слов на вершине стека с помощью операции сравнения с кодом cmp
 	JUMP,		// JUMP addr - безусловный переход по адресу addr
 	JUMP_YES,	// JUMP_YES addr - переход по адресу addr, если на вершине стека значение 1
@@ -36,6 +38,58 @@ enum Instruction
 	BP,
 	SBLOAD,
 	SBSTORE,
+
+	// Составные инструкции (суперинструкции). Порождаются не парсером, а
+	// проходом выбора суперинструкций в CodeGen::flush() из частых
+	// последовательностей простых инструкций.
+	PUSH_ADD,	// PUSH_ADD n - PUSH n; ADD
+	PUSH_SUB,	// PUSH_SUB n - PUSH n; SUB
+	PUSH_MULT,	// PUSH_MULT n - PUSH n; MULT
+	PUSH_DIV,	// PUSH_DIV n - PUSH n; DIV
+	LOAD_ADD,	// LOAD_ADD addr - LOAD addr; ADD
+	SLOAD_ADD,	// SLOAD_ADD offset - SLOAD offset; ADD
+	INC,		// INC addr n - LOAD addr; PUSH n; ADD; STORE addr
+	SINC,		// SINC offset n - SLOAD offset; PUSH n; ADD; SSTORE offset
+	COMPARE_JUMP_NO,	// COMPARE_JUMP_NO cmp addr - COMPARE cmp; JUMP_NO addr
+
+	// Вызов функции, возврат из нее и место в кадре
+	CALL,		// CALL addr n - вызов функции по адресу addr, n аргументов с вершины стека переносятся в кадр
+	RET,		// RET k - возврат из функции с k (0 или 1) значениями на вершине стека
+	ALLOC,		// ALLOC n - n слов, заполненных нулями, в конце кадра функции
+
+	SWAP,		// обмен двух слов на вершине стека
+
+	// Сдвиги и поразрядные операции. SHL порождает замена умножения
+	// на степень двойки в CodeGen::flush().
+	SHL,		// SHL n - сдвиг слова на вершине стека на n разрядов влево
+	SHR,		// SHR n - арифметический сдвиг слова на вершине стека на n разрядов вправо
+	AND,		// поразрядное И двух слов на вершине стека
+	OR,		// поразрядное ИЛИ двух слов на вершине стека
+	XOR,		// поразрядное исключающее ИЛИ двух слов на вершине стека
+
+	// Групповые операции над массивами. Операнды в стеке: адреса
+	// массивов, число элементов n и, для VFILL, VADDS и VMULS, число v.
+	// Бит k аргумента mask означает, что k-й массив лежит в кадре
+	// функции (адрес относительно bp), иначе - в памяти данных.
+	VFILL,		// VFILL mask - a[i] := v
+	VCOPY,		// VCOPY mask - a[i] := b[i]
+	VADDS,		// VADDS mask - a[i] := a[i] + v
+	VMULS,		// VMULS mask - a[i] := a[i] * v
+	VADD,		// VADD mask - a[i] := b[i] + c[i]
+	VSUM,		// VSUM mask - сумма a[0] .. a[n - 1]
+	VMIN,		// VMIN mask - наименьший из a[0] .. a[n - 1]
+	VMAX,		// VMAX mask - наибольший из a[0] .. a[n - 1]
+
+	// Управление счетным циклом FOR. На вершине стека лежат предел b
+	// и шаг s, инструкция их не снимает: счетчик увеличивается на s,
+	// и, пока он не вышел за предел (i <= b при s >= 0, i >= b при
+	// s < 0), выполняется переход на addr.
+	LOOP,		// LOOP var addr - счетчик в памяти данных по адресу var
+	SLOOP,		// SLOOP offset addr - счетчик в кадре функции
+
+	// Переход по таблице для выбора CASE. За инструкцией следуют n + 1
+	// инструкций JUMP: для значений 0 .. n - 1 и переход по умолчанию.
+	JUMP_TABLE,	// JUMP_TABLE n - снимает v со стека, переход на JUMP номер v или n
 };
 
 // Класс Command представляет машинные инструкции. 
@@ -45,12 +99,17 @@ class Command
 public:
 	// Конструктор для инструкций без аргументов
 	Command(Instruction instruction)
-		: instruction_(instruction), arg_(0)
+		: instruction_(instruction), arg_(0), arg2_(0), isAddress_(false)
 	{}
 
 	// Конструктор для инструкций с одним аргументом
 	Command(Instruction instruction, int arg)
-		: instruction_(instruction), arg_(arg)
+		: instruction_(instruction), arg_(arg), arg2_(0), isAddress_(false)
+	{}
+
+	// Конструктор для составных инструкций с двумя аргументами
+	Command(Instruction instruction, int arg, int arg2)
+		: instruction_(instruction), arg_(arg), arg2_(arg2), isAddress_(false)
 	{}
 
 	// Печать инструкции
@@ -58,22 +117,38 @@ public:
 	//     ostream& os - поток вывода, куда будет напечатана инструкция
 	void print(int address, ostream& os);
 
+	Instruction instruction() const { return instruction_; }
+	int arg() const { return arg_; }
+	int arg2() const { return arg2_; }
+
 private:
+	friend class CodeGen;
+
 	Instruction instruction_; // Код инструкции
 	int arg_;				  // Аргумент инструкции
+	int arg2_;				  // Второй аргумент составной инструкции
+	bool isAddress_;		  // Аргумент - адрес в программе (например, адрес возврата)
 };
 
+// Образ объектного файла виртуальной машины с программой program
+// (формат описан в vm/docs/vm.txt). Образ можно записать в файл или
+// передать виртуальной машине в том же процессе (vm_image_load()).
+vector<char> objectImage(const vector<Command>& program);
+
 // Кодогенератор.
 // Назначение кодогенератора:
 // - Формировать программу для виртуальной машины Милана
 // - Отслеживать адрес последней инструкции
 // - Буферизовать программу и печатать ее в указанный поток вывода
+//   в виде текста или объектного файла
 
 class CodeGen
 {
 public:
-	explicit CodeGen(ostream& output)
-		: output_(output)
+	// object - записывать программу в формате объектного файла
+	// виртуальной машины (см. vm/docs/vm.txt), а не текстом
+	explicit CodeGen(ostream& output, bool object = false)
+		: output_(output), object_(object)
 	{
 	}
 
@@ -82,10 +157,19 @@ public:
 	
 	// Добавление инструкции с одним аргументом в конец программы
 	void emit(Instruction instruction, int arg);
+
+	// Добавление инструкции с двумя аргументами в конец программы
+	void emit(Instruction instruction, int arg, int arg2);
 	
 	// Запись инструкции без аргументов по указанному адресу
 	void emitAt(int address, Instruction instruction);
 
+	// Добавление инструкции, аргумент которой - адрес в программе,
+	// хранимый как данные (например, адрес возврата из функции в PUSH).
+	// Такой аргумент исправляется, если при выборе суперинструкций
+	// адреса инструкций сдвигаются.
+	void emitAddress(Instruction instruction, int address);
+
 	// Запись инструкции с одним аргументом по указанному адресу
 	void emitAt(int address, Instruction instruction, int arg);
 	
@@ -94,12 +178,34 @@ public:
 
 	// Формирование "пустой" инструкции (NOP) и возврат ее адреса
 	int reserve();
+
+	// Векторизация цикла WHILE, код которого занимает инструкции от
+	// start до конца программы. Цикл вида
+	//     WHILE i < n DO a[i + c] := <значение>; i := i + 1 OD,
+	// где значение - константа, переменная, элемент массива, сумма двух
+	// элементов или a[i + c], сложенный с константой или переменной
+	// (умноженный на нее), заменяется одной групповой инструкцией
+	// (VFILL, VCOPY, VADD, VADDS или VMULS) и присваиванием i := n.
+	// В report записывается выбранная инструкция или причина, по
+	// которой цикл не векторизован.
+	bool vectorizeLoop(int start, string& report);
 	
 	// Запись последовательности инструкций в выходной поток
 	void flush();
 
+	// Окончательная программа (после выбора суперинструкций) без
+	// печати. Буфер инструкций после вызова пуст.
+	vector<Command> takeProgram();
+
 private:
+	// Замена частых последовательностей инструкций составными
+	// инструкциями. Последовательность заменяется, только если
+	// ни на одну ее инструкцию, кроме первой, нет перехода. После
+	// замены адреса переходов пересчитываются.
+	void selectSuperinstructions();
+
 	ostream& output_;               // Выходной поток
+	bool object_;                   // Писать объектный файл вместо текста
 	vector<Command> commandBuffer_;	// Буфер инструкций
 };
 
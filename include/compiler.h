@@ -0,0 +1,38 @@
+#ifndef CMILAN_COMPILER_H
+#define CMILAN_COMPILER_H
+
+#include "codegen.h"
+#include "parser.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Компилятор Милана как библиотека.
+// Исходный текст программы передается строкой или потоком, результат -
+// программа для виртуальной машины в виде вектора инструкций и список
+// сообщений об ошибках. Стандартные потоки ввода-вывода не используются,
+// поэтому в одном процессе можно компилировать много программ подряд.
+
+// Результат компиляции
+struct Compilation
+{
+	bool ok;                        // ошибок не найдено
+	vector<Command> program;        // программа (пуста, если есть ошибки)
+	vector<Diagnostic> diagnostics; // сообщения об ошибках
+	vector<Diagnostic> vectorization; // отчет о векторизации циклов
+};
+
+// Компиляция программы из потока input. Имя файла fileName
+// передается лексическому анализатору.
+Compilation compile(istream& input, const string& fileName);
+
+// Компиляция программы из строки source
+Compilation compile(const string& source, const string& fileName = "<string>");
+
+// Печать сообщений об ошибках в поток os в формате cmilan:
+// "Line <номер строки>: <сообщение>"
+void printDiagnostics(const vector<Diagnostic>& diagnostics, ostream& os);
+
+#endif
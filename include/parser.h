@@ -32,19 +32,28 @@ using namespace std;
  * ошибок без печати сообщений. Если в процессе разбора была найдена хотя бы
  * одна ошибка, код для виртуальной машины не печатается.*/
 
+// Сообщение об ошибке в программе
+struct Diagnostic
+{
+	int line;       // номер строки
+	string message; // текст сообщения
+};
+
 class Parser 
 {
 public:
 	// Конструктор
 	//    const string& fileName - имя файла с программой для анализа
+	//    ostream& output - поток, в который печатается программа
+	//    bool object - печатать программу в формате объектного файла
 	//
 	// Конструктор создает экземпляры лексического анализатора и генератора.
 
-	Parser(const string& fileName, istream& input)
-		: output_(cout), error_(false), recovered_(true), lastVar_(0)
+	Parser(const string& fileName, istream& input, ostream& output = cout, bool object = false)
+		: output_(output), error_(false), recovered_(true), lastVar_(0)
 	{
 		scanner_ = new Scanner(fileName, input);
-		codegen_ = new CodeGen(output_);
+		codegen_ = new CodeGen(output_, object);
 		next();
 	}
 
@@ -56,6 +65,23 @@ public:
 
 	void parse();	//проводим синтаксический разбор 
 
+	// Синтаксический разбор без печати программы. Если ошибок нет,
+	// записывает окончательную программу в result и возвращает true.
+	bool compile(vector<Command>& result);
+
+	// Сообщения об ошибках, найденных при разборе. Парсер их не печатает.
+	const vector<Diagnostic>& diagnostics() const
+	{
+		return diagnostics_;
+	}
+
+	// Отчет о векторизации: для каждого цикла WHILE - выбранная
+	// групповая инструкция или причина, по которой цикл не векторизован.
+	const vector<Diagnostic>& vectorization() const
+	{
+		return vectorization_;
+	}
+
 private:
 
   enum VAR_TYPES: char
@@ -97,6 +123,12 @@ private:
 	void functions(); // Разбор списка функций.
 	void parameters(); // Разбор списка параметров.
 	void arguments(); // Разбор списка аргументов.
+	bool builtin(const string& name, bool value); // Разбор вызова встроенной операции над массивами.
+	int arrayArgument(); // Разбор массива - аргумента встроенной операции.
+	void caseStatement(); // Разбор выбора CASE.
+	int caseLabel(); // Разбор метки ветви выбора.
+	void caseSearch(const vector<pair<int, int> >& labels, int first, int last,
+		int defaultAddress, vector<int>& exits); // Выбор ветви двоичным поиском.
 
 	// Сравнение текущей лексемы с образцом. Текущая позиция в потоке лексем не изменяется.
 	bool see(Token t)
@@ -128,7 +160,7 @@ private:
 	// Обработчик ошибок.
 	void reportError(const string& message)
 	{
-		cerr << "Line " << scanner_->getLineNumber() << ": " << message << endl;
+		diagnostics_.push_back(Diagnostic{scanner_->getLineNumber(), message});
 		error_ = true;
 	}
 	
@@ -151,8 +183,10 @@ private:
 
 	Scanner* scanner_; //лексический анализатор для конструктора
 	CodeGen* codegen_; //указатель на виртуальную машину
-	ostream& output_; //выходной поток (в данном случае используем cout)
+	ostream& output_; //выходной поток (по умолчанию cout)
 	bool error_; //флаг ошибки. Используется чтобы определить, выводим ли список команд после разбора или нет
+	vector<Diagnostic> diagnostics_; //найденные ошибки
+	vector<Diagnostic> vectorization_; //отчет о векторизации циклов
 	bool recovered_; //не используется
 	VarTable variables_; //массив переменных, найденных в программе
 	int lastVar_; //номер последней записанной переменной
@@ -37,6 +37,14 @@ enum Token {
 	T_FUNCTION,				// Ключевое слово "function"
 	T_COMMA,				// ","
 	T_RETURN,				// Ключевое слово "return"
+	T_FOR,				// Ключевое слово "for"
+	T_TO,				// Ключевое слово "to"
+	T_STEP,				// Ключевое слово "step"
+	T_CASE,				// Ключевое слово "case"
+	T_OF,				// Ключевое слово "of"
+	T_ESAC,				// Ключевое слово "esac"
+	T_COLON,				// ":"
+	T_BAR,				// "|" - разделитель ветвей выбора
 };
 
 // Функция tokenToString возвращает описание лексемы.
@@ -85,6 +93,12 @@ public:
 		keywords_["read"] = T_READ;
 		keywords_["function"] = T_FUNCTION;
 		keywords_["return"] = T_RETURN;
+		keywords_["for"] = T_FOR;
+		keywords_["to"] = T_TO;
+		keywords_["step"] = T_STEP;
+		keywords_["case"] = T_CASE;
+		keywords_["of"] = T_OF;
+		keywords_["esac"] = T_ESAC;
 
 		nextChar();
 	}
@@ -1,4 +1,5 @@
 #include "codegen.h"
+#include <climits>
 
 void Command::print(int address, ostream& os)
 {
@@ -108,9 +109,125 @@ void Command::print(int address, ostream& os)
 			os << "SBSTORE\t" << arg_;
 			break;
 
+		case PUSH_ADD:
+			os << "PUSH_ADD\t" << arg_;
+			break;
+
+		case PUSH_SUB:
+			os << "PUSH_SUB\t" << arg_;
+			break;
+
+		case PUSH_MULT:
+			os << "PUSH_MULT\t" << arg_;
+			break;
+
+		case PUSH_DIV:
+			os << "PUSH_DIV\t" << arg_;
+			break;
+
+		case LOAD_ADD:
+			os << "LOAD_ADD\t" << arg_;
+			break;
+
+		case SLOAD_ADD:
+			os << "SLOAD_ADD\t" << arg_;
+			break;
+
+		case INC:
+			os << "INC\t" << arg_ << "\t" << arg2_;
+			break;
+
+		case SINC:
+			os << "SINC\t" << arg_ << "\t" << arg2_;
+			break;
+
+		case COMPARE_JUMP_NO:
+			os << "COMPARE_JUMP_NO\t" << arg_ << "\t" << arg2_;
+			break;
+
+		case CALL:
+			os << "CALL\t" << arg_ << "\t" << arg2_;
+			break;
+
+		case RET:
+			os << "RET\t" << arg_;
+			break;
+
+		case ALLOC:
+			os << "ALLOC\t" << arg_;
+			break;
+
+		case SWAP:
+			os << "SWAP";
+			break;
+
+		case SHL:
+			os << "SHL\t" << arg_;
+			break;
+
+		case SHR:
+			os << "SHR\t" << arg_;
+			break;
+
+		case AND:
+			os << "AND";
+			break;
+
+		case OR:
+			os << "OR";
+			break;
+
+		case XOR:
+			os << "XOR";
+			break;
+
+		case VFILL:
+			os << "VFILL\t" << arg_;
+			break;
+
+		case VCOPY:
+			os << "VCOPY\t" << arg_;
+			break;
+
+		case VADDS:
+			os << "VADDS\t" << arg_;
+			break;
+
+		case VMULS:
+			os << "VMULS\t" << arg_;
+			break;
+
+		case VADD:
+			os << "VADD\t" << arg_;
+			break;
+
+		case VSUM:
+			os << "VSUM\t" << arg_;
+			break;
+
+		case VMIN:
+			os << "VMIN\t" << arg_;
+			break;
+
+		case VMAX:
+			os << "VMAX\t" << arg_;
+			break;
+
+		case LOOP:
+			os << "LOOP\t" << arg_ << "\t" << arg2_;
+			break;
+
+		case SLOOP:
+			os << "SLOOP\t" << arg_ << "\t" << arg2_;
+			break;
+
+		case JUMP_TABLE:
+			os << "JUMP_TABLE\t" << arg_;
+			break;
+
 	}
 
-	os << endl;
+	os << '\n';
 }
 
 void CodeGen::emit(Instruction instruction)
@@ -123,6 +240,17 @@ void CodeGen::emit(Instruction instruction, int arg)
 	commandBuffer_.push_back(Command(instruction, arg));
 }
 
+void CodeGen::emit(Instruction instruction, int arg, int arg2)
+{
+	commandBuffer_.push_back(Command(instruction, arg, arg2));
+}
+
+void CodeGen::emitAddress(Instruction instruction, int address)
+{
+	commandBuffer_.push_back(Command(instruction, address));
+	commandBuffer_.back().isAddress_ = true;
+}
+
 void CodeGen::emitAt(int address, Instruction instruction)
 {
 	commandBuffer_[address] = Command(instruction);
@@ -144,11 +272,490 @@ int CodeGen::reserve()
 	return commandBuffer_.size() - 1;
 }
 
-void CodeGen::flush()
+// Признак инструкции перехода или вызова, аргумент которой - адрес в программе
+static bool isJump(Instruction instruction)
+{
+	return instruction == JUMP || instruction == JUMP_YES || instruction == JUMP_NO ||
+		instruction == CALL;
+}
+
+// Признак инструкции, второй аргумент которой - адрес перехода
+static bool isJump2(Instruction instruction)
+{
+	return instruction == COMPARE_JUMP_NO || instruction == LOOP || instruction == SLOOP;
+}
+
+// k, если n = 2^k, иначе -1
+static int log2Exact(int n)
+{
+	if(n <= 0 || (n & (n - 1)) != 0) {
+		return -1;
+	}
+
+	int k = 0;
+	while((1 << k) != n) {
+		++k;
+	}
+	return k;
+}
+
+void CodeGen::selectSuperinstructions()
 {
 	int count = commandBuffer_.size();
+
+	// Отмечаем инструкции, на которые есть переходы
+	vector<bool> isTarget(count + 1, false);
 	for(int address = 0; address < count; ++address) {
-		commandBuffer_[address].print(address, output_);
+		Command& command = commandBuffer_[address];
+		if((isJump(command.instruction_) || command.isAddress_) &&
+				command.arg_ >= 0 && command.arg_ <= count) {
+			isTarget[command.arg_] = true;
+		}
+		if(isJump2(command.instruction_) && command.arg2_ >= 0 && command.arg2_ <= count) {
+			isTarget[command.arg2_] = true;
+		}
+		// Инструкции таблицы переходов должны остаться на своих местах
+		if(command.instruction_ == JUMP_TABLE) {
+			for(int i = 1; i <= command.arg_ + 1 && address + i <= count; ++i) {
+				isTarget[address + i] = true;
+			}
+		}
+	}
+
+	// Можно ли заменить length инструкций, начиная с address
+	auto canFuse = [&](int address, int length) {
+		if(address + length > count) {
+			return false;
+		}
+		for(int i = 0; i < length; ++i) {
+			if(commandBuffer_[address + i].isAddress_ ||
+					(i > 0 && isTarget[address + i])) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	auto is = [&](int address, Instruction instruction) {
+		return commandBuffer_[address].instruction_ == instruction;
+	};
+
+	auto argAt = [&](int address) {
+		return commandBuffer_[address].arg_;
+	};
+
+	vector<Command> selected;
+	vector<int> newAddress(count + 1);
+
+	int address = 0;
+	while(address < count) {
+		int start = address;
+		newAddress[address] = selected.size();
+
+		// Пустое выделение кадра в функции без локальных переменных
+		// не нужно: вызов попадёт на следующую инструкцию
+		if(is(address, ALLOC) && argAt(address) == 0) {
+			++address;
+		}
+		// x := x + n и x := x - n
+		else if(canFuse(address, 4) &&
+				((is(address, LOAD) && is(address + 3, STORE)) ||
+				 (is(address, SLOAD) && is(address + 3, SSTORE))) &&
+				argAt(address) == argAt(address + 3) &&
+				is(address + 1, PUSH) &&
+				(is(address + 2, ADD) ||
+				 (is(address + 2, SUB) && argAt(address + 1) != INT_MIN))) {
+			int n = is(address + 2, ADD) ? argAt(address + 1) : -argAt(address + 1);
+			selected.push_back(Command(is(address, LOAD) ? INC : SINC, argAt(address), n));
+			address += 4;
+		}
+		// Условие цикла или условного оператора
+		else if(canFuse(address, 2) && is(address, COMPARE) && is(address + 1, JUMP_NO)) {
+			selected.push_back(Command(COMPARE_JUMP_NO, argAt(address), argAt(address + 1)));
+			address += 2;
+		}
+		// Умножение и деление на 1 не меняют значения
+		else if(canFuse(address, 2) && is(address, PUSH) && argAt(address) == 1 &&
+				(is(address + 1, MULT) || is(address + 1, DIV))) {
+			address += 2;
+		}
+		// Умножение на 2^k - сдвиг влево: в дополнительном коде результат
+		// тот же и для отрицательных чисел, и при переполнении. Деление
+		// так не заменяется: сдвиг вправо округляет к минус бесконечности,
+		// а DIV - к нулю.
+		else if(canFuse(address, 2) && is(address, PUSH) && is(address + 1, MULT) &&
+				log2Exact(argAt(address)) > 0) {
+			selected.push_back(Command(SHL, log2Exact(argAt(address))));
+			address += 2;
+		}
+		// 2^k * x, где x - переменная
+		else if(canFuse(address, 3) && is(address, PUSH) &&
+				(is(address + 1, LOAD) || is(address + 1, SLOAD)) &&
+				is(address + 2, MULT) && log2Exact(argAt(address)) > 0) {
+			selected.push_back(commandBuffer_[address + 1]);
+			selected.push_back(Command(SHL, log2Exact(argAt(address))));
+			address += 3;
+		}
+		// Арифметика с константой
+		else if(canFuse(address, 2) && is(address, PUSH) &&
+				(is(address + 1, ADD) || is(address + 1, SUB) ||
+				 is(address + 1, MULT) || is(address + 1, DIV))) {
+			Instruction fused = PUSH_ADD;
+			switch(commandBuffer_[address + 1].instruction_) {
+				case SUB:  fused = PUSH_SUB;  break;
+				case MULT: fused = PUSH_MULT; break;
+				case DIV:  fused = PUSH_DIV;  break;
+				default:   break;
+			}
+			selected.push_back(Command(fused, argAt(address)));
+			address += 2;
+		}
+		// Сложение с переменной
+		else if(canFuse(address, 2) && (is(address, LOAD) || is(address, SLOAD)) &&
+				is(address + 1, ADD)) {
+			selected.push_back(Command(is(address, LOAD) ? LOAD_ADD : SLOAD_ADD, argAt(address)));
+			address += 2;
+		}
+		else {
+			selected.push_back(commandBuffer_[address]);
+			++address;
+		}
+
+		for(int i = start + 1; i < address; ++i) {
+			newAddress[i] = newAddress[start];
+		}
+	}
+	newAddress[count] = selected.size();
+
+	// Пересчитываем адреса переходов
+	for(Command& command : selected) {
+		if((isJump(command.instruction_) || command.isAddress_) &&
+				command.arg_ >= 0 && command.arg_ <= count) {
+			command.arg_ = newAddress[command.arg_];
+		}
+		else if(isJump2(command.instruction_) &&
+				command.arg2_ >= 0 && command.arg2_ <= count) {
+			command.arg2_ = newAddress[command.arg2_];
+		}
+	}
+
+	commandBuffer_.swap(selected);
+}
+
+// Массив в векторизуемом цикле: элементы с индексами i + offset, где
+// i - счетчик цикла
+struct LoopArray
+{
+	bool reference;	// адрес массива хранится в параметре-ссылке
+	bool frame;	// массив лежит в кадре функции
+	int address;	// адрес массива или параметра-ссылки
+	int offset;
+};
+
+static bool sameElement(const LoopArray& a, const LoopArray& b)
+{
+	return a.reference == b.reference && a.frame == b.frame &&
+		a.address == b.address && a.offset == b.offset;
+}
+
+bool CodeGen::vectorizeLoop(int start, string& report)
+{
+	int end = commandBuffer_.size();
+
+	auto is = [&](int address, Instruction instruction) {
+		return address >= start && address < end &&
+			commandBuffer_[address].instruction_ == instruction;
+	};
+
+	auto argAt = [&](int address) {
+		return commandBuffer_[address].arg_;
+	};
+
+	// Условие i < n, где n - константа или переменная. Счетчик и
+	// переменные лежат в памяти данных (LOAD) или в кадре функции (SLOAD).
+	Instruction load = is(start, SLOAD) ? SLOAD : LOAD;
+	Instruction store = (load == LOAD) ? STORE : SSTORE;
+	int counter = is(start, load) ? argAt(start) : 0;
+
+	auto isCounter = [&](int address) {
+		return is(address, load) && argAt(address) == counter;
+	};
+
+	// Константа или переменная, которая не меняется в цикле
+	auto isInvariant = [&](int address) {
+		return is(address, PUSH) || (is(address, load) && argAt(address) != counter);
+	};
+
+	if(!is(start, load) || !isInvariant(start + 1) ||
+			!is(start + 2, COMPARE) || argAt(start + 2) != 2 ||
+			!is(start + 3, JUMP_NO) || argAt(start + 3) != end) {
+		report = "condition is not <counter> < <constant or variable>.";
+		return false;
+	}
+
+	// Тело заканчивается оператором i := i + 1
+	if(!isCounter(end - 5) || !is(end - 4, PUSH) || argAt(end - 4) != 1 ||
+			!is(end - 3, ADD) || !is(end - 2, store) || argAt(end - 2) != counter ||
+			!is(end - 1, JUMP) || argAt(end - 1) != start) {
+		report = "counter is not incremented by 1 at the end of the body.";
+		return false;
+	}
+
+	// Индекс i, i + c, i - c или c + i
+	auto index = [&](int& address, int& offset) {
+		if(isCounter(address) && is(address + 1, PUSH) &&
+				(is(address + 2, ADD) || (is(address + 2, SUB) && argAt(address + 1) != INT_MIN))) {
+			offset = is(address + 2, ADD) ? argAt(address + 1) : -argAt(address + 1);
+			address += 3;
+		}
+		else if(isCounter(address)) {
+			offset = 0;
+			address += 1;
+		}
+		else if(is(address, PUSH) && isCounter(address + 1) && is(address + 2, ADD)) {
+			offset = argAt(address);
+			address += 3;
+		}
+		else {
+			return false;
+		}
+		return true;
+	};
+
+	// Чтение (write = false) или запись элемента массива по индексу на
+	// вершине стека. Возвращает число инструкций или 0.
+	auto element = [&](int address, bool write, LoopArray& array) {
+		Instruction memory = write ? BSTORE : BLOAD;
+		Instruction frame = write ? SBSTORE : SBLOAD;
+		if(is(address, SLOAD) && argAt(address) != counter && is(address + 1, ADD) &&
+				is(address + 2, memory) && argAt(address + 2) == 0) {
+			array.reference = true;
+			array.frame = false;
+			array.address = argAt(address);
+			return 3;
+		}
+		if(is(address, memory) || is(address, frame)) {
+			array.reference = false;
+			array.frame = is(address, frame);
+			array.address = argAt(address);
+			return 1;
+		}
+		return 0;
+	};
+
+	// Оператор a[i + c] := <значение>: индекс, значение, SWAP и запись
+	LoopArray target;
+	int swap = end - 7;
+	if(element(end - 8, true, target) == 3) {
+		swap = end - 9;
+	}
+	else if(element(end - 6, true, target) != 1) {
+		swap = -1;
+	}
+
+	int address = start + 4;
+	if(swap < start + 4 || !is(swap, SWAP)) {
+		report = "body is not a single array element assignment.";
+		return false;
+	}
+	if(!index(address, target.offset)) {
+		report = "array index is not <counter> + <constant>.";
+		return false;
+	}
+
+	// Значение - один операнд или два операнда и операция
+	LoopArray arrays[2];
+	Command scalar(NOP);
+	int elements = 0;
+	int scalars = 0;
+	bool scalarFirst = false;
+	while(address < swap && elements + scalars < 2) {
+		int length = 0;
+		if(isInvariant(address)) {
+			scalar = commandBuffer_[address];
+			scalarFirst = (elements == 0);
+			++scalars;
+			++address;
+		}
+		else if(index(address, arrays[elements].offset) &&
+				(length = element(address, false, arrays[elements])) > 0) {
+			++elements;
+			address += length;
+		}
+		else {
+			break;
+		}
+	}
+
+	Instruction op = NOP;
+	if(elements + scalars == 2 && address + 1 == swap) {
+		op = commandBuffer_[address].instruction_;
+	}
+	else if(elements + scalars != 1 || address != swap) {
+		elements = scalars = 0;
+	}
+
+	Instruction operation = NOP;
+	const char* name = "";
+	if(elements == 0 && scalars == 1) {
+		operation = VFILL;
+		name = "VFILL";
+	}
+	else if(elements == 1 && scalars == 0) {
+		operation = VCOPY;
+		name = "VCOPY";
+	}
+	else if(elements == 2 && op == ADD) {
+		operation = VADD;
+		name = "VADD";
+	}
+	else if(elements == 1 && scalars == 1 && sameElement(arrays[0], target) &&
+			(op == ADD || (op == SUB && !scalarFirst))) {
+		operation = VADDS;
+		name = "VADDS";
+	}
+	else if(elements == 1 && scalars == 1 && sameElement(arrays[0], target) && op == MULT) {
+		operation = VMULS;
+		name = "VMULS";
+	}
+	else {
+		report = "assigned value is not a bulk operation on array elements and loop invariants.";
+		return false;
+	}
+
+	// Цикл заменяется кодом
+	//     IF i < n THEN <операция над n - i элементами>; i := n FI
+	// Условие и переход остаются прежними.
+	Command counterLoad = commandBuffer_[start];
+	Command bound = commandBuffer_[start + 1];
+	commandBuffer_.erase(commandBuffer_.begin() + start + 4, commandBuffer_.end());
+
+	// Адрес элемента i + offset
+	auto emitArray = [&](const LoopArray& array) {
+		if(array.reference) {
+			commandBuffer_.push_back(Command(SLOAD, array.address));
+			if(array.offset != 0) {
+				commandBuffer_.push_back(Command(PUSH, array.offset));
+				commandBuffer_.push_back(Command(ADD));
+			}
+		}
+		else {
+			commandBuffer_.push_back(Command(PUSH, array.address + array.offset));
+		}
+		commandBuffer_.push_back(counterLoad);
+		commandBuffer_.push_back(Command(ADD));
+	};
+
+	int spaces = target.frame ? 1 : 0;
+	emitArray(target);
+	if(operation == VCOPY || operation == VADD) {
+		for(int i = 0; i < elements; ++i) {
+			emitArray(arrays[i]);
+			spaces |= (arrays[i].frame ? 1 : 0) << (i + 1);
+		}
+	}
+
+	commandBuffer_.push_back(bound);
+	commandBuffer_.push_back(counterLoad);
+	commandBuffer_.push_back(Command(SUB));
+
+	// a[i] - k = a[i] + (-k)
+	if(scalars == 1 && op == SUB && scalar.instruction_ == PUSH && scalar.arg_ != INT_MIN) {
+		commandBuffer_.push_back(Command(PUSH, -scalar.arg_));
+	}
+	else if(scalars == 1) {
+		commandBuffer_.push_back(scalar);
+		if(op == SUB) {
+			commandBuffer_.push_back(Command(INVERT));
+		}
+	}
+
+	commandBuffer_.push_back(Command(operation, spaces));
+	commandBuffer_.push_back(bound);
+	commandBuffer_.push_back(Command(store, counter));
+	commandBuffer_[start + 3].arg_ = commandBuffer_.size();
+
+	report = string("vectorized with ") + name + ".";
+	return true;
+}
+
+// Формат объектного файла виртуальной машины (vm/vmint.h, vm/docs/vm.txt).
+// Инструкция занимает одно слово: код в битах 0-9, признак вынесенных
+// аргументов в бите 10 и аргумент со знаком или номер вынесенных
+// аргументов в битах 11-31.
+static const char OBJECT_MAGIC[] = "MVMO";
+static const unsigned int OBJECT_VERSION = 2;
+static const unsigned int PACKED_WIDE = 0x400;
+static const int PACKED_SHIFT = 11;
+static const int PACKED_ARG_MIN = -(1 << 20);
+static const int PACKED_ARG_MAX = (1 << 20) - 1;
+
+// Добавление 32-битного слова в порядке байтов little-endian
+static void putWord(vector<char>& buffer, unsigned int word)
+{
+	for(int i = 0; i < 4; ++i) {
+		buffer.push_back(static_cast<char>((word >> (8 * i)) & 0xFF));
+	}
+}
+
+vector<char> objectImage(const vector<Command>& program)
+{
+	vector<unsigned int> code;
+	vector<int> wide;
+
+	// Аргументы, не помещающиеся в слово, и аргументы составных
+	// инструкций с двумя аргументами выносятся парами
+	for(const Command& command : program) {
+		unsigned int instruction = command.instruction();
+		if(command.arg2() == 0 && command.arg() >= PACKED_ARG_MIN && command.arg() <= PACKED_ARG_MAX) {
+			code.push_back((static_cast<unsigned int>(command.arg()) << PACKED_SHIFT) | instruction);
+		}
+		else {
+			code.push_back((static_cast<unsigned int>(wide.size()) << PACKED_SHIFT) |
+					PACKED_WIDE | instruction);
+			wide.push_back(command.arg());
+			wide.push_back(command.arg2());
+		}
+	}
+
+	vector<char> buffer(OBJECT_MAGIC, OBJECT_MAGIC + 4);
+	putWord(buffer, OBJECT_VERSION);
+	putWord(buffer, 0);		// вход - переход на главную программу по адресу 0
+	putWord(buffer, code.size());
+	putWord(buffer, wide.size());
+	putWord(buffer, 0);		// начальных значений памяти данных (SET) нет
+	for(unsigned int word : code) {
+		putWord(buffer, word);
+	}
+	for(int word : wide) {
+		putWord(buffer, static_cast<unsigned int>(word));
+	}
+
+	return buffer;
+}
+
+void CodeGen::flush()
+{
+	selectSuperinstructions();
+
+	if(object_) {
+		vector<char> image = objectImage(commandBuffer_);
+		output_.write(image.data(), image.size());
+	}
+	else {
+		int count = commandBuffer_.size();
+		for(int address = 0; address < count; ++address) {
+			commandBuffer_[address].print(address, output_);
+		}
 	}
 	output_.flush();
 }
+
+vector<Command> CodeGen::takeProgram()
+{
+	selectSuperinstructions();
+
+	vector<Command> program;
+	program.swap(commandBuffer_);
+	return program;
+}
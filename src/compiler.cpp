@@ -0,0 +1,27 @@
+#include "compiler.h"
+#include <sstream>
+
+Compilation compile(istream& input, const string& fileName)
+{
+	Compilation result;
+
+	Parser parser(fileName, input);
+	result.ok = parser.compile(result.program);
+	result.diagnostics = parser.diagnostics();
+	result.vectorization = parser.vectorization();
+	return result;
+}
+
+Compilation compile(const string& source, const string& fileName)
+{
+	istringstream input(source);
+	return compile(input, fileName);
+}
+
+void printDiagnostics(const vector<Diagnostic>& diagnostics, ostream& os)
+{
+	for(const Diagnostic& diagnostic : diagnostics) {
+		os << "Line " << diagnostic.line << ": " << diagnostic.message << '\n';
+	}
+	os.flush();
+}
@@ -1,32 +1,75 @@
-#include "parser.h"
+#include "compiler.h"
 #include <iostream>
+#include <fstream>
 #include <cstdlib>
+#include <cstring>
 
 using namespace std;
 
 void printHelp()
 {
-	cout << "Usage: cmilan input_file" << endl;
+	cout << "Usage: cmilan [--object output_file] [--vectorize-report] input_file" << endl;
 }
 
 int main(int argc, char** argv)
 {
-	if(argc < 2) {
+	const char* inputName = NULL;
+	const char* objectName = NULL;
+	bool vectorizeReport = false;
+
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--object") == 0 && i + 1 < argc) {
+			objectName = argv[++i];
+		}
+		else if(strcmp(argv[i], "--vectorize-report") == 0) {
+			vectorizeReport = true;
+		}
+		else if(argv[i][0] == '-' || inputName != NULL) {
+			printHelp();
+			return EXIT_FAILURE;
+		}
+		else {
+			inputName = argv[i];
+		}
+	}
+
+	if(inputName == NULL) {
 		printHelp();
 		return EXIT_FAILURE;
 	}
 
 	ifstream input;
-        input.open(argv[1]);
+        input.open(inputName);
 
 	if(input) {
-		Parser p(argv[1], input);
+		// Объектный файл для виртуальной машины; без --object
+		// программа печатается текстом на стандартный вывод
+		if(objectName != NULL) {
+			ofstream object(objectName, ios::out | ios::binary);
+			if(!object) {
+				cerr << "Unable to write '" << objectName << "'" << endl;
+				return EXIT_FAILURE;
+			}
+
+			Parser p(inputName, input, object, true);
+			p.parse();
+			if(vectorizeReport) {
+				printDiagnostics(p.vectorization(), cerr);
+			}
+			printDiagnostics(p.diagnostics(), cerr);
+			return object ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+
+		Parser p(inputName, input);
 		p.parse();
+		if(vectorizeReport) {
+			printDiagnostics(p.vectorization(), cerr);
+		}
+		printDiagnostics(p.diagnostics(), cerr);
 		return EXIT_SUCCESS;
 	}
 	else {
-		cerr << "File '" << argv[1] << "' not found" << endl;
+		cerr << "File '" << inputName << "' not found" << endl;
 		return EXIT_FAILURE;
 	}
 }
-
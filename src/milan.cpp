@@ -0,0 +1,107 @@
+#include "compiler.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+// Имена команд виртуальной машины (vm/vm.h) совпадают с именами
+// инструкций компилятора (codegen.h), поэтому объявления машины
+// подключаются в отдельном пространстве имен.
+namespace mvm {
+extern "C" {
+#include "vm.h"
+}
+}
+
+using namespace std;
+
+// Драйвер: компиляция программы и ее исполнение в одном процессе.
+// Программа передается виртуальной машине образом объектного файла
+// в памяти, без промежуточных файлов и запуска mvm.
+
+void printHelp()
+{
+	cout << "Usage: milan [--threaded | --tos | --jit | --reg] [--no-verify] input_file" << endl;
+}
+
+int main(int argc, char** argv)
+{
+	const char* inputName = NULL;
+	mvm::vm_engine engine = mvm::ENGINE_SWITCH;
+	bool verify = true;
+
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--threaded") == 0) {
+			engine = mvm::ENGINE_THREADED;
+		}
+		else if(strcmp(argv[i], "--tos") == 0) {
+			engine = mvm::ENGINE_TOS;
+		}
+		else if(strcmp(argv[i], "--jit") == 0) {
+			engine = mvm::ENGINE_JIT;
+		}
+		else if(strcmp(argv[i], "--reg") == 0) {
+			engine = mvm::ENGINE_REGISTER;
+		}
+		else if(strcmp(argv[i], "--no-verify") == 0) {
+			verify = false;
+		}
+		else if(argv[i][0] == '-' || inputName != NULL) {
+			printHelp();
+			return EXIT_FAILURE;
+		}
+		else {
+			inputName = argv[i];
+		}
+	}
+
+	if(inputName == NULL) {
+		printHelp();
+		return EXIT_FAILURE;
+	}
+
+	ifstream input(inputName);
+	if(!input) {
+		cerr << "File '" << inputName << "' not found" << endl;
+		return EXIT_FAILURE;
+	}
+
+	Compilation compilation = compile(input, inputName);
+	if(!compilation.ok) {
+		printDiagnostics(compilation.diagnostics, cerr);
+		return EXIT_FAILURE;
+	}
+
+	// Команды исполняются прямо из образа, поэтому он живет до конца
+	// работы. Память vector выделяется operator new и выровнена
+	// достаточно для слов образа.
+	vector<char> object = objectImage(compilation.program);
+	mvm::vm_image* image = mvm::vm_image_create();
+	if(image == NULL || mvm::vm_image_load(image, object.data(), object.size()) != mvm::VM_OK) {
+		cerr << "Unable to load program" << endl;
+		return EXIT_FAILURE;
+	}
+
+	if(verify) {
+		mvm::vm_image_verify(image);
+	}
+
+	mvm::vm_state* vm = mvm::vm_create(image);
+	if(vm == NULL) {
+		cerr << mvm::vm_status_text(mvm::VM_NO_MEMORY) << endl;
+		return EXIT_FAILURE;
+	}
+
+	mvm::vm_set_engine(vm, engine);
+	mvm::vm_status status = mvm::vm_run(vm);
+	if(status != mvm::VM_OK) {
+		if(status == mvm::VM_RUNTIME_ERROR) {
+			mvm::vm_print_error(vm, stderr);
+		}
+		cerr << mvm::vm_status_text(status);
+	}
+
+	mvm::vm_destroy(vm);
+	mvm::vm_image_destroy(image);
+	return status == mvm::VM_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
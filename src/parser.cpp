@@ -12,6 +12,17 @@ void Parser::parse()
 	}
 }
 
+bool Parser::compile(vector<Command>& result)
+{
+	program();
+	if(error_) {
+		return false;
+	}
+
+	result = codegen_->takeProgram();
+	return true;
+}
+
 void Parser::program()
 {
   // Резервируем место для команды
@@ -39,13 +50,13 @@ void Parser::program()
 
 void Parser::statementList()
 {
-	//	  Если список операторов пуст, очередной лексемой будет одна из возможных "закрывающих скобок": END, OD, ELSE, FI.
+	//	  Если список операторов пуст, очередной лексемой будет одна из возможных "закрывающих скобок": END, OD, ELSE, FI, '|', ESAC.
 	//	  В этом случае результатом разбора будет пустой блок (его список операторов равен null).
 	//	  Если очередная лексема не входит в этот список, то ее мы считаем началом оператора и вызываем метод statement. 
 	//    Признаком последнего оператора является отсутствие после оператора точки с запятой.
 	if(see(T_END) || see(T_OD) ||
       see(T_ELSE) || see(T_FI) ||
-      see(T_RETURN)) {
+      see(T_RETURN) || see(T_BAR) || see(T_ESAC)) {
 		return;
 	}
 	else {
@@ -67,21 +78,26 @@ void Parser::statement()
     bool new_var = false;
 		int varAddress = findVariable(varName);
     bool is_local_variable = false;
+  		next();
+
+    // Вызов встроенной операции не объявляет
+    // переменную
+    if (varAddress < 0 && findFunciton(varName) < 0 &&
+        see(T_LPAREN) && builtin(varName, false))
+    {
+      return;
+    }
+
     if (varAddress < 0)
     {
       new_var = true;
       varAddress = findOrAddVariable(varName);
-
-      if (in_function)
-      {
-        is_local_variable = findParam(varName);
-        // Резервируем место на стеке под переменную
-        codegen_->emit(PUSH, 0);
-      }
-
     }
 
-		next();
+    if (in_function)
+    {
+      is_local_variable = findParam(varName);
+    }
 
     if (see(T_LSPAREN))
     {
@@ -103,40 +119,19 @@ void Parser::statement()
         // адресным типом.
         variables_[varName].type = ADDRESS;
 
-        // Задаём место для массива
+        // Задаём место для массива. В функции
+        // оно войдёт в кадр, который выделяет
+        // пролог
         lastVar_ = lastVar_ + index - 1;
-
-        if (in_function)
-        {
-          for (int i = 0; i < index - 1; ++i)
-          {
-            codegen_->emit(PUSH, 100);
-          }
-        }
       }
       // Здесь мы присваиваем значение элементу массива
       // с определённым индексом.
       else
       {
-        // Сохраняем на стеке значение,
-        // лежащее в участке памяти,
-        // отведённом под временное хранеине
-        // значения выражения
-        if (!in_function)
-        {
-          codegen_->emit(LOAD, lastVar_ + 1);
-        }
         expression();
 
         mustBe(T_RSPAREN);
 
-        // Сохраняем вычисленный индекс во
-        // временную память
-        if (!in_function)
-        {
-          codegen_->emit(STORE, lastVar_ + 1);
-        }
-
         if (lastExpressionType_ != INTEGER)
         {
           reportError("index can't be an address"
@@ -146,48 +141,32 @@ void Parser::statement()
         mustBe(T_ASSIGN);
         expression();
 
-        // Загружаем из памяти значение
-        // индекса, складываем его с
-        // адресом начала массива и
-        // кладём туда значение выражения.
-
-        if (!is_local_variable &&
-            in_function)
-        {
-          codegen_->emit(SLOAD, varAddress);
-        }
-        else
-        {
-          codegen_->emit(PUSH, varAddress);
-        }
+        // Индекс остался на стеке под
+        // значением выражения. Меняем их
+        // местами и кладём значение по
+        // адресу начала массива + индекс
+        codegen_->emit(SWAP);
 
         if (in_function)
         {
-          codegen_->emit(SLOAD, lastVar_);
-          codegen_->emit(ADD);
           if (is_local_variable)
           {
-            codegen_->emit(SBSTORE, 0);
+            // Локальный массив лежит в кадре
+            codegen_->emit(SBSTORE, varAddress);
           }
           else
           {
+            // Параметр-ссылка хранит адрес
+            // массива в памяти данных
+            codegen_->emit(SLOAD, varAddress);
+            codegen_->emit(ADD);
             codegen_->emit(BSTORE, 0);
           }
-
-          codegen_->emit(POP);
-
         }
         else
         {
-          codegen_->emit(LOAD, lastVar_ + 1);
-          codegen_->emit(ADD);
-          codegen_->emit(BSTORE, 0);
-
-          // Восстанавливаем значение во
-          // временной ячейке памяти
-          codegen_->emit(STORE, lastVar_ + 1);
+          codegen_->emit(BSTORE, varAddress);
         }
-        
       }
     }
     else if (see(T_LPAREN))
@@ -198,24 +177,28 @@ void Parser::statement()
 
       if (fn_address >= 0)
       {
-        codegen_->emit(PUSH, 0);
-
+        // Параметры текущей функции нужны
+        // после вызова
+        vector<Parameter> params = lastParamsTypes_;
         lastParamsTypes_ = functions_[varName].params_types;
         int n_args = lastParamsTypes_.size();
 
         arguments();
 
-        lastParamsTypes_.clear();
+        lastParamsTypes_ = params;
 
         mustBe(T_RPAREN);
 
-        codegen_->emit(BP);
+        // Аргументы лежат на вершине стека, CALL
+        // переносит их в новый кадр
+        codegen_->emit(CALL, functions_[varName].addr, n_args);
 
-        int offset = codegen_->getCurrentAddress() + 4;
-        codegen_->emit(PUSH, offset);
-        codegen_->emit(SSTORE, -n_args - 1);
-        codegen_->emit(BP, -n_args);
-        codegen_->emit(JUMP, functions_[varName].addr);
+        // Значение, которое вернула функция,
+        // в операторе не используется
+        if (functions_[varName].is_returns)
+        {
+          codegen_->emit(POP);
+        }
       }
 
     }
@@ -278,6 +261,7 @@ void Parser::statement()
 	}
 
 	else if(match(T_WHILE)) {
+		int line = scanner_->getLineNumber();
 		//запоминаем адрес начала проверки условия.
 		int conditionAddress = codegen_->getCurrentAddress();
 		relation();
@@ -290,6 +274,95 @@ void Parser::statement()
 		codegen_->emit(JUMP, conditionAddress);
 		//заполняем зарезервированный адрес инструкцией условного перехода на следующий за циклом оператор.
 		codegen_->emitAt(jumpNoAddress, JUMP_NO, codegen_->getCurrentAddress());
+
+		// Цикл над массивом заменяем групповой инструкцией
+		string report;
+		if(codegen_->vectorizeLoop(conditionAddress, report)) {
+			vectorization_.push_back(Diagnostic{line, "loop " + report});
+		}
+		else {
+			vectorization_.push_back(Diagnostic{line, "loop not vectorized: " + report});
+		}
+	}
+	// Счетный цикл FOR i := a TO b [STEP s] DO ... OD равносилен
+	//     i := a; WHILE i <= b DO ...; i := i + s OD
+	// (i >= b при отрицательном шаге), но предел вычисляется один раз.
+	// Предел и шаг лежат на стеке все время исполнения цикла, а счетчик
+	// в конце тела увеличивает и сравнивает с пределом одна инструкция
+	// LOOP (SLOOP в функции). Начальное значение сравнивается с пределом
+	// один раз перед циклом. Цикл завершается и тогда, когда счетчик
+	// переполнился бы, поэтому предел может быть любым целым.
+	else if(match(T_FOR)) {
+		int varAddress = 0;
+		if(see(T_IDENTIFIER)) {
+			string varName = scanner_->getStringValue();
+			bool new_var = findVariable(varName) < 0;
+			next();
+
+			varAddress = findOrAddVariable(varName);
+			if(new_var) {
+				variables_[varName].type = INTEGER;
+			}
+			else if(variables_[varName].type != INTEGER) {
+				reportError("loop variable must be an integer variable.");
+			}
+		}
+		else {
+			reportError("loop variable expected.");
+		}
+
+		Instruction load = in_function ? SLOAD : LOAD;
+		Instruction store = in_function ? SSTORE : STORE;
+
+		mustBe(T_ASSIGN);
+		expression();
+		if(lastExpressionType_ != INTEGER) {
+			reportError("loop bounds can't be addresses.");
+		}
+		codegen_->emit(store, varAddress);
+
+		mustBe(T_TO);
+		expression();
+		if(lastExpressionType_ != INTEGER) {
+			reportError("loop bounds can't be addresses.");
+		}
+
+		// Шаг - целая константа, по умолчанию 1
+		int step = 1;
+		if(match(T_STEP)) {
+			bool negative = see(T_ADDOP) && scanner_->getArithmeticValue() == A_MINUS;
+			if(negative) {
+				next();
+			}
+			mustBe(T_NUMBER);
+			step = negative ? -scanner_->getIntValue() : scanner_->getIntValue();
+			if(step == 0) {
+				reportError("loop step can't be zero.");
+			}
+		}
+
+		// Если начальное значение уже за пределом, тело не исполняется
+		codegen_->emit(DUP);
+		codegen_->emit(load, varAddress);
+		codegen_->emit(COMPARE, (step > 0) ? 5 : 4);		// ">=" или "<="
+		//резервируем место под переход за цикл.
+		int exitAddress = codegen_->reserve();
+		codegen_->emit(PUSH, step);
+
+		int bodyAddress = codegen_->getCurrentAddress();
+		mustBe(T_DO);
+		statementList();
+		mustBe(T_OD);
+		codegen_->emit(in_function ? SLOOP : LOOP, varAddress, bodyAddress);
+
+		// Снимаем со стека шаг и предел (при выходе до первой итерации
+		// шага на стеке еще нет)
+		codegen_->emit(POP);
+		codegen_->emitAt(exitAddress, JUMP_NO, codegen_->getCurrentAddress());
+		codegen_->emit(POP);
+	}
+	else if(match(T_CASE)) {
+		caseStatement();
 	}
 	else if(match(T_WRITE)) {
 		mustBe(T_LPAREN);
@@ -361,35 +434,14 @@ void Parser::statement()
     }
     else if (see(T_LPAREN))
     {
-      // Используем свободную память, чтобы
-      // сохранить значение выражения. Перед
-      // этим сохраняем её значение
-      if (in_function)
-      {
-        codegen_->emit(SLOAD, lastVar_ + 1);
-      }
-      else
-      {
-        codegen_->emit(LOAD, lastVar_ + 1);
-      }
-
+      // Значение выражения - адрес, по
+      // которому положим значение следующего
+      // за присваиванием выражения. Он
+      // остаётся на стеке
       mustBe(T_LPAREN);
       expression();
       mustBe(T_RPAREN);
 
-      // Сохраняем значение выражения,
-      // выдающего адресс, по которому
-      // положим значение следующего за
-      // присваиванием выражения
-      if (in_function)
-      {
-        codegen_->emit(SSTORE, lastVar_ + 1);
-      }
-      else
-      {
-        codegen_->emit(STORE, lastVar_ + 1);
-      }
-
       if (lastExpressionType_ != ADDRESS)
       {
         reportError("only expression with"
@@ -401,24 +453,16 @@ void Parser::statement()
 
       if (lastExpressionType_ == INTEGER)
         {
-          // Загружаем из памяти адресс,
-          // по которому положим значение
+          // Адрес лежит под значением:
+          // меняем их местами
+          codegen_->emit(SWAP);
           if (in_function)
           {
-            codegen_->emit(SLOAD, lastVar_ + 1);
             codegen_->emit(SBSTORE, 0);
-
-            codegen_->emit(SSTORE, lastVar_ + 1);
           }
           else
           {
-            codegen_->emit(LOAD, lastVar_ + 1);
             codegen_->emit(BSTORE, 0);
-
-            // Освобождаем занятую под значение
-            // выражения память. Загружаем
-            // запомненное в начале значение
-            codegen_->emit(STORE, lastVar_ + 1);
           }
         }
         else
@@ -610,6 +654,12 @@ void Parser::factor()
 
 		next();
 
+    if (varAddress < 0 && fn_address < 0 &&
+        see(T_LPAREN) && builtin(varName, true))
+    {
+      return;
+    }
+
     if (varAddress >= 0)
     {
       // Если обращение к элементу массива
@@ -688,24 +738,19 @@ void Parser::factor()
           mustBe(T_LPAREN);
         }
 
-        codegen_->emit(PUSH, 0);
-
+        vector<Parameter> params = lastParamsTypes_;
         lastParamsTypes_ = functions_[varName].params_types;
         int n_args = lastParamsTypes_.size();
 
         arguments();
 
-        lastParamsTypes_.clear();
+        lastParamsTypes_ = params;
 
         mustBe(T_RPAREN);
 
-        codegen_->emit(BP);
-
-        int offset = codegen_->getCurrentAddress() + 4;
-        codegen_->emit(PUSH, offset);
-        codegen_->emit(SSTORE, -n_args - 1);
-        codegen_->emit(BP, -n_args);
-        codegen_->emit(JUMP, functions_[varName].addr);
+        // RET 1 оставляет значение функции
+        // на месте аргументов
+        codegen_->emit(CALL, functions_[varName].addr, n_args);
       }
       else
       {
@@ -819,6 +864,253 @@ void Parser::arguments()
   }
 }
 
+// Встроенные операции над массивами. Это не зарезервированные
+// слова: имя означает операцию, только если нет переменной или
+// функции с таким именем.
+struct Builtin
+{
+  Instruction instruction;
+  int arrays;   // число массивов среди аргументов
+  bool scalar;  // последний аргумент - число
+  bool value;   // операция возвращает значение
+};
+
+static const map<string, Builtin> builtins = {
+  {"fill", {VFILL, 1, true, false}},   // fill(a, n, v): a[i] := v
+  {"copy", {VCOPY, 2, false, false}},  // copy(a, b, n): a[i] := b[i]
+  {"adds", {VADDS, 1, true, false}},   // adds(a, n, v): a[i] := a[i] + v
+  {"muls", {VMULS, 1, true, false}},   // muls(a, n, v): a[i] := a[i] * v
+  {"addv", {VADD, 3, false, false}},   // addv(a, b, c, n): a[i] := b[i] + c[i]
+  {"sum", {VSUM, 1, false, true}},     // sum(a, n)
+  {"min", {VMIN, 1, false, true}},     // min(a, n)
+  {"max", {VMAX, 1, false, true}},     // max(a, n)
+};
+
+bool Parser::builtin(const string& name, bool value)
+{
+  map<string, Builtin>::const_iterator it = builtins.find(name);
+  if (it == builtins.end())
+  {
+    return false;
+  }
+
+  const Builtin& op = it->second;
+  if (value && !op.value)
+  {
+    reportError(name + " has no value and can't be"
+        " used in expressions.");
+  }
+
+  // Аргументы могут менять тип выражения,
+  // в которое входит вызов
+  VAR_TYPES type = lastExpressionType_;
+  int spaces = 0;
+
+  mustBe(T_LPAREN);
+  for (int i = 0; i < op.arrays; ++i)
+  {
+    if (i > 0)
+    {
+      mustBe(T_COMMA);
+    }
+    spaces |= arrayArgument() << i;
+  }
+
+  int n_scalars = op.scalar ? 2 : 1;
+  for (int i = 0; i < n_scalars; ++i)
+  {
+    mustBe(T_COMMA);
+    expression();
+
+    if (lastExpressionType_ != INTEGER)
+    {
+      reportError("array length and value can't be"
+          " address variables.");
+    }
+  }
+  mustBe(T_RPAREN);
+
+  // Диапазоны массивов машина проверяет
+  // один раз на весь вызов
+  codegen_->emit(op.instruction, spaces);
+
+  // Значение операции в операторе не используется
+  if (!value && op.value)
+  {
+    codegen_->emit(POP);
+  }
+
+  lastExpressionType_ = type;
+  return true;
+}
+
+int Parser::arrayArgument()
+{
+  if (!see(T_IDENTIFIER))
+  {
+    reportError("array name expected.");
+    return 0;
+  }
+
+  string varName = scanner_->getStringValue();
+  int varAddress = findVariable(varName);
+  next();
+
+  if (varAddress < 0)
+  {
+    reportError("only defined variable can be"
+        " used as an array.");
+    return 0;
+  }
+
+  // Массив - та же память, что и у элементов
+  // varName[i]: локальный массив лежит в кадре,
+  // параметр-ссылка хранит адрес массива в
+  // памяти данных
+  if (in_function)
+  {
+    if (findParam(varName))
+    {
+      codegen_->emit(PUSH, varAddress);
+      return 1;
+    }
+
+    codegen_->emit(SLOAD, varAddress);
+    return 0;
+  }
+
+  codegen_->emit(PUSH, varAddress);
+  return 0;
+}
+
+// Таблица переходов строится, если меток выбора не меньше
+// CASE_TABLE_MIN_LABELS и диапазон от наименьшей до наибольшей метки
+// не больше чем в CASE_TABLE_MAX_SPREAD раз длиннее их числа.
+static const int CASE_TABLE_MIN_LABELS = 4;
+static const int CASE_TABLE_MAX_SPREAD = 3;
+
+// Выбор CASE x OF k1, k2: ... | k3: ... [ELSE ...] ESAC исполняет ветвь,
+// среди меток которой есть значение x, или ветвь ELSE; если такой нет,
+// ничего не делает. Метки - целые константы.
+//
+// Вместо цепочки сравнений по числу ветвей ветвь выбирает код,
+// который строится после разбора всех ветвей, когда известны метки:
+//     <x>; JUMP L0; <ветви, каждая с JUMP L2>; L0: <выбор>; L2:
+// Плотные метки выбирает JUMP_TABLE, редкие - двоичный поиск.
+void Parser::caseStatement()
+{
+	expression();
+	if(lastExpressionType_ != INTEGER) {
+		reportError("case selector can't be an address.");
+	}
+	int dispatchAddress = codegen_->reserve();
+
+	// Метка и адрес ее ветви; переходы в конец выбора
+	map<int, int> labels;
+	vector<int> exits;
+
+	mustBe(T_OF);
+	do {
+		int armAddress = codegen_->getCurrentAddress();
+		do {
+			int label = caseLabel();
+			if(!labels.insert(make_pair(label, armAddress)).second) {
+				reportError("duplicate case label.");
+			}
+		} while(match(T_COMMA));
+		mustBe(T_COLON);
+		statementList();
+		exits.push_back(codegen_->reserve());
+	} while(match(T_BAR));
+
+	int defaultAddress = -1;
+	if(match(T_ELSE)) {
+		defaultAddress = codegen_->getCurrentAddress();
+		statementList();
+		exits.push_back(codegen_->reserve());
+	}
+	mustBe(T_ESAC);
+
+	codegen_->emitAt(dispatchAddress, JUMP, codegen_->getCurrentAddress());
+
+	vector<pair<int, int> > sorted(labels.begin(), labels.end());
+	int count = sorted.size();
+	int low = sorted.front().first;
+	long long range = (long long)sorted.back().first - low + 1;
+
+	if(count >= CASE_TABLE_MIN_LABELS && range <= (long long)CASE_TABLE_MAX_SPREAD * count) {
+		// Номер команды таблицы - x - low; пропуски в метках и
+		// значения вне диапазона ведут на ветвь по умолчанию
+		if(low != 0) {
+			codegen_->emit(PUSH, low);
+			codegen_->emit(SUB);
+		}
+		codegen_->emit(JUMP_TABLE, (int)range);
+		int k = 0;
+		for(int i = 0; i <= range; ++i) {
+			if(k < count && sorted[k].first - low == i) {
+				codegen_->emit(JUMP, sorted[k].second);
+				++k;
+			}
+			else if(defaultAddress >= 0) {
+				codegen_->emit(JUMP, defaultAddress);
+			}
+			else {
+				exits.push_back(codegen_->reserve());
+			}
+		}
+	}
+	else {
+		caseSearch(sorted, 0, count - 1, defaultAddress, exits);
+	}
+
+	for(int exit : exits) {
+		codegen_->emitAt(exit, JUMP, codegen_->getCurrentAddress());
+	}
+}
+
+int Parser::caseLabel()
+{
+	bool negative = see(T_ADDOP) && scanner_->getArithmeticValue() == A_MINUS;
+	if(negative) {
+		next();
+	}
+	int value = scanner_->getIntValue();
+	mustBe(T_NUMBER);
+	return negative ? -value : value;
+}
+
+// Выбор среди меток labels[first .. last] (по возрастанию). Значение
+// выбора лежит на вершине стека и снимается до перехода на ветвь;
+// если defaultAddress < 0, переходы по умолчанию добавляются в exits.
+void Parser::caseSearch(const vector<pair<int, int> >& labels, int first, int last,
+		int defaultAddress, vector<int>& exits)
+{
+	// Осталась одна метка: сравнение на равенство
+	if(first == last) {
+		codegen_->emit(PUSH, labels[first].first);
+		codegen_->emit(COMPARE, 1);		// "!="
+		codegen_->emit(JUMP_NO, labels[first].second);
+		if(defaultAddress >= 0) {
+			codegen_->emit(JUMP, defaultAddress);
+		}
+		else {
+			exits.push_back(codegen_->reserve());
+		}
+		return;
+	}
+
+	// x < labels[middle] - в левой половине, иначе в правой
+	int middle = (first + last + 1) / 2;
+	codegen_->emit(DUP);
+	codegen_->emit(PUSH, labels[middle].first);
+	codegen_->emit(COMPARE, 2);		// "<"
+	int jumpNoAddress = codegen_->reserve();
+	caseSearch(labels, first, middle - 1, defaultAddress, exits);
+	codegen_->emitAt(jumpNoAddress, JUMP_NO, codegen_->getCurrentAddress());
+	caseSearch(labels, middle, last, defaultAddress, exits);
+}
+
 void Parser::parameters()
 {
   Parameter param = {};
@@ -888,6 +1180,14 @@ void Parser::functions()
     vector<Parameter> params_types = lastParamsTypes_;
 
     int addr = codegen_->getCurrentAddress();
+    int paramsCount = lastVar_;
+
+    // Пролог выделяет кадр под все локальные
+    // переменные и массивы функции одной
+    // командой ALLOC. Размер кадра известен
+    // только в конце функции, поэтому место
+    // под команду резервируем
+    int allocAddress = codegen_->reserve();
 
     mustBe(T_BEGIN);
     statementList();
@@ -902,47 +1202,20 @@ void Parser::functions()
       // выражение, которое хотим
       // вернуть
       expression();
-
-      // Помещаем его в стек
-      // над адресом возврата
-      // и увеличиваем количество
-      // элементов на стеке (чтобы
-      // не удалить наше значение)
-      codegen_->emit(SSTORE, 0);
-      codegen_->emit(PUSH, 0);
     }
 
     lastParamsTypes_.clear();
     variables = variables_;
     lastVar = lastVar_;
 
-    for (int i = 0; i < lastVar; ++i)
-    {
-      codegen_->emit(POP);
-    }
-
-    if (is_returns)
-    {
-      // Меняем местами возвращаемое значение
-      // и адрес возврата. Для этого
-      // Сохраняем возвращаемое значение
-      codegen_->emit(SSTORE, 1);
-
-      // Резервируем место под адресом
-      // возврата
-      codegen_->emit(DUP);
-
-      // Восстанавливаем сохранённое значение
-      codegen_->emit(SLOAD, 1);
-
-      // Кладём его на зарезервированное
-      // место
-      codegen_->emit(SSTORE, -1);
-    }
+    codegen_->emitAt(allocAddress, ALLOC, lastVar_ - paramsCount);
 
-    // Вытаскиваем из стека адрес
-    // возврата и переходим по нему
-    codegen_->emit(SJUMP);
+    // RET снимает кадр с аргументами и
+    // локальными переменными, восстанавливает
+    // bp вызывающей функции и переходит по
+    // адресу возврата. Возвращаемое значение
+    // остаётся на вершине стека
+    codegen_->emit(RET, is_returns ? 1 : 0);
 
     mustBe(T_END);
 
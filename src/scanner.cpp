@@ -35,6 +35,14 @@ static const char * tokenNames_[] = {
   "'FUNCTION'",
   "','",
   "'RETURN'",
+  "'FOR'",
+  "'TO'",
+  "'STEP'",
+  "'CASE'",
+  "'OF'",
+  "'ESAC'",
+  "':'",
+  "'|'",
 };
 
 void Scanner::nextToken()
@@ -134,7 +142,7 @@ void Scanner::nextToken()
 				nextChar();
 				break;
 			//Если встречаем ":", то дальше смотрим наличие символа "=". Если находим, то считаем что нашли лексему присваивания
-			//Иначе - лексема ошибки.
+			//Иначе - двоеточие после меток ветви выбора.
 			case ':':
 				nextChar();
 				if(ch_ == '=') {
@@ -143,7 +151,7 @@ void Scanner::nextToken()
 				
 				}
 				else {
-					token_ = T_ILLEGAL;
+					token_ = T_COLON;
 				}
 				break;
 			//Если встретили символ "<", то либо следующий символ "=", тогда лексема нестрогого сравнения. Иначе - строгого.
@@ -249,6 +257,11 @@ void Scanner::nextToken()
 				nextChar();
 				break;
 
+			case '|':
+				token_ = T_BAR;
+				nextChar();
+				break;
+
 			//Иначе лексема ошибки.
 			default:
 				token_ = T_ILLEGAL;
@@ -2,6 +2,7 @@
 #include "vmparse.tab.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 extern FILE *yyin;
 int need_close = 0;
@@ -17,30 +18,149 @@ void milan_error(char const * msg)
 	exit(1);
 }
 
+/*   image  engine */
+void run(const vm_image *image, vm_engine engine)
+{
+        vm_state *vm = vm_create(image);
+        vm_status status;
+
+        if(NULL == vm) {
+                milan_error(vm_status_text(VM_NO_MEMORY));
+        }
+
+        vm_set_engine(vm, engine);
+        status = vm_run(vm);
+        if(VM_RUNTIME_ERROR == status) {
+                vm_print_error(vm, stderr);
+        }
+        if(VM_OK != status) {
+                milan_error(vm_status_text(status));
+        }
+
+        vm_destroy(vm);
+}
+
+void print_help()
+{
+        printf("Usage: mvm [--threaded | --tos | --jit | --reg] [--no-verify] [--emit-c output_file] [input_file]\n");
+        printf("       mvm [engine options] --batch inputs [--jobs n] [--quantum n | --lanes n] [--output directory] input_file\n");
+}
+
 int main(int argc, char **argv)
 {
-        if(argc < 2) {
+        char *file_name = NULL;
+        char *emit_name = NULL;
+        char *batch_inputs = NULL;
+        char *output_dir = NULL;
+        unsigned int jobs = 0;
+        int quantum = 0;
+        unsigned int lanes = 0;
+        vm_image *image = vm_default_image();
+        vm_engine engine = ENGINE_SWITCH;
+        vm_status loaded = VM_NOT_OBJECT;
+        int verify = 1;
+        int status = 0;
+        int i;
+
+        for(i = 1; i < argc; ++i) {
+                if(0 == strcmp(argv[i], "--threaded")) {
+                        engine = ENGINE_THREADED;
+                }
+                else if(0 == strcmp(argv[i], "--tos")) {
+                        engine = ENGINE_TOS;
+                }
+                else if(0 == strcmp(argv[i], "--jit")) {
+                        engine = ENGINE_JIT;
+                }
+                else if(0 == strcmp(argv[i], "--reg")) {
+                        engine = ENGINE_REGISTER;
+                }
+                else if(0 == strcmp(argv[i], "--no-verify")) {
+                        verify = 0;
+                }
+                else if(0 == strcmp(argv[i], "--emit-c") && i + 1 < argc) {
+                        emit_name = argv[++i];
+                }
+                else if(0 == strcmp(argv[i], "--batch") && i + 1 < argc) {
+                        batch_inputs = argv[++i];
+                }
+                else if(0 == strcmp(argv[i], "--jobs") && i + 1 < argc) {
+                        jobs = (unsigned int)atoi(argv[++i]);
+                }
+                else if(0 == strcmp(argv[i], "--quantum") && i + 1 < argc) {
+                        quantum = atoi(argv[++i]);
+                }
+                else if(0 == strcmp(argv[i], "--lanes") && i + 1 < argc) {
+                        lanes = (unsigned int)atoi(argv[++i]);
+                }
+                else if(0 == strcmp(argv[i], "--output") && i + 1 < argc) {
+                        output_dir = argv[++i];
+                }
+                else if('-' == argv[i][0] && '\0' != argv[i][1]) {
+                        print_help();
+                        return 1;
+                }
+                else {
+                        file_name = argv[i];
+                }
+        }
+
+        /*        */
+        if(quantum > 0 && NULL != batch_inputs && ENGINE_SWITCH != engine && ENGINE_THREADED != engine) {
+                printf("--quantum can't be used with --tos, --jit or --reg\n");
+                return 1;
+        }
+#if defined(_WIN32)
+        /*     Windows  (vmsched.c) */
+        if(quantum > 0 && NULL != batch_inputs) {
+                printf("--quantum is not supported on Windows\n");
+                return 1;
+        }
+#endif
+
+        if(NULL == file_name) {
                 yyin = stdin;
                 printf("Reading input from stdin\n");
         }
+        else if(VM_NOT_OBJECT != (loaded = vm_image_load_file(image, file_name))) {
+                /*    ,   */
+                if(VM_OK != loaded) {
+                        milan_error(vm_status_text(loaded));
+                }
+                printf("Reading input from %s\n", file_name);
+        }
         else {
-                yyin = fopen(argv[1], "rt");
+                yyin = fopen(file_name, "rt");
                 if(!yyin) {
-                        printf("Unable to read %s\n", argv[1]);
+                        printf("Unable to read %s\n", file_name);
                         return 1;
                 }
                 
                 need_close = 1;
-                printf("Reading input from %s\n", argv[1]);
+                printf("Reading input from %s\n", file_name);
         }
         
-        if(0 == yyparse()) {
-                run();
+        if(VM_OK == loaded || 0 == yyparse()) {
+                if(verify) {
+                        vm_image_verify(image);
+                }
+
+                if(NULL != batch_inputs) {
+                        status = !vm_run_batch(image, engine, batch_inputs, jobs, output_dir,
+                                quantum, lanes);
+                }
+                else if(NULL == emit_name) {
+                        run(image, engine);
+                }
+                else if(!vm_emit_c(image, emit_name)) {
+                        printf("Unable to write %s\n", emit_name);
+                        status = 1;
+                }
         }
 
         if(need_close) {
                 fclose(yyin);
         }
                 
-        return 0;
+        return status;
 }
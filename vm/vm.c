@@ -1,225 +1,325 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include "vm.h"
+#include <string.h>
+#include <limits.h>
+#include "vmint.h"
 
 void milan_error();
 
-command vm_program[MAX_PROGRAM_SIZE];
-
-int vm_memory[MAX_MEMORY_SIZE];
-int vm_stack[MAX_STACK_SIZE];
-
-unsigned int vm_stack_pointer = 0;
-unsigned int vm_base_pointer = 0;
-unsigned int vm_command_pointer = 0;
+/* ,        */
+static vm_image default_image;
 
 opcode_info opcodes_table[] = {
-        {"NOP",      0},
-        {"STOP",     0},
-        {"LOAD",     1},
-        {"STORE",    1},
-        {"BLOAD",    1},
-        {"BSTORE",   1},
-        {"PUSH",     1},
-        {"POP",      0},
-        {"DUP",      0},
-        {"INVERT",   0},
-        {"ADD",      0},
-        {"SUB",      0},
-        {"MULT",     0},
-        {"DIV",      0},
-        {"COMPARE",  1},
-        {"JUMP",     1},
-        {"JUMP_YES", 1},
-        {"JUMP_NO",  1},
-        {"INPUT",    0},
-        {"PRINT",    0},
-        {"SLOAD",    1},
-        {"SSTORE",   1},
-        {"SJUMP",    0},
-        {"BP",		   1},
-        {"SBLOAD",   1},
-        {"SBSTORE",  1},
+        {"NOP",      0, 0, 0},
+        {"STOP",     0, 0, 0},
+        {"LOAD",     1, 0, 1},
+        {"STORE",    1, 1, 0},
+        {"BLOAD",    1, 1, 1},
+        {"BSTORE",   1, 2, 0},
+        {"PUSH",     1, 0, 1},
+        {"POP",      0, 1, 0},
+        {"DUP",      0, 1, 2},
+        {"INVERT",   0, 1, 1},
+        {"ADD",      0, 2, 1},
+        {"SUB",      0, 2, 1},
+        {"MULT",     0, 2, 1},
+        {"DIV",      0, 2, 1},
+        {"COMPARE",  1, 2, 1},
+        {"JUMP",     1, 0, 0},
+        {"JUMP_YES", 1, 1, 0},
+        {"JUMP_NO",  1, 1, 0},
+        {"INPUT",    0, 0, 1},
+        {"PRINT",    0, 1, 0},
+        {"SLOAD",    1, 0, 1},
+        {"SSTORE",   1, 1, 0},
+        {"SJUMP",    0, 1, 0},
+        {"BP",       1, 0, 0},
+        {"SBLOAD",   1, 1, 1},
+        {"SBSTORE",  1, 2, 0},
+        {"PUSH_ADD", 1, 1, 1},
+        {"PUSH_SUB", 1, 1, 1},
+        {"PUSH_MULT", 1, 1, 1},
+        {"PUSH_DIV", 1, 1, 1},
+        {"LOAD_ADD", 1, 1, 1},
+        {"SLOAD_ADD", 1, 1, 1},
+        {"INC",      2, 0, 0},
+        {"SINC",     2, 0, 0},
+        {"COMPARE_JUMP_NO", 2, 2, 0},
+        {"CALL",     2, 0, 0},
+        {"RET",      1, 0, 0},
+        {"ALLOC",    1, 0, 0},
+        {"SWAP",     0, 2, 2},
+        {"SHL",      1, 1, 1},
+        {"SHR",      1, 1, 1},
+        {"AND",      0, 2, 1},
+        {"OR",       0, 2, 1},
+        {"XOR",      0, 2, 1},
+        {"VFILL",    1, 3, 0},
+        {"VCOPY",    1, 3, 0},
+        {"VADDS",    1, 3, 0},
+        {"VMULS",    1, 3, 0},
+        {"VADD",     1, 4, 0},
+        {"VSUM",     1, 2, 1},
+        {"VMIN",     1, 2, 1},
+        {"VMAX",     1, 2, 1},
+        {"LOOP",     2, 2, 2},
+        {"SLOOP",    2, 2, 2},
+        {"JUMP_TABLE", 1, 1, 0},
 };
 
 int opcodes_table_size = sizeof(opcodes_table) / sizeof(opcode_info);
 
-typedef enum {
-        BAD_DATA_ADDRESS,
-        BAD_CODE_ADDRESS,
-        BAD_RELATION,
-        STACK_OVERFLOW,
-        STACK_EMPTY,
-        DIVISION_BY_ZERO,
-        BAD_INPUT,
-        UNKNOWN_COMMAND,
-        STACK_CORRUPTED,
-} runtime_error;
+void vm_error(vm_state *vm, runtime_error error)
+{
+        vm->error = error;
+        vm_fail(vm, VM_RUNTIME_ERROR);
+}
+
+void vm_fail(vm_state *vm, vm_status status)
+{
+        vm->status = status;
+        longjmp(vm->failure, 1);
+}
 
-void vm_init()
+void* vm_allocate(vm_state *vm, size_t size)
 {
-	vm_stack_pointer = 0;
-	vm_base_pointer = 0;
-	vm_command_pointer = 0;
+        void *buffer = malloc(size);
+
+        if(NULL == buffer) {
+                vm_fail(vm, VM_NO_MEMORY);
+        }
+        return buffer;
 }
 
-void vm_error(runtime_error error)
+void vm_print_error(const vm_state *vm, FILE *out)
 {
 	opcode_info* info;
+        command cmd = vm_fetch(vm->image, vm->command_pointer);
 
-        switch(error) {
+        switch(vm->error) {
         case BAD_DATA_ADDRESS:
-                fprintf(stderr, "Error: illegal data address\n");
+                fprintf(out, "Error: illegal data address\n");
                 break;
 
         case BAD_CODE_ADDRESS:
-                fprintf(stderr, "Error: illegal address in JUMP* instruction\n");
+                fprintf(out, "Error: illegal address in JUMP* instruction\n");
                 break;
 
         case BAD_RELATION:
-                fprintf(stderr, "Error: illegal comparison operator\n");
+                fprintf(out, "Error: illegal comparison operator\n");
                 break;
 
         case STACK_OVERFLOW:
-                fprintf(stderr, "Error: stack overflow\n");
+                fprintf(out, "Error: stack overflow\n");
                 break;
 
         case STACK_EMPTY:
-                fprintf(stderr, "Error: stack is empty (no arguments are available)\n");
+                fprintf(out, "Error: stack is empty (no arguments are available)\n");
                 break;
 
         case DIVISION_BY_ZERO:
-                fprintf(stderr, "Error: division by zero\n");
+                fprintf(out, "Error: division by zero\n");
                 break;
 
         case BAD_INPUT:
-                fprintf(stderr, "Error: illegal input\n");
+                fprintf(out, "Error: illegal input\n");
                 break;
 
         case UNKNOWN_COMMAND:
-                fprintf(stderr, "Error: unknown command, unable to execute\n");
+                fprintf(out, "Error: unknown command, unable to execute\n");
                 break;
 
         case STACK_CORRUPTED:
-                fprintf(stderr, "Error: offset goes out of a stack boundaries\n");
+                fprintf(out, "Error: offset goes out of a stack boundaries\n");
                 break;
 
         default:
-                fprintf(stderr, "Error: runtime error %d\n", error);
+                fprintf(out, "Error: runtime error %d\n", vm->error);
         }
 	
-	fprintf(stderr, "Code:\n\n");
+	fprintf(out, "Code:\n\n");
 
-        info = operation_info(vm_program[vm_command_pointer].operation);
+        info = operation_info(cmd.operation);
 	if(NULL == info) {
-		fprintf(stderr, "%d\t(%d)\t\t%d\n", vm_command_pointer, 
-			vm_program[vm_command_pointer].operation,
-			vm_program[vm_command_pointer].arg);
+		fprintf(out, "%d\t(%d)\t\t%d\n", vm->command_pointer, 
+			cmd.operation,
+			cmd.arg);
 	}
 	else {
-                if(info->need_arg) {
-                        fprintf(stderr, "\t%d\t%s\t\t%d\n", vm_command_pointer, info->name,
-                                vm_program[vm_command_pointer].arg);
+                if(2 == info->need_arg) {
+                        fprintf(out, "\t%d\t%s\t\t%d\t%d\n", vm->command_pointer, info->name,
+                                cmd.arg,
+                                cmd.arg2);
+                }
+                else if(info->need_arg) {
+                        fprintf(out, "\t%d\t%s\t\t%d\n", vm->command_pointer, info->name,
+                                cmd.arg);
                 }
                 else {
-                        fprintf(stderr, "\t%d\t%s\n", vm_command_pointer, info->name);
+                        fprintf(out, "\t%d\t%s\n", vm->command_pointer, info->name);
                 }
         }
-
-        milan_error("VM error");
 }
 
-int vm_load(unsigned int address)
+static int vm_load(vm_state *vm, unsigned int address)
 {
         if(address < MAX_MEMORY_SIZE) {
-                return vm_memory[address];
+                return vm->memory[address];
         }
         else {
-                vm_error(BAD_DATA_ADDRESS);
+                vm_error(vm, BAD_DATA_ADDRESS);
                 return 0;
         }
 }
 
-void vm_store(unsigned int address, int word)
+static void vm_store(vm_state *vm, unsigned int address, int word)
 {
         if(address < MAX_MEMORY_SIZE) {
-                vm_memory[address] = word;
+                vm->memory[address] = word;
         }
         else {
-                vm_error(BAD_DATA_ADDRESS);
+                vm_error(vm, BAD_DATA_ADDRESS);
         }
 }
 
-int vm_read()
+int vm_read(vm_state *vm)
 {
         int n;
 
-	fprintf(stderr, "> "); fflush(stdout);
-        if(scanf("%d", &n)) {
+        /*      ,  
+         *  
+         */
+        if(!vm->prompted) {
+                fprintf(vm->output, "> "); fflush(stdout);
+                vm->prompted = 1;
+        }
+        if(NULL != vm->read_input ? vm->read_input(vm, &n) : fscanf(vm->input, "%d", &n)) {
+                vm->prompted = 0;
                 return n;
         }
         else {
-                vm_error(BAD_INPUT);
+                vm_error(vm, BAD_INPUT);
                 return 0;
         }
 }
 
-void vm_write(int n)
+void vm_write(vm_state *vm, int n)
 {
-        fprintf(stderr, "%d\n", n);
+        fprintf(vm->output, "%d\n", n);
 }
 
-int vm_pop()
+static int vm_pop(vm_state *vm)
 {
-	if(vm_stack_pointer > 0) {
-		return vm_stack[--vm_stack_pointer];
+	if(vm->stack_pointer > 0) {
+		return vm->stack[--vm->stack_pointer];
 	}
 	else {
-		vm_error(STACK_EMPTY);
+		vm_error(vm, STACK_EMPTY);
                 return 0;
 	}
 }
 
-void vm_push(int word)
+static void vm_push(vm_state *vm, int word)
 {
-	if(vm_stack_pointer < MAX_STACK_SIZE) {
-		vm_stack[vm_stack_pointer++] = word;
+	if(vm->stack_pointer < MAX_STACK_SIZE) {
+		vm->stack[vm->stack_pointer++] = word;
 	}
 	else {
-		vm_error(STACK_OVERFLOW);
+		vm_error(vm, STACK_OVERFLOW);
 	}
 }
 
-int vm_sload(int offset)
+static int vm_sload(vm_state *vm, int offset)
 {
-	if(vm_base_pointer + offset >= 0 &&
-			vm_base_pointer + offset < MAX_STACK_SIZE) {
-		return vm_stack[vm_base_pointer + offset];
+	if(vm->base_pointer + offset >= 0 &&
+			vm->base_pointer + offset < MAX_STACK_SIZE) {
+		return vm->frames[vm->base_pointer + offset];
 	}
 	else {
-		vm_error(STACK_CORRUPTED);
+		vm_error(vm, STACK_CORRUPTED);
 		return 0;
 	}
 }
 
-void vm_sstore(int offset, int word)
+static void vm_sstore(vm_state *vm, int offset, int word)
 {
-	if(vm_base_pointer + offset >= 0 &&
-			vm_base_pointer + offset < MAX_STACK_SIZE) {
-		vm_stack[vm_base_pointer + offset] = word;
+	if(vm->base_pointer + offset >= 0 &&
+			vm->base_pointer + offset < MAX_STACK_SIZE) {
+		vm->frames[vm->base_pointer + offset] = word;
 	}
 	else {
-		vm_error(STACK_CORRUPTED);
+		vm_error(vm, STACK_CORRUPTED);
 	}
 }
 
-int vm_run_command()
+void vm_call(vm_state *vm, unsigned int address, unsigned int n)
 {
-	unsigned int index = vm_command_pointer;
+        unsigned int base = vm->frame_top;
 
-        operation op = vm_program[index].operation;
-        unsigned int arg = vm_program[index].arg;
+        if(n > vm->stack_pointer) {
+                vm_error(vm, STACK_EMPTY);
+        }
+        if(base + 2 + n > MAX_STACK_SIZE) {
+                vm_error(vm, STACK_OVERFLOW);
+        }
+
+        /*         */
+        vm->stack_pointer -= n;
+        memcpy(vm->frames + base + 2, vm->stack + vm->stack_pointer, n * sizeof(int));
+        vm->frames[base] = (int)address;
+        vm->frames[base + 1] = (int)vm->base_pointer;
+        vm->base_pointer = base + 2;
+        vm->frame_top = base + 2 + n;
+}
+
+void vm_return(vm_state *vm, int results)
+{
+        unsigned int bp = vm->base_pointer;
+
+        if(results < 0 || results > 1) {
+                vm_error(vm, UNKNOWN_COMMAND);
+        }
+        if((unsigned int)results > vm->stack_pointer) {
+                vm_error(vm, STACK_EMPTY);
+        }
+        if(bp < 2 || bp > MAX_STACK_SIZE) {
+                vm_error(vm, STACK_CORRUPTED);
+        }
+
+        /*       */
+        vm->command_pointer = (unsigned int)vm->frames[bp - 2];
+        vm->base_pointer = (unsigned int)vm->frames[bp - 1];
+        vm->frame_top = bp - 2;
+}
+
+void vm_alloc(vm_state *vm, int n)
+{
+        if(n < 0 || vm->frame_top + (unsigned int)n > MAX_STACK_SIZE) {
+                vm_error(vm, STACK_OVERFLOW);
+        }
+
+        memset(vm->frames + vm->frame_top, 0, n * sizeof(int));
+        vm->frame_top += n;
+}
+
+int vm_run_command(vm_state *vm)
+{
+	unsigned int index = vm->command_pointer;
+        command cmd = vm_fetch(vm->image, index);
+
+        operation op = cmd.operation;
+        unsigned int arg = cmd.arg;
+        int arg2 = cmd.arg2;
         int data;
+        int under;
+        opcode_info *info;
+
+/*    . vm_error(vm)   ,
+ *       .
+ *    .
+ */
+#define QUICKEN(quick) \
+        (vm->quick_code[index] = (vm->quick_code[index] & ~PACKED_CODE_MASK) | (quick))
 
         switch(op) {
         case NOP:
@@ -231,188 +331,527 @@ int vm_run_command()
                 break;
                 
         case LOAD:
-                vm_push(vm_load(arg));
+                vm_push(vm, vm_load(vm, arg));
                 break;
 
         case STORE:
-                vm_store(arg, vm_pop());
+                vm_store(vm, arg, vm_pop(vm));
                 break;
 
         case BLOAD:
-                vm_push(vm_load(arg + vm_pop()));
+                vm_push(vm, vm_load(vm, arg + vm_pop(vm)));
                 break;
 
         case BSTORE:
-                data = vm_pop();
-                vm_store(arg + data, vm_pop());
+                data = vm_pop(vm);
+                vm_store(vm, arg + data, vm_pop(vm));
                 break;
 
         case PUSH:
-                vm_push(arg);
+                vm_push(vm, arg);
                 break;
 
         case POP:
-                vm_pop();
+                vm_pop(vm);
                 break;
 
         case DUP:
-                data = vm_pop();
-                vm_push(data);
-                vm_push(data);
+                data = vm_pop(vm);
+                vm_push(vm, data);
+                vm_push(vm, data);
                 break;
 
         case INVERT:
-                vm_push(-vm_pop());
+                vm_push(vm, -vm_pop(vm));
+                break;
+
+        case SWAP:
+                data = vm_pop(vm);
+                under = vm_pop(vm);
+                vm_push(vm, data);
+                vm_push(vm, under);
+                break;
+
+        case SHL:
+                vm_push(vm, (int)((unsigned int)vm_pop(vm) << (arg & 31)));
+                break;
+
+        case SHR:
+                vm_push(vm, vm_pop(vm) >> (arg & 31));
+                break;
+
+        case AND:
+                data = vm_pop(vm);
+                vm_push(vm, vm_pop(vm) & data);
+                break;
+
+        case OR:
+                data = vm_pop(vm);
+                vm_push(vm, vm_pop(vm) | data);
+                break;
+
+        case XOR:
+                data = vm_pop(vm);
+                vm_push(vm, vm_pop(vm) ^ data);
+                break;
+
+        case VFILL:
+        case VCOPY:
+        case VADDS:
+        case VMULS:
+        case VADD:
+        case VSUM:
+        case VMIN:
+        case VMAX:
+                info = operation_info(op);
+                if(vm->stack_pointer < (unsigned int)info->pop) {
+                        vm_error(vm, STACK_EMPTY);
+                }
+                data = vm_bulk(vm, op, arg, vm->stack + vm->stack_pointer - info->pop,
+                        vm->base_pointer);
+                if(data >= 0) {
+                        vm_error(vm, (runtime_error)data);
+                }
+                vm->stack_pointer -= info->pop - info->push;
                 break;
 
         case ADD:
-                data = vm_pop();
-                vm_push(vm_pop() + data);
+                data = vm_pop(vm);
+                vm_push(vm, vm_pop(vm) + data);
                 break;
 
         case SUB:
-                data = vm_pop();
-                vm_push(vm_pop() - data);
+                data = vm_pop(vm);
+                vm_push(vm, vm_pop(vm) - data);
                 break;
 
         case MULT:
-                data = vm_pop();
-                vm_push(vm_pop() * data);
+                data = vm_pop(vm);
+                vm_push(vm, vm_pop(vm) * data);
                 break;
 
         case DIV:
-                data = vm_pop();
+                data = vm_pop(vm);
                 if(0 == data) {
-                        vm_error(DIVISION_BY_ZERO);
+                        vm_error(vm, DIVISION_BY_ZERO);
                 }
                 else {
-                        vm_push(vm_pop() / data);
+                        vm_push(vm, vm_pop(vm) / data);
                 }
                 break;
 
         case COMPARE:
-                data = vm_pop();
+                data = vm_pop(vm);
                 switch(arg) {
                 case EQ:
-                        vm_push((vm_pop() == data) ? 1 : 0);
+                        vm_push(vm, (vm_pop(vm) == data) ? 1 : 0);
                         break;
 
                 case NE:
-                        vm_push((vm_pop() != data) ? 1 : 0);
+                        vm_push(vm, (vm_pop(vm) != data) ? 1 : 0);
                         break;
 
                 case LT:
-                        vm_push((vm_pop() < data) ? 1 : 0);
+                        vm_push(vm, (vm_pop(vm) < data) ? 1 : 0);
                         break;
 
                 case GT:
-                        vm_push((vm_pop() > data) ? 1 : 0);
+                        vm_push(vm, (vm_pop(vm) > data) ? 1 : 0);
                         break;
 
                 case LE:
-                        vm_push((vm_pop() <= data) ? 1 : 0);
+                        vm_push(vm, (vm_pop(vm) <= data) ? 1 : 0);
                         break;
 
                 case GE:
-                        vm_push((vm_pop() >= data) ? 1 : 0);
+                        vm_push(vm, (vm_pop(vm) >= data) ? 1 : 0);
                         break;
 
                 default:
-                        vm_error(BAD_RELATION);
+                        vm_error(vm, BAD_RELATION);
                 }
-                break;
+                QUICKEN(QUICK_COMPARE(arg));
+                ++vm->command_pointer;
+                return 1;
 
         case JUMP:
                 if(arg < MAX_PROGRAM_SIZE) {
-                        vm_command_pointer = arg;
+                        QUICKEN(QUICK(JUMP));
+                        vm->command_pointer = arg;
                         return 1;
                 }
                 else {
-                        vm_error(BAD_CODE_ADDRESS);
+                        vm_error(vm, BAD_CODE_ADDRESS);
                 }
                         
                 break;
 
         case JUMP_YES:
                 if(arg < MAX_PROGRAM_SIZE) {
-                        data = vm_pop();
+                        data = vm_pop(vm);
+                        QUICKEN(QUICK(JUMP_YES));
                         if(data) {
-                                vm_command_pointer = arg;
+                                vm->command_pointer = arg;
                                 return 1;
                         }
                 }
                 else {
-                        vm_error(BAD_CODE_ADDRESS);
+                        vm_error(vm, BAD_CODE_ADDRESS);
                 }
                 break;
 
         case JUMP_NO:
                 if(arg < MAX_PROGRAM_SIZE) {
-                        data = vm_pop();
+                        data = vm_pop(vm);
+                        QUICKEN(QUICK(JUMP_NO));
                         if(!data) {
-                                vm_command_pointer = arg;
+                                vm->command_pointer = arg;
                                 return 1;
                         }
                 }
                 else {
-                        vm_error(BAD_CODE_ADDRESS);
+                        vm_error(vm, BAD_CODE_ADDRESS);
                 }
                 break;
 
         case INPUT:
-                vm_push(vm_read());
+                vm_push(vm, vm_read(vm));
                 break;
 
         case PRINT:
-		vm_write(vm_pop());
+		vm_write(vm, vm_pop(vm));
                 break;
 
 				case SLOAD:
-					vm_push(vm_sload(arg));
+					vm_push(vm, vm_sload(vm, arg));
 					break;
 
 				case SSTORE:
-					vm_sstore(arg, vm_pop());
+					vm_sstore(vm, arg, vm_pop(vm));
 					break;
 
         case SJUMP:
 					if(arg < MAX_PROGRAM_SIZE) {
-							vm_command_pointer = vm_pop();
+							vm->command_pointer = vm_pop(vm);
+							QUICKEN(QUICK(SJUMP));
 							return 1;
 					}
 					else {
-									vm_error(BAD_CODE_ADDRESS);
+									vm_error(vm, BAD_CODE_ADDRESS);
 					}
 					break;
 
 				case BP:
-					vm_base_pointer = vm_stack_pointer + arg;
+					vm->base_pointer = vm->stack_pointer + arg;
 					break;
 
 				case SBLOAD:
-					vm_push(vm_sload(arg + vm_pop()));
+					vm_push(vm, vm_sload(vm, arg + vm_pop(vm)));
 					break;
 
 				case SBSTORE:
-					int offset = vm_pop();
-					vm_sstore(arg + offset, vm_pop());
+					int offset = vm_pop(vm);
+					vm_sstore(vm, arg + offset, vm_pop(vm));
 					break;
 
+        case PUSH_ADD:
+                vm_push(vm, vm_pop(vm) + (int)arg);
+                break;
+
+        case PUSH_SUB:
+                vm_push(vm, vm_pop(vm) - (int)arg);
+                break;
+
+        case PUSH_MULT:
+                vm_push(vm, vm_pop(vm) * (int)arg);
+                break;
+
+        case PUSH_DIV:
+                if(0 == arg) {
+                        vm_error(vm, DIVISION_BY_ZERO);
+                }
+                else {
+                        vm_push(vm, vm_pop(vm) / (int)arg);
+                }
+                break;
+
+        case LOAD_ADD:
+                data = vm_load(vm, arg);
+                vm_push(vm, vm_pop(vm) + data);
+                break;
+
+        case SLOAD_ADD:
+                data = vm_sload(vm, arg);
+                vm_push(vm, vm_pop(vm) + data);
+                break;
+
+        case INC:
+                vm_store(vm, arg, vm_load(vm, arg) + arg2);
+                break;
+
+        case SINC:
+                vm_sstore(vm, arg, vm_sload(vm, arg) + arg2);
+                break;
+
+        case COMPARE_JUMP_NO:
+                /*     ,   JUMP_NO */
+                if((unsigned int)arg2 >= MAX_PROGRAM_SIZE) {
+                        vm_error(vm, BAD_CODE_ADDRESS);
+                }
+                data = vm_pop(vm);
+                switch(arg) {
+                case EQ: data = (vm_pop(vm) == data); break;
+                case NE: data = (vm_pop(vm) != data); break;
+                case LT: data = (vm_pop(vm) <  data); break;
+                case GT: data = (vm_pop(vm) >  data); break;
+                case LE: data = (vm_pop(vm) <= data); break;
+                case GE: data = (vm_pop(vm) >= data); break;
+                default:
+                        vm_error(vm, BAD_RELATION);
+                }
+                /*       ,  
+                 *     .
+                 */
+                vm->quick_code[index] = PACK(QUICK_COMPARE_JUMP_NO(arg), arg2);
+                vm->command_pointer = data ? index + 1 : (unsigned int)arg2;
+                return 1;
+
+        case LOOP:
+        case SLOOP:
+                if((unsigned int)arg2 >= MAX_PROGRAM_SIZE) {
+                        vm_error(vm, BAD_CODE_ADDRESS);
+                }
+                if(vm->stack_pointer < 2) {
+                        vm_error(vm, STACK_EMPTY);
+                }
+                under = vm->stack[vm->stack_pointer - 1];
+                if(LOOP == op) {
+                        data = LOOP_NEXT(vm_load(vm, arg), under);
+                        vm_store(vm, arg, data);
+                }
+                else {
+                        data = LOOP_NEXT(vm_sload(vm, arg), under);
+                        vm_sstore(vm, arg, data);
+                }
+                QUICKEN(QUICK(op));
+                vm->command_pointer =
+                        LOOP_CONTINUES(data, vm->stack[vm->stack_pointer - 2], under) ?
+                        (unsigned int)arg2 : index + 1;
+                return 1;
+
+        case JUMP_TABLE:
+                /*        */
+                if(arg >= MAX_PROGRAM_SIZE - index - 1) {
+                        vm_error(vm, BAD_CODE_ADDRESS);
+                }
+                data = vm_pop(vm);
+                QUICKEN(QUICK(JUMP_TABLE));
+                vm->command_pointer = index + 1 + JUMP_TABLE_ENTRY(data, arg);
+                return 1;
+
+        case CALL:
+                if(arg >= MAX_PROGRAM_SIZE) {
+                        vm_error(vm, BAD_CODE_ADDRESS);
+                }
+                vm_call(vm, index + 1, (unsigned int)arg2);
+                QUICKEN(QUICK(CALL));
+                vm->command_pointer = arg;
+                return 1;
+
+        case RET:
+                vm_return(vm, (int)arg);
+                QUICKEN(QUICK(RET));
+                return 1;
+
+        case ALLOC:
+                vm_alloc(vm, (int)arg);
+                break;
+
         default:
-		vm_error(UNKNOWN_COMMAND);
+		vm_error(vm, UNKNOWN_COMMAND);
         }
 
-        ++vm_command_pointer;
+        QUICKEN(QUICK(op));
+        ++vm->command_pointer;
         return 1;
+
+#undef QUICKEN
 }
 
-void run()
+/*       
+ *     ,    .
+ */
+static int run_verified(vm_state *vm)
 {
-	vm_command_pointer = 0;
-	while(vm_command_pointer < MAX_PROGRAM_SIZE) {
-		if(!vm_run_command())
-			break;
-	}
+        switch(vm->engine) {
+        case ENGINE_JIT:
+                return run_jit(vm);
+
+        case ENGINE_REGISTER:
+                return run_register(vm);
+
+        case ENGINE_TOS:
+                return run_tos(vm);
+
+        default:
+                return run_unchecked(vm);
+        }
+}
+
+vm_status vm_run_with(vm_state *vm, int (*run)(vm_state *vm))
+{
+        vm->status = VM_OK;
+        if(0 != setjmp(vm->failure)) {
+                /* vm_error()  vm_fail() */
+                return vm->status;
+        }
+
+        if(NULL != run && run(vm)) {
+                return VM_OK;
+        }
+        vm->unchecked = 0;
+
+        if(ENGINE_SWITCH != vm->engine) {
+                run_threaded(vm);
+        }
+        else {
+                run_quick(vm);
+        }
+        return VM_OK;
+}
+
+/*   ,  ,   */
+static void refill(vm_state *vm)
+{
+        vm->budget = vm->quantum ? vm->quantum : INT_MAX;
+}
+
+vm_status vm_run(vm_state *vm)
+{
+        vm->stack_pointer = 0;
+        vm->base_pointer = 0;
+        vm->frame_top = 0;
+        vm->command_pointer = vm->image->entry;
+        vm->call_depth = 0;
+        vm->unchecked = 0;
+        vm->prompted = 0;
+        refill(vm);
+
+        return vm_run_with(vm, vm->image->verified ? run_verified : NULL);
+}
+
+vm_status vm_resume(vm_state *vm)
+{
+        refill(vm);
+
+        /*        ,
+         *    -   
+         */
+        return vm_run_with(vm, vm->unchecked ? run_unchecked : NULL);
+}
+
+/*       ; 
+ *       
+ */
+static void initialize(vm_state *vm)
+{
+        const vm_image *image = vm->image;
+        unsigned int i;
+
+        for(i = 0; i < image->data_size; ++i) {
+                vm->memory[image->data[2 * i]] = (int)image->data[2 * i + 1];
+        }
+
+        vm->stack_pointer = 0;
+        vm->base_pointer = 0;
+        vm->frame_top = 0;
+        vm->command_pointer = image->entry;
+        vm->status = VM_OK;
+}
+
+vm_state* vm_create(const vm_image *image)
+{
+        /*       ,   
+         *     .  
+         *     ,   
+         *      .
+         */
+        vm_state *vm = (vm_state*)calloc(1, sizeof(vm_state));
+
+        if(NULL == vm) {
+                return NULL;
+        }
+        if(!vm_map_memory(vm)) {
+                free(vm);
+                return NULL;
+        }
+
+        vm->image = image;
+        vm->engine = ENGINE_SWITCH;
+        vm->input = stdin;
+        vm->output = stderr;
+        initialize(vm);
+        return vm;
+}
+
+void vm_reset(vm_state *vm)
+{
+        vm_clear_memory(vm);
+        initialize(vm);
+}
+
+void vm_set_engine(vm_state *vm, vm_engine engine)
+{
+        vm->engine = engine;
+}
+
+void vm_set_quantum(vm_state *vm, int quantum)
+{
+        vm->quantum = (quantum > 0) ? quantum : 0;
+}
+
+void vm_set_io(vm_state *vm, FILE *input, FILE *output)
+{
+        vm->input = input;
+        vm->output = output;
+}
+
+void vm_destroy(vm_state *vm)
+{
+        if(NULL == vm) {
+                return;
+        }
+
+        vm_release_jit(vm);
+        vm_release_registers(vm);
+        free(vm->quick_code);
+        free(vm->threaded);
+        free(vm->tos);
+        free(vm->jit_targets);
+        free(vm->jit_cache);
+        vm_unmap_memory(vm);
+        free(vm);
+}
+
+const char* vm_status_text(vm_status status)
+{
+        switch(status) {
+        case VM_OK:                     return "OK";
+        case VM_RUNTIME_ERROR:          return "VM error";
+        case VM_NOT_OBJECT:             return "Not an object file";
+        case VM_BAD_VERSION:            return "Unsupported object file version";
+        case VM_BAD_HEADER:             return "Bad object file header";
+        case VM_BAD_OBJECT_COMMAND:     return "Illegal command in object file";
+        case VM_BAD_OBJECT_DATA:        return "Illegal data address in object file";
+        case VM_BAD_ADDRESS:            return "Illegal address in put_command()";
+        case VM_BAD_COMMAND:            return "Illegal command in put_command()";
+        case VM_BAD_DATA_ADDRESS:       return "Illegal address in set_mem()";
+        case VM_TOO_MANY_WIDE:          return "Too many wide arguments in put_command()";
+        case VM_NO_MEMORY:              return "Out of memory";
+        case VM_YIELD:                  return "Quantum expired";
+        case VM_WAIT_INPUT:             return "Waiting for input";
+        default:                        return "Unknown error";
+        }
 }
 
 opcode_info* operation_info(operation op)
@@ -420,19 +859,175 @@ opcode_info* operation_info(operation op)
         return (op < opcodes_table_size) ? &opcodes_table[op] : NULL;
 }
 
-void put_command(unsigned int address, operation op, int arg)
+command vm_fetch(const vm_image *image, unsigned int address)
 {
-        if(address < MAX_PROGRAM_SIZE) {
-                vm_program[address].operation = op;
-                vm_program[address].arg = arg;
+        packed_command word = image->code[address];
+        command cmd;
+
+        cmd.operation = (operation)PACKED_CODE(word);
+        if(word & PACKED_WIDE) {
+                cmd.arg = image->wide[PACKED_FIELD(word)];
+                cmd.arg2 = image->wide[PACKED_FIELD(word) + 1];
         }
         else {
-                milan_error("Illegal address in put_command()");
+                cmd.arg = PACKED_FIELD(word);
+                cmd.arg2 = 0;
         }
+        return cmd;
 }
 
-void set_mem(unsigned int address, int value)
+vm_image* vm_image_create()
+{
+        return (vm_image*)calloc(1, sizeof(vm_image));
+}
+
+void vm_image_destroy(vm_image *image)
+{
+        if(NULL == image) {
+                return;
+        }
+
+        if(image->code_capacity) {
+                free(image->code);
+        }
+        if(image->wide_capacity) {
+                free(image->wide);
+        }
+        if(image->data_capacity) {
+                free(image->data);
+        }
+        vm_release_analysis(image);
+        vm_release_object(image);
+        free(image);
+}
+
+/*     *items  count   item_size.
+ * ,     (capacity  0, 
+ *   ), .   
+ *  ( NOP).
+ */
+static int reserve(void **items, unsigned int size, unsigned int *capacity,
+                unsigned int count, size_t item_size)
+{
+        unsigned int bigger = *capacity ? *capacity : 1024;
+        void *moved;
+
+        if(count <= *capacity) {
+                return 1;
+        }
+
+        while(bigger < count) {
+                bigger *= 2;
+        }
+
+        moved = malloc(bigger * item_size);
+        if(NULL == moved) {
+                return 0;
+        }
+        if(size > 0) {
+                memcpy(moved, *items, size * item_size);
+        }
+        memset((char*)moved + size * item_size, 0, (bigger - size) * item_size);
+        if(*capacity) {
+                free(*items);
+        }
+
+        *items = moved;
+        *capacity = bigger;
+        return 1;
+}
+
+vm_status vm_image_put(vm_image *image, unsigned int address, operation op,
+        int arg, int arg2)
+{
+        unsigned int wide;
+
+        if(address >= MAX_PROGRAM_SIZE) {
+                return VM_BAD_ADDRESS;
+        }
+        if((unsigned int)op > PACKED_CODE_MASK) {
+                return VM_BAD_COMMAND;
+        }
+        if(!reserve((void **)&image->code, image->size, &image->code_capacity,
+                                address + 1, sizeof(packed_command))) {
+                return VM_NO_MEMORY;
+        }
+
+        if(0 == arg2 && arg >= PACKED_ARG_MIN && arg <= PACKED_ARG_MAX) {
+                image->code[address] = PACK(op, arg);
+        }
+        else {
+                /*   wide,     
+                 * ,  .
+                 */
+                if(address < image->size && (image->code[address] & PACKED_WIDE)) {
+                        wide = PACKED_FIELD(image->code[address]);
+                }
+                else if(image->wide_size < 2 * MAX_PROGRAM_SIZE) {
+                        wide = image->wide_size;
+                }
+                else {
+                        return VM_TOO_MANY_WIDE;
+                }
+                if(!reserve((void **)&image->wide, image->wide_size, &image->wide_capacity,
+                                        wide + 2, sizeof(int))) {
+                        return VM_NO_MEMORY;
+                }
+                if(wide == image->wide_size) {
+                        image->wide_size += 2;
+                }
+                image->wide[wide] = arg;
+                image->wide[wide + 1] = arg2;
+                image->code[address] = PACK(op, wide) | PACKED_WIDE;
+        }
+
+        if(address >= image->size) {
+                image->size = address + 1;
+        }
+        image->verified = 0;
+        return VM_OK;
+}
+
+vm_status vm_image_set(vm_image *image, unsigned int address, int value)
+{
+        if(address >= MAX_MEMORY_SIZE) {
+                return VM_BAD_DATA_ADDRESS;
+        }
+        if(!reserve((void **)&image->data, 2 * image->data_size, &image->data_capacity,
+                                2 * image->data_size + 2, sizeof(unsigned int))) {
+                return VM_NO_MEMORY;
+        }
+
+        image->data[2 * image->data_size] = address;
+        image->data[2 * image->data_size + 1] = (unsigned int)value;
+        ++image->data_size;
+        return VM_OK;
+}
+
+vm_image* vm_default_image()
+{
+        return &default_image;
+}
+
+void put_command(unsigned int address, operation op, int arg)
 {
-        vm_memory[address] = value;
+        put_command2(address, op, arg, 0);
 }
 
+void put_command2(unsigned int address, operation op, int arg, int arg2)
+{
+        vm_status status = vm_image_put(&default_image, address, op, arg, arg2);
+
+        if(VM_OK != status) {
+                milan_error(vm_status_text(status));
+        }
+}
+
+void set_mem(unsigned int address, int value)
+{
+        vm_status status = vm_image_set(&default_image, address, value);
+
+        if(VM_OK != status) {
+                milan_error(vm_status_text(status));
+        }
+}
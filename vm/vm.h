@@ -8,11 +8,15 @@
 /*    */
 #define MAX_PROGRAM_SIZE        65536
 
-/*    */
-#define MAX_MEMORY_SIZE         65536
+/*   ,     (MAX_STACK_SIZE).
+ *      ,    
+ *   (vmmem.c).
+ */
+#define MAX_MEMORY_SIZE         (1 << 24)
+#define MAX_STACK_SIZE          (1 << 20)
 
-/*   */
-#define MAX_STACK_SIZE          8192
+/*  ,  vm_run_lanes()   lockstep */
+#define VM_LANES                8
 
 /*    */
 typedef enum {
@@ -42,6 +46,67 @@ typedef enum {
 				BP,
 				SBLOAD,
 				SBSTORE,
+
+        /*   (),  
+         *  ,   .
+         *      .
+         */
+        PUSH_ADD,       /* PUSH c; ADD */
+        PUSH_SUB,       /* PUSH c; SUB */
+        PUSH_MULT,      /* PUSH c; MULT */
+        PUSH_DIV,       /* PUSH c; DIV */
+        LOAD_ADD,       /* LOAD addr; ADD */
+        SLOAD_ADD,      /* SLOAD offset; ADD */
+        INC,            /* INC addr c: LOAD addr; PUSH c; ADD; STORE addr */
+        SINC,           /* SINC offset c: SLOAD offset; PUSH c; ADD; SSTORE offset */
+        COMPARE_JUMP_NO, /* COMPARE_JUMP_NO cmp addr: COMPARE cmp; JUMP_NO addr */
+
+        /*  ,        .
+         *        (docs/vm.txt).
+         */
+        CALL,           /* CALL addr n:  addr  n    */
+        RET,            /* RET k:  k (0  1)     */
+        ALLOC,          /* ALLOC n: n ,  ,    */
+
+        SWAP,           /*       */
+
+        /*       n (  32) 
+         *      
+         */
+        SHL,            /* SHL n:   */
+        SHR,            /* SHR n:    */
+        AND,
+        OR,
+        XOR,
+
+        /*     (. vmbulk.c).  -
+         *  ,   n   v;  k 
+         * ,  k-     .
+         */
+        VFILL,          /* a, n, v: a[i] = v */
+        VCOPY,          /* a, b, n: a[i] = b[i] */
+        VADDS,          /* a, n, v: a[i] = a[i] + v */
+        VMULS,          /* a, n, v: a[i] = a[i] * v */
+        VADD,           /* a, b, c, n: a[i] = b[i] + c[i] */
+        VSUM,           /* a, n:   */
+        VMIN,           /* a, n:  , n >= 1 */
+        VMAX,           /* a, n:  , n >= 1 */
+
+        /*   .      b 
+         *  s,    .    s, ,
+         *       (i <= b  s >= 0, i >= b 
+         * s < 0),    addr2.
+         */
+        LOOP,           /* LOOP addr addr2:  memory[addr] */
+        SLOOP,          /* SLOOP offset addr2:   , bp + offset */
+
+        /*   .    n + 1  JUMP:
+         *    0 .. n - 1    .
+         *       v  
+         *    index + 1 + v,  0 <= v < n, 
+         *  index + 1 + n.
+         */
+        JUMP_TABLE      /* JUMP_TABLE n */
 } operation;
 
 /*   */
@@ -58,12 +123,15 @@ typedef enum {
 typedef struct {
         operation operation; /*   */
         int arg;         /*  */
+        int arg2;        /*     */
 } command;
 
 /*    */
 typedef struct opcode_info {
         char *name;          /*    */
-        int need_arg;        /* ,  1,     */
+        int need_arg;        /*    (0, 1  2) */
+        int pop;             /*  ,     */
+        int push;            /*  ,     */
 } opcode_info;
 
 /*       op.
@@ -73,18 +141,265 @@ typedef struct opcode_info {
 
 opcode_info* operation_info(operation op);
 
-/*        address. */
+/*    */
+typedef enum {
+        ENGINE_SWITCH = 0,   /*    switch ( ) */
+        ENGINE_THREADED,     /*     */
+        ENGINE_TOS,          /*        */
+        ENGINE_JIT,          /*   x86-64 */
+        ENGINE_REGISTER,     /*      */
+} vm_engine;
 
-void put_command(unsigned int address, operation op, int arg);
+/*      */
+typedef enum {
+        VM_OK = 0,              /*  ( ) */
+        VM_RUNTIME_ERROR,       /*   , . vm_print_error() */
+        VM_NOT_OBJECT,          /*    ,     */
+        VM_BAD_VERSION,         /*      */
+        VM_BAD_HEADER,          /*     */
+        VM_BAD_OBJECT_COMMAND,  /*      */
+        VM_BAD_OBJECT_DATA,     /*       */
+        VM_BAD_ADDRESS,         /*    */
+        VM_BAD_COMMAND,         /*    */
+        VM_BAD_DATA_ADDRESS,    /*    */
+        VM_TOO_MANY_WIDE,       /*     */
+        VM_NO_MEMORY,           /*    */
+        VM_YIELD,               /*  , . vm_set_quantum() */
+        VM_WAIT_INPUT           /*     (, vmsched.c) */
+} vm_status;
+
+/*     status. */
+
+const char* vm_status_text(vm_status status);
+
+/*  : ,  ,  ,
+ *        .
+ *    vm_image_verify()   , 
+ *      ,   
+ *    .
+ */
+typedef struct vm_image vm_image;
+
+/* :  , ,  ,   ,
+ *  ,   .    
+ *   ,    
+ *     .
+ */
+typedef struct vm_state vm_state;
+
+/*   .  NULL,    . */
+
+vm_image* vm_image_create();
+
+/*     arg  arg2     address.
+ *      address   NOP.
+ */
+
+vm_status vm_image_put(vm_image *image, unsigned int address, operation op,
+        int arg, int arg2);
+
+/*   value      address
+ * ( SET  ).
+ */
+
+vm_status vm_image_set(vm_image *image, unsigned int address, int value);
+
+/*         (,
+ *      ).   size
+ *      4   ,  
+ * :     .  VM_NOT_OBJECT,
+ *       .
+ */
+
+vm_status vm_image_load(vm_image *image, void *object, size_t size);
+
+/*      file_name ( 
+ *  docs/vm.txt).      vm_image_destroy(),
+ *      ,  . 
+ * VM_NOT_OBJECT,         
+ *  (      ).
+ */
+
+vm_status vm_image_load_file(vm_image *image, const char *file_name);
+
+/*   .
+ *
+ *   ,      
+ *  .  1,    ; 
+ * vm_run()       .  
+ *   .   ,  
+ * ,  .
+ */
+
+int vm_image_verify(vm_image *image);
+
+/*      C   file_name.
+ *      
+ * bin/libmvm.a     (. vmaot.h).
+ *       vm_image_verify().  0,
+ *     .
+ */
+
+int vm_emit_c(const vm_image *image, const char *file_name);
+
+/*  . ,  ,  . */
+
+void vm_image_destroy(vm_image *image);
+
+/*  ,   image.   
+ *   vm_reset(),  - stdin,  - stderr, 
+ *  - ENGINE_SWITCH.    ,  
+ * .  NULL,    .
+ */
+
+vm_state* vm_create(const vm_image *image);
+
+/*     :   
+ *      ,  .
+ *  ,     
+ *  ,    .
+ */
+
+void vm_reset(vm_state *vm);
+
+/*       vm_run(). */
+
+void vm_set_engine(vm_state *vm, vm_engine engine);
+
+/*    INPUT  PRINT. */
+
+void vm_set_io(vm_state *vm, FILE *input, FILE *output);
+
+/*     (0 -  ). 
+ *    (ENGINE_THREADED,   ,  
+ * )     ,  ,
+ * SJUMP  RET:    ,      
+ *  .   , vm_run()  vm_resume()
+ *  VM_YIELD.     
+ * .
+ */
+
+void vm_set_quantum(vm_state *vm, int quantum);
 
 /*  .
  *
- *      0  ,
- *    STOP    
- *  .
+ *          
+ * ,    STOP   
+ *   .    ,  
+ *     vm_reset().  VM_OK 
+ * VM_RUNTIME_ERROR (    
+ * , . vm_print_error()),   VM_NO_MEMORY.
+ */
+
+vm_status vm_run(vm_state *vm);
+
+/*  ,  vm_run()  vm_resume() 
+ *   VM_YIELD  VM_WAIT_INPUT,   .
+ *   ,  vm_run().
+ */
+
+vm_status vm_resume(vm_state *vm);
+
+/*    :    
+ *  .
+ */
+
+void vm_print_error(const vm_state *vm, FILE *out);
+
+/*       . */
+
+void vm_destroy(vm_state *vm);
+
+/*   image  count   (SIMT,
+ * vmlanes.c):     VM_LANES,  ,
+ *     ,     .
+ *  i   inputs[i],    outputs[i]  ,
+ *   vm_run(),   -  status[i];   
+ *   vm_print_error()    outputs[i].
+ */
+
+void vm_run_lanes(const vm_image *image, unsigned int count, FILE **inputs,
+        FILE **outputs, vm_status *status);
+
+/*    image  engine  
+ *    inputs:  (    
+ * )         . 
+ *   jobs  (0 -   ),  
+ *   .     name 
+ *   output_dir/name.out,   output_dir  NULL - 
+ *    "name: "  
+ * .    stderr    
+ *    .  quantum  0,   
+ *   ,    
+ * vm_scheduler     ENGINE_THREADED,  engine 
+ * ;  Windows  ,   quantum  0
+ *    0.  lanes  0,  
+ *    lanes     vm_run_lanes().
+ *  0 ,        
+ *    .
+ */
+
+int vm_run_batch(const vm_image *image, vm_engine engine, const char *inputs,
+        unsigned int jobs, const char *output_dir, int quantum, unsigned int lanes);
+
+/*    (vmsched.c):  
+ *      ,  -   
+ *    INPUT,      . 
+ *     ,     
+ *    .   
+ * ENGINE_THREADED.  Windows  .
+ */
+
+typedef struct vm_scheduler vm_scheduler;
+
+/*    workers    quantum.
+ *  NULL,    .
+ */
+
+vm_scheduler* vm_scheduler_create(unsigned int workers, int quantum);
+
+/*   vm,      input (
+ *      ,   
+ *  ).     done(vm, status,
+ * data)   ,   .   
+ *   ENGINE_THREADED:     
+ *  .  0,    .
+ */
+
+int vm_scheduler_add(vm_scheduler *scheduler, vm_state *vm, const char *input,
+        void (*done)(vm_state *vm, vm_status status, void *data), void *data);
+
+/*      . */
+
+void vm_scheduler_run(vm_scheduler *scheduler);
+
+/*  :    -  ,
+ *    ,      ;
+ *    -   ,  
+ *   ; ,    
+ *  .
  */
 
-void run();
+void vm_scheduler_print_stats(const vm_scheduler *scheduler, FILE *out);
+
+/*   (  ) */
+
+void vm_scheduler_destroy(vm_scheduler *scheduler);
+
+/*        (vmparse.y).
+ *        ;   
+ *       milan_error().
+ */
+
+vm_image* vm_default_image();
+
+/*        address. */
+
+void put_command(unsigned int address, operation op, int arg);
+
+/*         address. */
+
+void put_command2(unsigned int address, operation op, int arg, int arg2);
 
 /*   value      address. */
 
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "vmaot.h"
+
+/*  ,   C (. vmaot.h). 
+ *   bin/libmvm.a  main.c  .
+ */
+
+void milan_error(char const *msg)
+{
+        fputs(msg, stderr);
+        exit(1);
+}
+
+int aot_main(const command *program, unsigned int program_size,
+        const aot_data *data, unsigned int data_size, int (*run)(vm_state *vm))
+{
+        vm_image *image = vm_image_create();
+        vm_state *vm;
+        vm_status status = VM_OK;
+        unsigned int i;
+
+        if(NULL == image) {
+                milan_error(vm_status_text(VM_NO_MEMORY));
+        }
+
+        for(i = 0; i < program_size && VM_OK == status; ++i) {
+                status = vm_image_put(image, i, program[i].operation, program[i].arg,
+                        program[i].arg2);
+        }
+        for(i = 0; i < data_size && VM_OK == status; ++i) {
+                status = vm_image_set(image, data[i].address, data[i].value);
+        }
+        if(VM_OK != status) {
+                milan_error(vm_status_text(status));
+        }
+
+        vm = vm_create(image);
+        if(NULL == vm) {
+                milan_error(vm_status_text(VM_NO_MEMORY));
+        }
+
+        /*        */
+        vm->command_pointer = 0;
+        vm_set_engine(vm, ENGINE_THREADED);
+        status = vm_run_with(vm, run);
+        if(VM_RUNTIME_ERROR == status) {
+                vm_print_error(vm, stderr);
+        }
+        if(VM_OK != status) {
+                milan_error(vm_status_text(status));
+        }
+
+        vm_destroy(vm);
+        vm_image_destroy(image);
+        return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef _MILAN_VMAOT_H
+#define _MILAN_VMAOT_H
+
+/*   ,   C  mvm --emit-c
+ * (vmemit.c).      
+ *   bin/libmvm.a.
+ */
+
+#include <string.h>
+#include "vmint.h"
+
+/*      ( SET) */
+typedef struct {
+        unsigned int address;
+        int value;
+} aot_data;
+
+/*        run, 
+ *  vmemit.c. run  1,   ,
+ *  0,       
+ *   vm->command_pointer.    .
+ */
+
+int aot_main(const command *program, unsigned int program_size,
+        const aot_data *data, unsigned int data_size, int (*run)(vm_state *vm));
+
+/*       address */
+#define SAVE_STATE(address) \
+        do { \
+                vm->stack_pointer = sp; \
+                vm->base_pointer = bp; \
+                vm->command_pointer = (address); \
+        } while(0)
+
+/*      */
+#define DEOPT(address)  do { SAVE_STATE(address); return 0; } while(0)
+
+#endif
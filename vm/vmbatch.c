@@ -0,0 +1,740 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vmint.h"
+
+/*        
+ * (mvm --batch).
+ *
+ *          .
+ *      (vm_state)   , 
+ *        vm_reset(),
+ *        . 
+ *          
+ *   ,     
+ *          
+ *  .      .
+ *
+ *   ,      ,  
+ *      (vmsched.c). 
+ *  lockstep      ,  
+ *   vm_run_lanes() (vmlanes.c).
+ */
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#endif
+
+/*        */
+typedef struct {
+        const char *name;               /*     */
+        int ran;                        /*   */
+        const char *problem;            /*     */
+        vm_status status;
+        double seconds;                 /*   */
+} batch_input;
+
+/*     */
+typedef struct {
+        const vm_image *image;
+        vm_engine engine;
+        const char *output_dir;
+        batch_input *inputs;
+        unsigned int count;
+        unsigned int next;              /*      */
+        unsigned int lanes;             /*    lockstep  0 */
+        int failed;                     /*     */
+#if defined(_WIN32)
+        CRITICAL_SECTION lock;
+#else
+        pthread_mutex_t lock;
+#endif
+} batch;
+
+static void lock(batch *b)
+{
+#if defined(_WIN32)
+        EnterCriticalSection(&b->lock);
+#else
+        pthread_mutex_lock(&b->lock);
+#endif
+}
+
+static void unlock(batch *b)
+{
+#if defined(_WIN32)
+        LeaveCriticalSection(&b->lock);
+#else
+        pthread_mutex_unlock(&b->lock);
+#endif
+}
+
+/*     */
+static double now()
+{
+#if defined(_WIN32)
+        LARGE_INTEGER count;
+        LARGE_INTEGER frequency;
+
+        QueryPerformanceCounter(&count);
+        QueryPerformanceFrequency(&frequency);
+        return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+        struct timespec t;
+
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+/*   */
+static unsigned int processors()
+{
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors;
+#else
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+        return (count > 0) ? (unsigned int)count : 1;
+#endif
+}
+
+/*     */
+static const char* base_name(const char *path)
+{
+        const char *name = path;
+        const char *p;
+
+        for(p = path; '\0' != *p; ++p) {
+                if('/' == *p || '\\' == *p) {
+                        name = p + 1;
+                }
+        }
+        return name;
+}
+
+/*   a,    b  c */
+static char* concat(const char *a, const char *b, const char *c)
+{
+        size_t length = strlen(a) + strlen(b) + strlen(c);
+        char *s = (char*)malloc(length + 1);
+
+        if(NULL != s) {
+                strcpy(s, a);
+                strcat(s, b);
+                strcat(s, c);
+        }
+        return s;
+}
+
+/*     *names */
+static int add_name(char ***names, unsigned int *count, unsigned int *capacity,
+        char *name)
+{
+        if(NULL == name) {
+                return 0;
+        }
+
+        if(*count == *capacity) {
+                unsigned int bigger = *capacity ? 2 * *capacity : 64;
+                char **moved = (char**)realloc(*names, bigger * sizeof(char*));
+
+                if(NULL == moved) {
+                        free(name);
+                        return 0;
+                }
+                *names = moved;
+                *capacity = bigger;
+        }
+
+        (*names)[(*count)++] = name;
+        return 1;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+        return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*  :    path    
+ *   path.  0,  path   .
+ */
+static int list_inputs(const char *path, char ***names, unsigned int *count)
+{
+        unsigned int capacity = 0;
+        FILE *list;
+        char line[4096];
+
+        *names = NULL;
+        *count = 0;
+
+#if defined(_WIN32)
+        {
+                WIN32_FIND_DATAA entry;
+                char *pattern = concat(path, "\\", "*");
+                HANDLE find = (NULL == pattern) ? INVALID_HANDLE_VALUE :
+                        FindFirstFileA(pattern, &entry);
+
+                free(pattern);
+                if(INVALID_HANDLE_VALUE != find) {
+                        do {
+                                if(!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+                                                !add_name(names, count, &capacity,
+                                                        concat(path, "\\", entry.cFileName))) {
+                                        break;
+                                }
+                        } while(FindNextFileA(find, &entry));
+                        FindClose(find);
+                        qsort(*names, *count, sizeof(char*), compare_names);
+                        return 1;
+                }
+        }
+#else
+        {
+                DIR *dir = opendir(path);
+                struct dirent *entry;
+                struct stat info;
+
+                if(NULL != dir) {
+                        while(NULL != (entry = readdir(dir))) {
+                                char *name = concat(path, "/", entry->d_name);
+
+                                if(NULL == name || 0 != stat(name, &info) || !S_ISREG(info.st_mode)) {
+                                        free(name);
+                                        continue;
+                                }
+                                if(!add_name(names, count, &capacity, name)) {
+                                        break;
+                                }
+                        }
+                        closedir(dir);
+                        qsort(*names, *count, sizeof(char*), compare_names);
+                        return 1;
+                }
+        }
+#endif
+
+        list = fopen(path, "rt");
+        if(NULL == list) {
+                return 0;
+        }
+
+        while(NULL != fgets(line, sizeof(line), list)) {
+                size_t length = strcspn(line, "\r\n");
+
+                line[length] = '\0';
+                if(0 != length && !add_name(names, count, &capacity, concat(line, "", ""))) {
+                        break;
+                }
+        }
+        fclose(list);
+        return 1;
+}
+
+/*    out      
+ *  name    
+ */
+static void copy_tagged(FILE *out, const char *name)
+{
+        int line_start = 1;
+        int c;
+
+        rewind(out);
+        while(EOF != (c = getc(out))) {
+                if(line_start) {
+                        printf("%s: ", name);
+                }
+                putchar(c);
+                line_start = ('\n' == c);
+        }
+        if(!line_start) {
+                putchar('\n');
+        }
+        fflush(stdout);
+}
+
+/*        .  0,
+ *  -      ( -  input->problem).
+ */
+static int open_files(batch *b, batch_input *input, FILE **in, FILE **out)
+{
+        *in = fopen(input->name, "rt");
+        *out = NULL;
+
+        if(NULL == *in) {
+                input->problem = "Unable to read";
+                return 0;
+        }
+
+        if(NULL == b->output_dir) {
+                *out = tmpfile();
+        }
+        else {
+                char *directory = concat(b->output_dir, "/", "");
+                char *out_name = (NULL == directory) ? NULL :
+                        concat(directory, base_name(input->name), ".out");
+
+                if(NULL != out_name) {
+                        *out = fopen(out_name, "wt");
+                }
+                free(directory);
+                free(out_name);
+        }
+
+        if(NULL == *out) {
+                input->problem = "Unable to write";
+                fclose(*in);
+                return 0;
+        }
+        return 1;
+}
+
+/*      :  , 
+ *  mvm   ,      
+ */
+static void close_files(batch *b, batch_input *input, FILE *in, FILE *out)
+{
+        input->ran = 1;
+        if(VM_OK != input->status) {
+                fputs(vm_status_text(input->status), out);
+        }
+
+        fclose(in);
+        if(NULL == b->output_dir) {
+                lock(b);
+                copy_tagged(out, input->name);
+                unlock(b);
+        }
+        fclose(out);
+}
+
+/*         vm */
+static void run_input(batch *b, vm_state *vm, batch_input *input)
+{
+        FILE *in;
+        FILE *out;
+        double start;
+
+        if(!open_files(b, input, &in, &out)) {
+                return;
+        }
+
+        start = now();
+        vm_reset(vm);
+        vm_set_io(vm, in, out);
+        input->status = vm_run(vm);
+        input->seconds = now() - start;
+
+        /*   ,   mvm    */
+        if(VM_RUNTIME_ERROR == input->status) {
+                vm_print_error(vm, out);
+        }
+        close_files(b, input, in, out);
+}
+
+/*    count  ,   first,
+ *  lockstep.       .
+ */
+static void run_lanes(batch *b, unsigned int first, unsigned int count)
+{
+        FILE *in[VM_LANES];
+        FILE *out[VM_LANES];
+        vm_status status[VM_LANES];
+        batch_input *opened[VM_LANES];
+        unsigned int n = 0;
+        double seconds;
+        unsigned int i;
+
+        for(i = first; i < first + count; ++i) {
+                if(open_files(b, &b->inputs[i], &in[n], &out[n])) {
+                        opened[n++] = &b->inputs[i];
+                }
+        }
+
+        seconds = now();
+        vm_run_lanes(b->image, n, in, out, status);
+        seconds = now() - seconds;
+
+        for(i = 0; i < n; ++i) {
+                opened[i]->status = status[i];
+                opened[i]->seconds = seconds / n;
+                close_files(b, opened[i], in[i], out[i]);
+        }
+}
+
+/*     lockstep:     
+ * 
+ */
+static void work_lanes(batch *b)
+{
+        for(;;) {
+                unsigned int first;
+                unsigned int count;
+
+                lock(b);
+                first = b->next;
+                count = (b->count - first < b->lanes) ? b->count - first : b->lanes;
+                b->next += count;
+                unlock(b);
+
+                if(0 == count) {
+                        break;
+                }
+                run_lanes(b, first, count);
+        }
+}
+
+/*  :     ,     */
+static void work(batch *b)
+{
+        vm_state *vm;
+
+        if(0 != b->lanes) {
+                work_lanes(b);
+                return;
+        }
+
+        vm = vm_create(b->image);
+        if(NULL == vm) {
+                lock(b);
+                b->failed = 1;
+                unlock(b);
+                return;
+        }
+        vm_set_engine(vm, b->engine);
+
+        for(;;) {
+                unsigned int index;
+
+                lock(b);
+                index = b->next;
+                if(index < b->count) {
+                        ++b->next;
+                }
+                unlock(b);
+
+                if(index >= b->count) {
+                        break;
+                }
+                run_input(b, vm, &b->inputs[index]);
+        }
+
+        vm_destroy(vm);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI thread_main(LPVOID b)
+{
+        work((batch*)b);
+        return 0;
+}
+#else
+static void* thread_main(void *b)
+{
+        work((batch*)b);
+        return NULL;
+}
+#endif
+
+#if !defined(_WIN32)
+/*     :   
+ *       
+ */
+typedef struct {
+        batch *b;
+        batch_input *input;
+        vm_state *vm;
+        FILE *out;
+        char *text;
+        size_t size;
+} green_input;
+
+/*       (vm_scheduler_add()) */
+static void green_done(vm_state *vm, vm_status status, void *data)
+{
+        green_input *g = (green_input*)data;
+        batch *b = g->b;
+        FILE *text;
+
+        g->input->status = status;
+        g->input->ran = 1;
+        if(VM_RUNTIME_ERROR == status) {
+                vm_print_error(vm, g->out);
+        }
+        if(VM_OK != status) {
+                fputs(vm_status_text(status), g->out);
+        }
+        fclose(g->out);
+        g->out = NULL;
+
+        if(NULL == b->output_dir) {
+                text = (0 != g->size) ? fmemopen(g->text, g->size, "r") : NULL;
+                if(NULL != text) {
+                        lock(b);
+                        copy_tagged(text, g->input->name);
+                        unlock(b);
+                        fclose(text);
+                }
+        }
+        else {
+                char *directory = concat(b->output_dir, "/", "");
+                char *out_name = (NULL == directory) ? NULL :
+                        concat(directory, base_name(g->input->name), ".out");
+
+                text = (NULL == out_name) ? NULL : fopen(out_name, "wt");
+                if(NULL != text) {
+                        fwrite(g->text, 1, g->size, text);
+                        fclose(text);
+                }
+                else {
+                        g->input->problem = "Unable to write";
+                        g->input->ran = 0;
+                }
+                free(directory);
+                free(out_name);
+        }
+
+        free(g->text);
+        g->text = NULL;
+}
+
+/*     :     */
+static void run_green(batch *b, unsigned int jobs, int quantum)
+{
+        vm_scheduler *scheduler = vm_scheduler_create(jobs, quantum);
+        green_input *green = (green_input*)calloc(b->count + 1, sizeof(green_input));
+        unsigned int i;
+
+        if(NULL == scheduler || NULL == green) {
+                b->failed = 1;
+                free(green);
+                if(NULL != scheduler) {
+                        vm_scheduler_destroy(scheduler);
+                }
+                return;
+        }
+
+        for(i = 0; i < b->count; ++i) {
+                green_input *g = &green[i];
+
+                g->b = b;
+                g->input = &b->inputs[i];
+                if(0 != access(g->input->name, R_OK)) {
+                        g->input->problem = "Unable to read";
+                        continue;
+                }
+
+                g->vm = vm_create(b->image);
+                g->out = (NULL == g->vm) ? NULL : open_memstream(&g->text, &g->size);
+                if(NULL == g->out || !vm_scheduler_add(scheduler, g->vm, g->input->name,
+                                green_done, g)) {
+                        b->failed = 1;
+                        break;
+                }
+                vm_set_io(g->vm, stdin, g->out);
+        }
+
+        if(!b->failed) {
+                vm_scheduler_run(scheduler);
+                vm_scheduler_print_stats(scheduler, stderr);
+        }
+        vm_scheduler_destroy(scheduler);
+
+        for(i = 0; i < b->count; ++i) {
+                if(NULL != green[i].out) {
+                        fclose(green[i].out);
+                        free(green[i].text);
+                }
+                if(NULL != green[i].vm) {
+                        vm_destroy(green[i].vm);
+                }
+                if(NULL != b->inputs[i].problem) {
+                        fprintf(stderr, "%s: %s\n", b->inputs[i].name, b->inputs[i].problem);
+                }
+        }
+        free(green);
+}
+#endif
+
+static int compare_seconds(const void *a, const void *b)
+{
+        double x = *(const double*)a;
+        double y = *(const double*)b;
+
+        return (x > y) - (x < y);
+}
+
+/* :         */
+static void print_summary(batch *b, unsigned int jobs, double wall)
+{
+        double *times = (double*)malloc((b->count + 1) * sizeof(double));
+        unsigned int ran = 0;
+        unsigned int failed = 0;
+        double total = 0;
+        unsigned int i;
+
+        fprintf(stderr, "\n%-40s %-10s %12s\n", "Input", "Status", "Time, ms");
+        for(i = 0; i < b->count; ++i) {
+                batch_input *input = &b->inputs[i];
+                const char *status = input->problem;
+
+                if(input->ran) {
+                        status = (VM_OK == input->status) ? "OK" : vm_status_text(input->status);
+                        fprintf(stderr, "%-40s %-10s %12.3f\n", input->name, status,
+                                input->seconds * 1000);
+                        if(NULL != times) {
+                                times[ran] = input->seconds;
+                        }
+                        total += input->seconds;
+                        ++ran;
+                }
+                else {
+                        fprintf(stderr, "%-40s %s\n", input->name,
+                                (NULL != status) ? status : "Not run");
+                }
+                if(!input->ran || VM_OK != input->status) {
+                        ++failed;
+                }
+        }
+
+        fprintf(stderr, "\n%u inputs, %u failed, %u workers\n", b->count, failed, jobs);
+        if(0 != ran && NULL != times) {
+                qsort(times, ran, sizeof(double), compare_seconds);
+                fprintf(stderr, "Time per input, ms: min %.3f, median %.3f, max %.3f\n",
+                        times[0] * 1000, times[ran / 2] * 1000, times[ran - 1] * 1000);
+        }
+        fprintf(stderr, "Wall time %.3f s, %.1f inputs/s, run time %.3f s (%.2fx)\n",
+                wall, (wall > 0) ? b->count / wall : 0.0, total,
+                (wall > 0) ? total / wall : 0.0);
+        free(times);
+}
+
+int vm_run_batch(const vm_image *image, vm_engine engine, const char *inputs,
+        unsigned int jobs, const char *output_dir, int quantum, unsigned int lanes)
+{
+        batch b;
+        char **names;
+        unsigned int count;
+        unsigned int started = 0;
+        int green = 0;
+        double start;
+        int ok;
+        unsigned int i;
+#if defined(_WIN32)
+        HANDLE *threads;
+#else
+        pthread_t *threads;
+#endif
+
+#if defined(_WIN32)
+        /*     Windows  (vmsched.c) */
+        if(quantum > 0) {
+                fprintf(stderr, "--quantum is not supported on Windows\n");
+                return 0;
+        }
+#endif
+        if(!list_inputs(inputs, &names, &count)) {
+                fprintf(stderr, "Unable to read %s\n", inputs);
+                return 0;
+        }
+
+        if(0 == jobs) {
+                jobs = processors();
+        }
+        if(jobs > count) {
+                jobs = count ? count : 1;
+        }
+
+        b.image = image;
+        b.engine = engine;
+        b.output_dir = output_dir;
+        b.inputs = (batch_input*)calloc(count + 1, sizeof(batch_input));
+        b.count = count;
+        b.next = 0;
+        b.lanes = (lanes > VM_LANES) ? VM_LANES : lanes;
+        b.failed = 0;
+#if defined(_WIN32)
+        threads = (HANDLE*)malloc(jobs * sizeof(HANDLE));
+        InitializeCriticalSection(&b.lock);
+#else
+        threads = (pthread_t*)malloc(jobs * sizeof(pthread_t));
+        pthread_mutex_init(&b.lock, NULL);
+#endif
+
+        if(NULL == b.inputs || NULL == threads) {
+                b.failed = 1;
+                b.count = 0;
+        }
+        for(i = 0; i < b.count; ++i) {
+                b.inputs[i].name = names[i];
+        }
+
+        start = now();
+#if !defined(_WIN32)
+        if(quantum > 0) {
+                run_green(&b, jobs, quantum);
+                green = 1;
+        }
+#endif
+        for(i = 0; !green && i < b.count && i < jobs; ++i) {
+#if defined(_WIN32)
+                threads[i] = CreateThread(NULL, 0, thread_main, &b, 0, NULL);
+                if(NULL == threads[i]) {
+                        break;
+                }
+#else
+                if(0 != pthread_create(&threads[i], NULL, thread_main, &b)) {
+                        break;
+                }
+#endif
+                ++started;
+        }
+
+        /*      ,    */
+        if(0 == started && !green) {
+                work(&b);
+        }
+
+        for(i = 0; i < started; ++i) {
+#if defined(_WIN32)
+                WaitForSingleObject(threads[i], INFINITE);
+                CloseHandle(threads[i]);
+#else
+                pthread_join(threads[i], NULL);
+#endif
+        }
+
+        if(b.failed) {
+                fprintf(stderr, "%s\n", vm_status_text(VM_NO_MEMORY));
+        }
+        if(!green) {
+                print_summary(&b, started ? started : 1, now() - start);
+        }
+
+        ok = !b.failed;
+        for(i = 0; i < b.count; ++i) {
+                ok = ok && b.inputs[i].ran && VM_OK == b.inputs[i].status;
+        }
+
+#if defined(_WIN32)
+        DeleteCriticalSection(&b.lock);
+#else
+        pthread_mutex_destroy(&b.lock);
+#endif
+        for(i = 0; i < count; ++i) {
+                free(names[i]);
+        }
+        free(names);
+        free(b.inputs);
+        free(threads);
+        return ok;
+}
@@ -0,0 +1,261 @@
+#include <string.h>
+#include "vmint.h"
+
+/*    : VFILL, VCOPY, VADDS, VMULS, VADD,
+ * VSUM, VMIN  VMAX.
+ *
+ *     :  ,   n
+ * ,  VFILL, VADDS  VMULS, .  k  
+ * ,  k-        bp + ,
+ *      .   
+ *     ;  n <= 0   
+ * ,  VMIN  VMAX     .
+ *
+ *    ,      ,  
+ *    .   
+ * BULK_WIDTH   ;     
+ *     ,   .
+ */
+
+#if defined(__GNUC__)
+/*   GCC:    SSE2, AVX
+ *  NEON   .  4   
+ *    .
+ */
+typedef int bulk_vector __attribute__((vector_size(32), aligned(4), may_alias));
+#define BULK_WIDTH      ((int)(sizeof(bulk_vector) / sizeof(int)))
+#endif
+
+/*      op */
+int vm_bulk_arrays(operation op)
+{
+        switch(op) {
+        case VCOPY:     return 2;
+        case VADD:      return 3;
+        default:        return 1;
+        }
+}
+
+/*    n    address     
+ *  ; NULL,      .
+ */
+static int* bulk_range(vm_state *vm, int address, int in_frame, unsigned int bp, int n)
+{
+        unsigned int start;
+
+        if(in_frame) {
+                start = bp + (unsigned int)address;
+                if(start >= MAX_STACK_SIZE || (unsigned int)n > MAX_STACK_SIZE - start) {
+                        return NULL;
+                }
+                return vm->frames + start;
+        }
+
+        start = (unsigned int)address;
+        if(start >= MAX_MEMORY_SIZE || (unsigned int)n > MAX_MEMORY_SIZE - start) {
+                return NULL;
+        }
+        return vm->memory + start;
+}
+
+/*   a    b: a   b[1 .. n - 1] */
+static int bulk_ahead(const int *a, const int *b, int n)
+{
+        return a > b && a < b + n;
+}
+
+static void bulk_fill(int *a, int n, int value)
+{
+        int i = 0;
+
+#ifdef BULK_WIDTH
+        bulk_vector v = {0};
+
+        v += value;
+        for(; i + BULK_WIDTH <= n; i += BULK_WIDTH) {
+                *(bulk_vector *)(a + i) = v;
+        }
+#endif
+        for(; i < n; ++i) {
+                a[i] = value;
+        }
+}
+
+static void bulk_add_scalar(int *a, int n, int value)
+{
+        int i = 0;
+
+#ifdef BULK_WIDTH
+        bulk_vector v = {0};
+
+        v += value;
+        for(; i + BULK_WIDTH <= n; i += BULK_WIDTH) {
+                *(bulk_vector *)(a + i) += v;
+        }
+#endif
+        for(; i < n; ++i) {
+                a[i] += value;
+        }
+}
+
+static void bulk_mul_scalar(int *a, int n, int value)
+{
+        int i = 0;
+
+#ifdef BULK_WIDTH
+        bulk_vector v = {0};
+
+        v += value;
+        for(; i + BULK_WIDTH <= n; i += BULK_WIDTH) {
+                *(bulk_vector *)(a + i) *= v;
+        }
+#endif
+        for(; i < n; ++i) {
+                a[i] *= value;
+        }
+}
+
+/* a[i] = b[i] + c[i] */
+static void bulk_add(int *a, const int *b, const int *c, int n, int vector)
+{
+        int i = 0;
+
+#ifdef BULK_WIDTH
+        if(vector) {
+                for(; i + BULK_WIDTH <= n; i += BULK_WIDTH) {
+                        *(bulk_vector *)(a + i) =
+                                *(const bulk_vector *)(b + i) + *(const bulk_vector *)(c + i);
+                }
+        }
+#endif
+        for(; i < n; ++i) {
+                a[i] = b[i] + c[i];
+        }
+}
+
+static int bulk_sum(const int *a, int n)
+{
+        int sum = 0;
+        int i = 0;
+
+#ifdef BULK_WIDTH
+        bulk_vector v = {0};
+        int k;
+
+        for(; i + BULK_WIDTH <= n; i += BULK_WIDTH) {
+                v += *(const bulk_vector *)(a + i);
+        }
+        for(k = 0; k < BULK_WIDTH; ++k) {
+                sum += v[k];
+        }
+#endif
+        for(; i < n; ++i) {
+                sum += a[i];
+        }
+        return sum;
+}
+
+/*  (maximum = 0)   , n >= 1 */
+static int bulk_extremum(const int *a, int n, int maximum)
+{
+        int result = a[0];
+        int i = 0;
+
+#ifdef BULK_WIDTH
+        bulk_vector v;
+        bulk_vector x;
+        bulk_vector m;
+        int k;
+
+        if(n >= BULK_WIDTH) {
+                v = *(const bulk_vector *)a;
+                for(i = BULK_WIDTH; i + BULK_WIDTH <= n; i += BULK_WIDTH) {
+                        x = *(const bulk_vector *)(a + i);
+                        m = maximum ? (x > v) : (x < v);
+                        v = (x & m) | (v & ~m);
+                }
+                result = v[0];
+                for(k = 1; k < BULK_WIDTH; ++k) {
+                        if(maximum ? (v[k] > result) : (v[k] < result)) {
+                                result = v[k];
+                        }
+                }
+        }
+#endif
+        for(; i < n; ++i) {
+                if(maximum ? (a[i] > result) : (a[i] < result)) {
+                        result = a[i];
+                }
+        }
+        return result;
+}
+
+int vm_bulk(vm_state *vm, operation op, int spaces, int *operands, unsigned int bp)
+{
+        int arrays = vm_bulk_arrays(op);
+        int n = operands[arrays];
+        int *a[3];
+        int i;
+
+        if(n <= 0) {
+                /*         */
+                if(VMIN == op || VMAX == op) {
+                        return (spaces & 1) ? STACK_CORRUPTED : BAD_DATA_ADDRESS;
+                }
+                if(VSUM == op) {
+                        operands[0] = 0;
+                }
+                return -1;
+        }
+
+        for(i = 0; i < arrays; ++i) {
+                a[i] = bulk_range(vm, operands[i], spaces & (1 << i), bp, n);
+                if(NULL == a[i]) {
+                        return (spaces & (1 << i)) ? STACK_CORRUPTED : BAD_DATA_ADDRESS;
+                }
+        }
+
+        switch(op) {
+        case VFILL:
+                bulk_fill(a[0], n, operands[2]);
+                break;
+
+        case VCOPY:
+                if(bulk_ahead(a[0], a[1], n)) {
+                        for(i = 0; i < n; ++i) {
+                                a[0][i] = a[1][i];
+                        }
+                }
+                else {
+                        memmove(a[0], a[1], n * sizeof(int));
+                }
+                break;
+
+        case VADDS:
+                bulk_add_scalar(a[0], n, operands[2]);
+                break;
+
+        case VMULS:
+                bulk_mul_scalar(a[0], n, operands[2]);
+                break;
+
+        case VADD:
+                bulk_add(a[0], a[1], a[2], n,
+                        !bulk_ahead(a[0], a[1], n) && !bulk_ahead(a[0], a[2], n));
+                break;
+
+        case VSUM:
+                operands[0] = bulk_sum(a[0], n);
+                break;
+
+        case VMIN:
+        case VMAX:
+                operands[0] = bulk_extremum(a[0], n, VMAX == op);
+                break;
+
+        default:
+                break;
+        }
+
+        return -1;
+}
@@ -0,0 +1,787 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdarg.h>
+#include "vmint.h"
+
+/*       C (mvm --emit-c).
+ *
+ *       C,
+ *  JUMP*  COMPARE_JUMP_NO -  goto   ,
+ *   SJUMP  RET -  switch   . 
+ *       
+ * (bin/libmvm.a, . vmaot.h),   vm_read(), vm_write()
+ *   .
+ *
+ *  ,  vm_image_verify(),    ,
+ *       (vmloop.h);  - 
+ *    .    ,
+ *        
+ *   ,    . 
+ *        mvm.
+ */
+
+/*   */
+static const vm_image *image;
+
+/*  ,     */
+static unsigned char labels[MAX_PROGRAM_SIZE + 1];
+
+/*   ,      */
+static FILE *body;
+
+/*    */
+static int uses_address;
+static int uses_data;
+static int uses_calls;
+static int uses_frames;
+
+/*   SJUMP  RET   */
+static int has_return;
+
+static const char *relations[] = { "==", "!=", "<", ">", "<=", ">=" };
+
+/*    C */
+static const char* int_text(int n)
+{
+        static char buffer[2][32];
+        static int next = 0;
+        char *text = buffer[next];
+
+        next = 1 - next;
+        if(INT_MIN == n) {
+                sprintf(text, "(%d - 1)", INT_MIN + 1);
+        }
+        else {
+                sprintf(text, "%d", n);
+        }
+        return text;
+}
+
+/*   n    */
+static const char* offset_text(int n)
+{
+        static char text[32];
+
+        if(n >= 0) {
+                sprintf(text, " + %d", n);
+        }
+        else if(INT_MIN == n) {
+                sprintf(text, " + %uu", (unsigned int)n);
+        }
+        else {
+                sprintf(text, " - %d", -n);
+        }
+        return text;
+}
+
+/*     address;    
+ *   .
+ */
+static unsigned int label(unsigned int address)
+{
+        return (address < image->size) ? address : image->size;
+}
+
+/*      JUMP_TABLE   address:
+ *  JUMP     .
+ */
+static unsigned int table_target(unsigned int address)
+{
+        address = label(address);
+        if(address < image->size && TC_JUMP == vm_decode(image, address)) {
+                return label(vm_fetch(image, address).arg);
+        }
+        return address;
+}
+
+static void mark_labels()
+{
+        unsigned int i;
+        unsigned int k;
+
+        has_return = 0;
+        for(i = 0; i <= image->size; ++i) {
+                labels[i] = 0;
+        }
+
+        for(i = 0; i < image->size; ++i) {
+                command cmd = vm_fetch(image, i);
+
+                switch(vm_decode(image, i)) {
+                case TC_JUMP:
+                case TC_JUMP_YES:
+                case TC_JUMP_NO:
+                        labels[label(cmd.arg)] = 1;
+                        break;
+
+                case TC_CALL:
+                case TC_CALLF:
+                        labels[label(cmd.arg)] = 1;
+                        labels[i + 1] = 1;
+                        break;
+
+                case TC_CJ_EQ:
+                case TC_CJ_NE:
+                case TC_CJ_LT:
+                case TC_CJ_GT:
+                case TC_CJ_LE:
+                case TC_CJ_GE:
+                case TC_LOOP:
+                case TC_SLOOP:
+                        labels[label(cmd.arg2)] = 1;
+                        break;
+
+                case TC_JUMP_TABLE:
+                        for(k = 0; k <= (unsigned int)cmd.arg; ++k) {
+                                labels[table_target(i + 1 + k)] = 1;
+                        }
+                        break;
+
+                case TC_SJUMP:
+                case TC_RET:
+                        has_return = 1;
+                        break;
+
+                default:
+                        break;
+                }
+        }
+
+        /* SJUMP  RET     ,  
+         *    -   .
+         */
+        if(has_return) {
+                for(i = 0; i <= image->size; ++i) {
+                        if(!image->verified || i == image->size ||
+                                        (i > 0 && (TC_CALL == vm_decode(image, i - 1) ||
+                                                   TC_CALLF == vm_decode(image, i - 1)))) {
+                                labels[i] = 1;
+                        }
+                }
+        }
+}
+
+/*    */
+static void line(const char *format, ...)
+{
+        va_list args;
+
+        va_start(args, format);
+        fprintf(body, "        ");
+        vfprintf(body, format, args);
+        fprintf(body, "\n");
+        va_end(args);
+}
+
+/*     data,     SJUMP  RET.
+ *       .
+ */
+static void emit_dispatch()
+{
+        unsigned int i;
+
+        fprintf(body, "dispatch:\n");
+        line("switch(data) {");
+        for(i = 0; i < image->size; ++i) {
+                if(labels[i]) {
+                        line("case %u: goto L%u;", i, i);
+                }
+        }
+        line("default: goto L%u;", image->size);
+        line("}");
+}
+
+/* ,       vm_image_verify() */
+static void need(unsigned int address, int n)
+{
+        if(!image->verified) {
+                line("if(sp < %d) DEOPT(%u);", n, address);
+        }
+}
+
+static void room(unsigned int address)
+{
+        if(!image->verified) {
+                line("if(sp >= MAX_STACK_SIZE) DEOPT(%u);", address);
+        }
+}
+
+/*  bp + offset    */
+static void frame_address(unsigned int address, int offset)
+{
+        uses_address = 1;
+        uses_frames = 1;
+        line("address = bp%s;", offset_text(offset));
+        if(!image->verified) {
+                line("if(address >= MAX_STACK_SIZE) DEOPT(%u);", address);
+        }
+}
+
+static void emit_command(unsigned int address)
+{
+        command cmd = vm_fetch(image, address);
+        opcode_info *info = operation_info(cmd.operation);
+        threaded_op op = vm_decode(image, address);
+        int arg = cmd.arg;
+        int arg2 = cmd.arg2;
+        int valid_memory = (unsigned int)arg < MAX_MEMORY_SIZE;
+        int low;
+        int high;
+        int i;
+        unsigned int k;
+
+        if(labels[address]) {
+                fprintf(body, "L%u:\n", address);
+        }
+
+        if(NULL == info) {
+                line("/* %u: (%d) %d */", address, cmd.operation, arg);
+        }
+        else if(2 == info->need_arg) {
+                line("/* %u: %s %d %d */", address, info->name, arg, arg2);
+        }
+        else if(info->need_arg) {
+                line("/* %u: %s %d */", address, info->name, arg);
+        }
+        else {
+                line("/* %u: %s */", address, info->name);
+        }
+
+        switch(op) {
+        case TC_NOP:
+                break;
+
+        case TC_STOP:
+                line("SAVE_STATE(%u);", address);
+                line("return 1;");
+                break;
+
+        case TC_LOAD:
+                if(!valid_memory) {
+                        line("DEOPT(%u);", address);
+                        break;
+                }
+                room(address);
+                line("stack[sp++] = memory[%d];", arg);
+                break;
+
+        case TC_STORE:
+                if(!valid_memory) {
+                        line("DEOPT(%u);", address);
+                        break;
+                }
+                need(address, 1);
+                line("memory[%d] = stack[--sp];", arg);
+                break;
+
+        case TC_BLOAD:
+        case TC_BSTORE:
+                uses_address = 1;
+                need(address, (TC_BLOAD == op) ? 1 : 2);
+                line("address = %uu + (unsigned int)stack[sp - 1];", (unsigned int)arg);
+                line("if(address >= MAX_MEMORY_SIZE) DEOPT(%u);", address);
+                if(TC_BLOAD == op) {
+                        line("stack[sp - 1] = memory[address];");
+                }
+                else {
+                        line("memory[address] = stack[sp - 2];");
+                        line("sp -= 2;");
+                }
+                break;
+
+        case TC_PUSH:
+                room(address);
+                line("stack[sp++] = %s;", int_text(arg));
+                break;
+
+        case TC_POP:
+                need(address, 1);
+                line("--sp;");
+                break;
+
+        case TC_DUP:
+                need(address, 1);
+                room(address);
+                line("stack[sp] = stack[sp - 1];");
+                line("++sp;");
+                break;
+
+        case TC_SWAP:
+                uses_data = 1;
+                need(address, 2);
+                line("data = stack[sp - 1];");
+                line("stack[sp - 1] = stack[sp - 2];");
+                line("stack[sp - 2] = data;");
+                break;
+
+        case TC_INVERT:
+                need(address, 1);
+                line("stack[sp - 1] = -stack[sp - 1];");
+                break;
+
+        case TC_ADD:
+        case TC_SUB:
+        case TC_MULT:
+                need(address, 2);
+                line("--sp;");
+                line("stack[sp - 1] %s= stack[sp];",
+                        (TC_ADD == op) ? "+" : (TC_SUB == op) ? "-" : "*");
+                break;
+
+        case TC_AND:
+        case TC_OR:
+        case TC_XOR:
+                need(address, 2);
+                line("--sp;");
+                line("stack[sp - 1] %s= stack[sp];",
+                        (TC_AND == op) ? "&" : (TC_OR == op) ? "|" : "^");
+                break;
+
+        case TC_SHL:
+                need(address, 1);
+                line("stack[sp - 1] = (int)((unsigned int)stack[sp - 1] << %d);", arg & 31);
+                break;
+
+        case TC_SHR:
+                need(address, 1);
+                line("stack[sp - 1] >>= %d;", arg & 31);
+                break;
+
+        case TC_VFILL:
+        case TC_VCOPY:
+        case TC_VADDS:
+        case TC_VMULS:
+        case TC_VADD:
+        case TC_VSUM:
+        case TC_VMIN:
+        case TC_VMAX:
+                uses_data = 1;
+                need(address, info->pop);
+                line("if((data = vm_bulk(vm, %s, %d, stack + sp - %d, bp)) >= 0) DEOPT(%u);",
+                        info->name, arg, info->pop, address);
+                if(info->pop != info->push) {
+                        line("sp -= %d;", info->pop - info->push);
+                }
+                break;
+
+        case TC_DIV:
+                need(address, 2);
+                line("if(0 == stack[sp - 1]) DEOPT(%u);", address);
+                line("--sp;");
+                line("stack[sp - 1] /= stack[sp];");
+                break;
+
+        case TC_CMP_EQ:
+        case TC_CMP_NE:
+        case TC_CMP_LT:
+        case TC_CMP_GT:
+        case TC_CMP_LE:
+        case TC_CMP_GE:
+                need(address, 2);
+                line("--sp;");
+                line("stack[sp - 1] = (stack[sp - 1] %s stack[sp]) ? 1 : 0;",
+                        relations[op - TC_CMP_EQ]);
+                break;
+
+        case TC_JUMP:
+                line("goto L%u;", label(arg));
+                break;
+
+        case TC_JUMP_YES:
+        case TC_JUMP_NO:
+                need(address, 1);
+                line("if(%sstack[--sp]) goto L%u;",
+                        (TC_JUMP_NO == op) ? "!" : "", label(arg));
+                break;
+
+        case TC_CALL:
+                uses_calls = 1;
+                line("if(calls >= MAX_STACK_SIZE) DEOPT(%u);", address);
+                line("vm->calls[calls].return_address = %u;", address + 1);
+                line("vm->calls[calls].stack_pointer = sp%s;", offset_text(vm_call_effect(image, address)));
+                line("++calls;");
+                line("goto L%u;", label(arg));
+                break;
+
+        case TC_INPUT:
+                /*    :  
+                 *     .
+                 */
+                uses_data = 1;
+                room(address);
+                line("SAVE_STATE(%u);", address);
+                line("data = vm_read(vm);");
+                line("stack[sp++] = data;");
+                break;
+
+        case TC_PRINT:
+                need(address, 1);
+                line("vm_write(vm, stack[--sp]);");
+                break;
+
+        case TC_SLOAD:
+                frame_address(address, arg);
+                room(address);
+                line("stack[sp++] = frames[address];");
+                break;
+
+        case TC_SSTORE:
+                need(address, 1);
+                frame_address(address, arg);
+                line("frames[address] = stack[--sp];");
+                break;
+
+        case TC_SJUMP:
+                uses_data = 1;
+                if(image->verified) {
+                        /*     , 
+                         *   ,     ,
+                         *   .
+                         */
+                        uses_calls = 1;
+                        line("data = stack[sp - 1];");
+                        line("if(0 == calls || (unsigned int)data != vm->calls[calls - 1].return_address ||");
+                        line("                sp - 1 != vm->calls[calls - 1].stack_pointer) DEOPT(%u);", address);
+                        line("--calls;");
+                        line("--sp;");
+                        line("goto dispatch;");
+                        break;
+                }
+
+                need(address, 1);
+                line("data = stack[--sp];");
+                line("goto dispatch;");
+                break;
+
+        case TC_CALLF:
+                /*       , 
+                 *       
+                 */
+                uses_address = 1;
+                uses_frames = 1;
+                need(address, arg2);
+                line("address = vm->frame_top;");
+                line("if(address + %d > MAX_STACK_SIZE) DEOPT(%u);", arg2 + 2, address);
+                if(image->verified) {
+                        uses_calls = 1;
+                        line("if(calls >= MAX_STACK_SIZE) DEOPT(%u);", address);
+                        if(vm_frame_bounds(image, address, &low, &high)) {
+                                line("if((long long)address + %dLL < 0 ||", low + 2);
+                                line("                (long long)address + %dLL >= MAX_STACK_SIZE) DEOPT(%u);",
+                                        high + 2, address);
+                        }
+                        line("vm->calls[calls].return_address = %u;", address + 1);
+                        line("vm->calls[calls].stack_pointer = sp%s;", offset_text(vm_call_effect(image, address)));
+                        line("vm->calls[calls].base_pointer = bp;");
+                        line("++calls;");
+                }
+                line("frames[address] = %u;", address + 1);
+                line("frames[address + 1] = bp;");
+                line("bp = address + 2;");
+                line("vm->frame_top = bp + %d;", arg2);
+                if(arg2 > 0) {
+                        line("sp -= %d;", arg2);
+                }
+                if(arg2 > 4) {
+                        uses_data = 1;
+                        line("for(data = 0; data < %d; ++data) {", arg2);
+                        line("        frames[bp + data] = stack[sp + data];");
+                        line("}");
+                }
+                else {
+                        for(i = 0; i < arg2; ++i) {
+                                line("frames[bp + %d] = stack[sp + %d];", i, i);
+                        }
+                }
+                line("goto L%u;", label(arg));
+                break;
+
+        case TC_RET:
+                uses_address = 1;
+                uses_data = 1;
+                uses_frames = 1;
+                need(address, arg);
+                line("address = bp - 2;");
+                if(image->verified) {
+                        /*      
+                         *  (. vmloop.h)
+                         */
+                        uses_calls = 1;
+                        line("if(0 == calls || address >= MAX_STACK_SIZE - 1 ||");
+                        line("                (unsigned int)frames[address] != vm->calls[calls - 1].return_address ||");
+                        line("                (unsigned int)frames[address + 1] != vm->calls[calls - 1].base_pointer ||");
+                        line("                sp != vm->calls[calls - 1].stack_pointer) DEOPT(%u);", address);
+                        line("--calls;");
+                }
+                else {
+                        line("if(address >= MAX_STACK_SIZE - 1) DEOPT(%u);", address);
+                }
+                line("data = frames[address];");
+                line("bp = frames[address + 1];");
+                line("vm->frame_top = address;");
+                line("goto dispatch;");
+                break;
+
+        case TC_ALLOC:
+                if(arg < 0) {
+                        line("DEOPT(%u);", address);
+                        break;
+                }
+                uses_address = 1;
+                uses_frames = 1;
+                line("address = vm->frame_top;");
+                line("if(%d > MAX_STACK_SIZE - address) DEOPT(%u);", arg, address);
+                line("memset(frames + address, 0, %d * sizeof(int));", arg);
+                line("vm->frame_top = address + %d;", arg);
+                break;
+
+        case TC_BP:
+                if(image->verified && vm_frame_bounds(image, address, &low, &high)) {
+                        uses_address = 1;
+                        line("address = sp%s;", offset_text(arg));
+                        line("if((long long)address + %dLL < 0 ||", low);
+                        line("                (long long)address + %dLL >= MAX_STACK_SIZE) DEOPT(%u);",
+                                high, address);
+                        line("bp = address;");
+                        break;
+                }
+                line("bp = sp%s;", offset_text(arg));
+                break;
+
+        case TC_SBLOAD:
+        case TC_SBSTORE:
+                uses_address = 1;
+                uses_frames = 1;
+                need(address, (TC_SBLOAD == op) ? 1 : 2);
+                line("address = bp + (%uu + (unsigned int)stack[sp - 1]);", (unsigned int)arg);
+                line("if(address >= MAX_STACK_SIZE) DEOPT(%u);", address);
+                if(TC_SBLOAD == op) {
+                        line("stack[sp - 1] = frames[address];");
+                }
+                else {
+                        line("frames[address] = stack[sp - 2];");
+                        line("sp -= 2;");
+                }
+                break;
+
+        case TC_PUSH_ADD:
+        case TC_PUSH_SUB:
+        case TC_PUSH_MULT:
+                need(address, 1);
+                line("stack[sp - 1] %s= %s;",
+                        (TC_PUSH_ADD == op) ? "+" : (TC_PUSH_SUB == op) ? "-" : "*",
+                        int_text(arg));
+                break;
+
+        case TC_PUSH_DIV:
+                if(0 == arg) {
+                        line("DEOPT(%u);", address);
+                        break;
+                }
+                need(address, 1);
+                line("stack[sp - 1] /= %s;", int_text(arg));
+                break;
+
+        case TC_LOAD_ADD:
+                if(!valid_memory) {
+                        line("DEOPT(%u);", address);
+                        break;
+                }
+                need(address, 1);
+                line("stack[sp - 1] += memory[%d];", arg);
+                break;
+
+        case TC_SLOAD_ADD:
+                need(address, 1);
+                frame_address(address, arg);
+                line("stack[sp - 1] += frames[address];");
+                break;
+
+        case TC_INC:
+                if(!valid_memory) {
+                        line("DEOPT(%u);", address);
+                        break;
+                }
+                line("memory[%d] += %s;", arg, int_text(arg2));
+                break;
+
+        case TC_SINC:
+                frame_address(address, arg);
+                line("frames[address] += %s;", int_text(arg2));
+                break;
+
+        case TC_CJ_EQ:
+        case TC_CJ_NE:
+        case TC_CJ_LT:
+        case TC_CJ_GT:
+        case TC_CJ_LE:
+        case TC_CJ_GE:
+                need(address, 2);
+                line("sp -= 2;");
+                line("if(!(stack[sp] %s stack[sp + 1])) goto L%u;",
+                        relations[op - TC_CJ_EQ], label(arg2));
+                break;
+
+        case TC_JUMP_TABLE:
+                /*  JUMP        */
+                need(address, 1);
+                line("switch((unsigned int)stack[--sp]) {");
+                for(k = 0; k < (unsigned int)arg; ++k) {
+                        line("case %u: goto L%u;", k, table_target(address + 1 + k));
+                }
+                line("default: goto L%u;", table_target(address + 1 + k));
+                line("}");
+                break;
+
+        case TC_LOOP:
+        case TC_SLOOP:
+                uses_data = 1;
+                if(TC_LOOP == op) {
+                        if(!valid_memory) {
+                                line("DEOPT(%u);", address);
+                                break;
+                        }
+                        need(address, 2);
+                        line("data = LOOP_NEXT(memory[%d], stack[sp - 1]);", arg);
+                        line("memory[%d] = data;", arg);
+                }
+                else {
+                        need(address, 2);
+                        frame_address(address, arg);
+                        line("data = LOOP_NEXT(frames[address], stack[sp - 1]);");
+                        line("frames[address] = data;");
+                }
+                line("if(LOOP_CONTINUES(data, stack[sp - 2], stack[sp - 1])) goto L%u;",
+                        label(arg2));
+                break;
+
+        default:
+                /*  :    */
+                line("DEOPT(%u);", address);
+                break;
+        }
+}
+
+/*     ( SET) */
+static void emit_data(FILE *out)
+{
+        unsigned int i;
+        unsigned int count = 0;
+
+        fprintf(out, "static const aot_data data[] = {\n");
+        for(i = 0; i < image->data_size; ++i) {
+                fprintf(out, "        {%u, %s},\n", image->data[2 * i],
+                        int_text((int)image->data[2 * i + 1]));
+                ++count;
+        }
+        if(0 == count) {
+                fprintf(out, "        {0, 0}\n");
+        }
+        fprintf(out, "};\n\n");
+        fprintf(out, "#define DATA_SIZE %u\n\n", count);
+}
+
+int vm_emit_c(const vm_image *program, const char *file_name)
+{
+        FILE *out;
+        unsigned int i;
+        int c;
+        int ok;
+
+        out = fopen(file_name, "wt");
+        if(NULL == out) {
+                return 0;
+        }
+
+        body = tmpfile();
+        if(NULL == body) {
+                fclose(out);
+                return 0;
+        }
+
+        image = program;
+        uses_address = 0;
+        uses_data = 0;
+        uses_calls = 0;
+        uses_frames = 0;
+
+        mark_labels();
+        if(0 != image->entry) {
+                /*        */
+                labels[image->entry] = 1;
+                line("goto L%u;", image->entry);
+        }
+        for(i = 0; i < image->size; ++i) {
+                emit_command(i);
+        }
+        if(labels[image->size]) {
+                fprintf(body, "L%u:\n", image->size);
+        }
+        line("SAVE_STATE(%u);", image->size);
+        line("return 1;");
+        if(has_return) {
+                fprintf(body, "\n");
+                emit_dispatch();
+        }
+
+        fprintf(out, "/* ,   C  mvm --emit-c.\n");
+        fprintf(out, " *      :\n");
+        fprintf(out, " *     cc -O2 -fwrapv -pthread -I<vm> program.c <vm>/bin/libmvm.a\n");
+        fprintf(out, " */\n\n");
+        fprintf(out, "#include \"vmaot.h\"\n\n");
+
+        fprintf(out, "static const command program[] = {\n");
+        for(i = 0; i < image->size; ++i) {
+                command cmd = vm_fetch(image, i);
+                opcode_info *info = operation_info(cmd.operation);
+
+                if(NULL == info) {
+                        fprintf(out, "        {(operation)%d, ", cmd.operation);
+                }
+                else {
+                        fprintf(out, "        {%s, ", info->name);
+                }
+                fprintf(out, "%s, %s},\n", int_text(cmd.arg), int_text(cmd.arg2));
+        }
+        if(0 == image->size) {
+                fprintf(out, "        {NOP, 0, 0}\n");
+        }
+        fprintf(out, "};\n\n");
+
+        emit_data(out);
+
+        fprintf(out, "static int run_program(vm_state *vm)\n{\n");
+        fprintf(out, "        int *stack = vm->stack;\n");
+        fprintf(out, "        int *memory = vm->memory;\n");
+        fprintf(out, "        unsigned int sp = vm->stack_pointer;\n");
+        fprintf(out, "        unsigned int bp = vm->base_pointer;\n");
+        if(uses_frames) {
+                fprintf(out, "        int *frames = vm->frames;\n");
+        }
+        if(uses_address) {
+                fprintf(out, "        unsigned int address;\n");
+        }
+        if(uses_data) {
+                fprintf(out, "        int data;\n");
+        }
+        if(uses_calls) {
+                fprintf(out, "        unsigned int calls = 0;\n");
+        }
+        fprintf(out, "\n");
+
+        rewind(body);
+        while(EOF != (c = getc(body))) {
+                putc(c, out);
+        }
+        fclose(body);
+
+        fprintf(out, "}\n\n");
+        fprintf(out, "int main()\n{\n");
+        fprintf(out, "        return aot_main(program, %u, data, DATA_SIZE, run_program);\n",
+                image->size);
+        fprintf(out, "}\n");
+
+        ok = !ferror(out);
+        return (0 == fclose(out)) && ok;
+}
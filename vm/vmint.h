@@ -0,0 +1,459 @@
+#ifndef _MILAN_VMINT_H
+#define _MILAN_VMINT_H
+
+/*    ,  
+ *     (vm.c, vmthread.c, vmverify.c,
+ * vmtos.c, vmjit.c, vmreg.c)     (vmobj.c).
+ *     .
+ */
+
+#include <limits.h>
+#include <setjmp.h>
+#include "vm.h"
+
+/*    */
+typedef enum {
+        BAD_DATA_ADDRESS,
+        BAD_CODE_ADDRESS,
+        BAD_RELATION,
+        STACK_OVERFLOW,
+        STACK_EMPTY,
+        DIVISION_BY_ZERO,
+        BAD_INPUT,
+        UNKNOWN_COMMAND,
+        STACK_CORRUPTED,
+} runtime_error;
+
+/*       32- :
+ *      0-9   -   (operation    ),
+ *      10     -   ,
+ *      11-31 -    ,   ,
+ *                        image->wide.
+ *   ,    21 , 
+ *      (INC, SINC, COMPARE_JUMP_NO,
+ * LOOP, SLOOP).
+ */
+typedef unsigned int packed_command;
+
+#define PACKED_CODE_MASK        0x3FF
+#define PACKED_WIDE             0x400
+#define PACKED_SHIFT            11
+#define PACKED_ARG_MIN          (-(1 << 20))
+#define PACKED_ARG_MAX          ((1 << 20) - 1)
+
+#define PACKED_CODE(word)       ((word) & PACKED_CODE_MASK)
+#define PACKED_FIELD(word)      ((int)(word) >> PACKED_SHIFT)
+#define PACK(code, field)       (((unsigned int)(field) << PACKED_SHIFT) | (code))
+
+/*   (docs/vm.txt)   32-   
+ *  little-endian. :
+ *       "MVMO",  ,  ,
+ *      ,   ,   SET.
+ *         ,    image->code,
+ *   (image->wide)   <, > 
+ *  .   2  SLOAD/SSTORE    
+ *    ,    .
+ */
+#define OBJECT_MAGIC            "MVMO"
+#define OBJECT_VERSION          2
+#define OBJECT_HEADER_WORDS     6
+
+/*      :  , 
+ *   ,  vm_image_verify(),  
+ * ,  CALL     (RET   ).
+ */
+typedef struct {
+        unsigned int return_address;
+        unsigned int stack_pointer;
+        unsigned int base_pointer;
+} vm_call_frame;
+
+/*    (vmverify.c) */
+typedef struct vm_analysis vm_analysis;
+
+/*   (vm.c, vmobj.c).    
+ *         ; 
+ *   vm_image_put()     
+ *  (capacity   0).
+ */
+struct vm_image {
+        packed_command *code;
+        unsigned int size;              /*   */
+        unsigned int code_capacity;
+
+        int *wide;                      /*    */
+        unsigned int wide_size;
+        unsigned int wide_capacity;
+
+        unsigned int entry;             /* ,   vm_run()   */
+
+        unsigned int *data;             /*  <, >    */
+        unsigned int data_size;         /*   */
+        unsigned int data_capacity;
+
+        void *mapping;                  /*      */
+        size_t mapping_size;
+
+        int verified;                   /*   vm_image_verify() */
+        vm_analysis *analysis;
+};
+
+/* .       
+ *        vm_destroy(): 
+ *    ,   vm_create()  ,
+ *  vm_reset()      .
+ *
+ *     :   
+ *  SAVE_STATE GCC    ,   sp  bp
+ *       SSE.
+ */
+struct vm_state {
+        const vm_image *image;
+        vm_engine engine;
+        FILE *input;
+        FILE *output;
+
+        unsigned int stack_pointer;
+        vm_status status;
+        unsigned int base_pointer;
+        runtime_error error;            /*   status == VM_RUNTIME_ERROR */
+        unsigned int command_pointer;
+        int quantum;                    /* vm_set_quantum() */
+        int budget;                     /*   */
+        int prompted;                   /*     */
+        unsigned int call_depth;        /*   calls   */
+        jmp_buf failure;                /*   vm_run()   */
+        int unchecked;                  /*     */
+
+        /*    INPUT  fscanf(input):  0 
+         *     vm_fail(vm, VM_WAIT_INPUT), 
+         *     (vmsched.c).
+         */
+        int (*read_input)(vm_state *vm, int *n);
+        void *reader;                   /*  read_input */
+
+        packed_command *quick_code;     /* vmquick.c */
+        struct threaded_command *threaded;      /* vmthread.c */
+        int threaded_decoded;           /* threaded   */
+        void **threaded_labels;         /*     */
+        struct tos_command *tos;        /* vmtos.c */
+        unsigned char **jit_targets;    /* vmjit.c */
+        unsigned char *jit_exit;        /*     */
+        unsigned char *jit_cache;       /*      */
+        void *jit_code;
+        size_t jit_capacity;
+        struct register_code *registers;        /* vmreg.c */
+
+        /*   MAX_STACK_SIZE , MAX_MEMORY_SIZE 
+         * 2 * MAX_STACK_SIZE     (vmmem.c). 
+         *     : frames == stack + MAX_STACK_SIZE.
+         */
+        vm_call_frame *calls;
+        int *memory;
+        int *stack;
+        int *frames;
+        unsigned int frame_top;         /*    */
+        void *regions;
+        size_t regions_size;            /* 0 -   calloc() */
+        int guarded;                    /*     */
+};
+
+/*     (vmjit.c, vmreg.c). 
+ *     ,     
+ *  ,     .
+ */
+#if defined(_MSC_VER)
+#define VM_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define VM_THREAD_LOCAL __thread
+#else
+#define VM_THREAD_LOCAL _Thread_local
+#endif
+
+/*       vm->command_pointer:
+ *    ,  vm_run() 
+ * VM_RUNTIME_ERROR.   .
+ */
+
+void vm_error(vm_state *vm, runtime_error error);
+
+/*  vm_run()   status (, VM_NO_MEMORY).
+ *   .
+ */
+
+void vm_fail(vm_state *vm, vm_status status);
+
+/*   size    ;     -
+ * vm_fail(vm, VM_NO_MEMORY).
+ */
+
+void* vm_allocate(vm_state *vm, size_t size);
+
+/*    run    .
+ * run  1,   ,  0,  
+ *       
+ * vm->command_pointer (run   NULL).   
+ *  ,   vm_run().
+ */
+
+vm_status vm_run_with(vm_state *vm, int (*run)(vm_state *vm));
+
+/*   ,     ,
+ *   (vmmem.c).  0,    .
+ */
+
+int vm_map_memory(vm_state *vm);
+
+/*       */
+
+void vm_clear_memory(vm_state *vm);
+
+void vm_unmap_memory(vm_state *vm);
+
+/*        2^32 ,  
+ *   32-     .
+ *  0,    (   ).
+ */
+
+int vm_guard_memory(vm_state *vm);
+
+/*   ,    
+ * (vmobj.c)
+ */
+
+void vm_release_object(vm_image *image);
+
+/*    address    */
+
+command vm_fetch(const vm_image *image, unsigned int address);
+
+/*       INPUT  PRINT */
+
+int vm_read(vm_state *vm);
+void vm_write(vm_state *vm, int n);
+
+/*     vm->command_pointer  
+ * .  0,   .  
+ *    vm->quick_code   .
+ */
+
+int vm_run_command(vm_state *vm);
+
+/*  CALL, RET  ALLOC    (vm.c):   
+ *  address  n ,  results   
+ * n   .
+ */
+
+void vm_call(vm_state *vm, unsigned int address, unsigned int n);
+void vm_return(vm_state *vm, int results);
+void vm_alloc(vm_state *vm, int n);
+
+/*   op   (vmbulk.c). operands - 
+ *     , spaces -  , bp - 
+ * .     :  
+ *  ,       , 
+ *  -1.  VSUM, VMIN  VMAX  
+ * operands[0].
+ */
+
+int vm_bulk(vm_state *vm, operation op, int spaces, int *operands, unsigned int bp);
+
+/*       op */
+
+int vm_bulk_arrays(operation op);
+
+/*     op.     ,
+ *          
+ * ( LOAD/STORE,  ,  PUSH_DIV).
+ */
+#define QUICK(op)                       (0x100 + (op))
+
+/*   COMPARE  COMPARE_JUMP_NO    cmp */
+#define QUICK_COMPARE(cmp)              (0x200 + (cmp))
+#define QUICK_COMPARE_JUMP_NO(cmp)      (0x210 + (cmp))
+
+/*   (LOOP, SLOOP):    i   s
+ * (   2^32,   ADD)     
+ *    b.  ,   i 
+ * INT_MIN + s ( s < 0 -  INT_MAX + s);   .
+ */
+#define LOOP_NEXT(i, s)                 ((int)((unsigned int)(i) + (unsigned int)(s)))
+#define LOOP_CONTINUES(i, b, s) \
+        (((s) >= 0) ? ((i) <= (b) && (i) >= INT_MIN + (s)) : ((i) >= (b) && (i) <= INT_MAX + (s)))
+
+/*   JUMP_TABLE n   v: v  0 <= v < n,
+ *  n (  )
+ */
+#define JUMP_TABLE_ENTRY(v, n) \
+        (((unsigned int)(v) < (unsigned int)(n)) ? (unsigned int)(v) : (unsigned int)(n))
+
+/*       (vmquick.c) */
+
+void run_quick(vm_state *vm);
+
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO
+#endif
+
+/*      (vmthread.c, vmtos.c) */
+typedef enum {
+        TC_NOP = 0,
+        TC_STOP,
+        TC_LOAD,
+        TC_STORE,
+        TC_BLOAD,
+        TC_BSTORE,
+        TC_PUSH,
+        TC_POP,
+        TC_DUP,
+        TC_INVERT,
+        TC_ADD,
+        TC_SUB,
+        TC_MULT,
+        TC_DIV,
+        TC_CMP_EQ,
+        TC_CMP_NE,
+        TC_CMP_LT,
+        TC_CMP_GT,
+        TC_CMP_LE,
+        TC_CMP_GE,
+        TC_CMP_BAD,     /* COMPARE     */
+        TC_JUMP,
+        TC_JUMP_YES,
+        TC_JUMP_NO,
+        TC_JUMP_BAD,    /* JUMP*    */
+        TC_CALL,        /* JUMP,  vm_image_verify()     */
+        TC_INPUT,
+        TC_PRINT,
+        TC_SLOAD,
+        TC_SSTORE,
+        TC_SJUMP,
+        TC_BP,
+        TC_SBLOAD,
+        TC_SBSTORE,
+        TC_PUSH_ADD,
+        TC_PUSH_SUB,
+        TC_PUSH_MULT,
+        TC_PUSH_DIV,
+        TC_LOAD_ADD,
+        TC_SLOAD_ADD,
+        TC_INC,
+        TC_SINC,
+        TC_CJ_EQ,       /* COMPARE_JUMP_NO: ,    */
+        TC_CJ_NE,
+        TC_CJ_LT,
+        TC_CJ_GT,
+        TC_CJ_LE,
+        TC_CJ_GE,
+        TC_CALLF,       /* CALL */
+        TC_RET,
+        TC_ALLOC,
+        TC_SWAP,
+        TC_SHL,
+        TC_SHR,
+        TC_AND,
+        TC_OR,
+        TC_XOR,
+        TC_VFILL,
+        TC_VCOPY,
+        TC_VADDS,
+        TC_VMULS,
+        TC_VADD,
+        TC_VSUM,
+        TC_VMIN,
+        TC_VMAX,
+        TC_LOOP,
+        TC_SLOOP,
+        TC_JUMP_TABLE,
+        TC_UNKNOWN,     /*   */
+        TC_END,         /*   */
+        TC_COUNT
+} threaded_op;
+
+/*     address */
+
+threaded_op vm_decode(const vm_image *image, unsigned int address);
+
+/*       (vmthread.c) */
+
+void run_threaded(vm_state *vm);
+
+/*  ,  vm_image_verify(),   
+ *  .  1,   ,  0, 
+ *        
+ * vm->command_pointer.
+ */
+
+int run_unchecked(vm_state *vm);
+
+/*         (vmtos.c) */
+
+int run_tos(vm_state *vm);
+
+/*     ,   JIT-
+ * (vmjit.c).  ,   x86-64, - run_unchecked().
+ */
+
+int run_jit(vm_state *vm);
+
+/*   ,    */
+
+void vm_release_jit(vm_state *vm);
+
+/*     :   
+ *       (vmreg.c).
+ */
+
+int run_register(vm_state *vm);
+
+/*     */
+
+void vm_release_registers(vm_state *vm);
+
+/*    (vmverify.c).   
+ *     vm_image_destroy().
+ */
+
+void vm_release_analysis(vm_image *image);
+
+/*     base_pointer,  
+ * BP  CALL   address,    SLOAD/SSTORE, 
+ *     .
+ */
+
+int vm_frame_allowed(const vm_image *image, unsigned int address,
+        unsigned int base_pointer);
+
+/*   SLOAD/SSTORE,  vm_frame_allowed() 
+ *  BP  CALL   address.  0,    .
+ */
+
+int vm_frame_bounds(const vm_image *image, unsigned int address,
+        int *low, int *high);
+
+/*       address  
+ *   (   -   ). 
+ *     ,   
+ * .  0,   .
+ */
+
+int vm_stack_depth(const vm_image *image, unsigned int address,
+        int *stack_depth);
+
+/*    ,    
+ *   address (0   ).
+ */
+
+unsigned int vm_region_entry(const vm_image *image, unsigned int address);
+
+/*     JUMP   address */
+
+int vm_is_call(const vm_image *image, unsigned int address);
+
+/*        address (JUMP 
+ * CALL)  
+ */
+
+int vm_call_effect(const vm_image *image, unsigned int address);
+
+#endif
@@ -0,0 +1,1389 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE             /* REG_RIP */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "vmint.h"
+
+/*  JIT-  x86-64.
+ *
+ * ,  vm_image_verify(),   
+ *   :       
+ *    x86-64,  
+ *    ,   JUMP*  COMPARE_JUMP_NO
+ *      .  
+ * SJUMP  RET      
+ * .
+ *
+ *            
+ *     ,    
+ *  C (rbx, r12 - r14),  INPUT  PRINT 
+ * vm_read()/vm_write() .     r10  
+ *    C    .  
+ *      (vmmem.c),  SLOAD/SSTORE
+ *       ,    
+ *   vm->frame_top.
+ *
+ *          rbp 
+ * r15 ( ).        
+ * ,      ;  
+ *   ,        , 
+ *   - :    (   
+ *  ),  CALL, RET, SJUMP,    STOP,
+ *     (    
+ *   )     .
+ *
+ *       (  
+ *   ,      vm->jit_targets)
+ *   .    vm_reset()  ,
+ *       ,   
+ *  vm_destroy().
+ *
+ *       (vmloop.h),  
+ * ,   ,      BP  CALL
+ *     SJUMP  RET.    ,   
+ *     0,    
+ *   ,    .
+ *
+ *  BLOAD/BSTORE  SBLOAD/SBSTORE  Linux  : 
+ *         2^32  (vm_guard_memory()),
+ *       SIGSEGV.  
+ *          
+ *    ,    .
+ *
+ *   ,        
+ * ,     .
+ */
+
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(VM_NO_JIT)
+
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <signal.h>
+#include <ucontext.h>
+#define JIT_TRAP
+#endif
+
+/*  x86-64 */
+enum {
+        RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+#define R_STACK         RBX     /*  vm->stack */
+#define R_SP            R12     /*   */
+#define R_BP            R13     /*   */
+#define R_MEMORY        R14     /*  vm->memory */
+#define R_CALLS         R10     /*    */
+#define R_FRAMES        R11     /*  vm->calls (. frame_index()) */
+
+#define NO_INDEX        -1
+
+/*     sp + n */
+#define STACK(n)        R_STACK, R_SP, 2, (n) * 4
+
+/*      address */
+#define MEMORY(address) R_MEMORY, NO_INDEX, 0, (address) * 4
+
+/*      bp + offset */
+#define FRAME(offset)   R_STACK, R_BP, 2, (MAX_STACK_SIZE + (offset)) * 4
+
+/*      eax + offset */
+#define FRAME_AT(offset) R_STACK, RAX, 2, (MAX_STACK_SIZE + (offset)) * 4
+
+/*  field  vm->calls[calls + n]  ecx = calls * 3
+ * (. frame_index())
+ */
+#define CALL_FRAME(n, field) \
+        R_FRAMES, RCX, 2, (n) * (int)sizeof(vm_call_frame) + (int)offsetof(vm_call_frame, field)
+
+/*   x86.     . */
+enum {
+        CC_O = 0x0, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8,
+        CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+/*      (. compare_type) */
+static const int relations[] = { CC_E, CC_NE, CC_L, CC_G, CC_LE, CC_GE };
+
+/*   ,       */
+typedef enum {
+        FIXUP_COMMAND,  /*     */
+        FIXUP_DEOPT,    /*       */
+        FIXUP_EXIT      /*    */
+} fixup_kind;
+
+typedef struct {
+        fixup_kind kind;
+        unsigned int position;  /*  32-   */
+        unsigned int address;   /*   */
+        int cache;              /*    (cache_state()) */
+} fixup;
+
+/*           */
+#define COMMAND_CODE_SIZE       256
+#define COMMAND_FIXUPS          4
+#define STUB_SIZE               32
+
+/*     vm->jit_cache  fixup.cache: 
+ *      . CACHE_LABEL  
+ * vm->jit_cache ,     .
+ */
+#define CACHE_COUNT             3
+#define CACHE_R15               4
+#define CACHE_LABEL             8
+
+/*  ,        */
+static VM_THREAD_LOCAL unsigned char *code;
+static VM_THREAD_LOCAL unsigned int code_size;
+static VM_THREAD_LOCAL unsigned int *offsets;
+
+static VM_THREAD_LOCAL fixup *fixups;
+static VM_THREAD_LOCAL unsigned int fixups_count;
+
+/*     :    , 
+ *  (   -    rbp  r15)  , 
+ *        ( 0 - ).
+ */
+static VM_THREAD_LOCAL int cached;
+static VM_THREAD_LOCAL int top;
+static VM_THREAD_LOCAL int dirty;
+
+static void byte(unsigned int b)
+{
+        code[code_size++] = (unsigned char)b;
+}
+
+static void dword(unsigned int d)
+{
+        byte(d);
+        byte(d >> 8);
+        byte(d >> 16);
+        byte(d >> 24);
+}
+
+static void qword(unsigned long long q)
+{
+        dword((unsigned int)q);
+        dword((unsigned int)(q >> 32));
+}
+
+/*  REX,    */
+static void rex(int wide, int reg, int index, int base)
+{
+        unsigned int bits = (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) |
+                ((index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0);
+
+        if(bits) {
+                byte(0x40 | bits);
+        }
+}
+
+/*        */
+static void opcode(unsigned int op)
+{
+        if(op > 0xFF) {
+                byte(op >> 8);
+        }
+        byte(op & 0xFF);
+}
+
+/*  op   reg (   )
+ *     [base + index * 2^scale + disp].
+ */
+static void op_mem(int wide, unsigned int op, int reg,
+                int base, int index, int scale, int disp)
+{
+        rex(wide, reg, (NO_INDEX == index) ? 0 : index, base);
+        opcode(op);
+        if(NO_INDEX == index && (base & 7) != RSP) {
+                byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        }
+        else {
+                byte(0x80 | ((reg & 7) << 3) | RSP);
+                byte((NO_INDEX == index) ? (0x20 | (base & 7)) :
+                        ((scale << 6) | ((index & 7) << 3) | (base & 7)));
+        }
+        dword(disp);
+}
+
+/*  op    */
+static void op_reg(int wide, unsigned int op, int reg, int rm)
+{
+        rex(wide, reg, 0, rm);
+        opcode(op);
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* mov reg32, value */
+static void mov_imm(int reg, int value)
+{
+        rex(0, 0, 0, reg);
+        byte(0xB8 + (reg & 7));
+        dword(value);
+}
+
+/* mov reg64, pointer */
+static void mov_pointer(int reg, void *pointer)
+{
+        rex(1, 0, 0, reg);
+        byte(0xB8 + (reg & 7));
+        qword((unsigned long long)pointer);
+}
+
+/*     n */
+static void move_sp(int n)
+{
+        if(1 == n) {
+                op_reg(0, 0xFF, 0, R_SP);               /* inc r12d */
+        }
+        else if(-1 == n) {
+                op_reg(0, 0xFF, 1, R_SP);               /* dec r12d */
+        }
+        else if(n > 0) {
+                op_reg(0, 0x81, 0, R_SP);               /* add r12d, n */
+                dword(n);
+        }
+        else {
+                op_reg(0, 0x81, 5, R_SP);               /* sub r12d, -n */
+                dword(-n);
+        }
+}
+
+/*     */
+static int second()
+{
+        return (RBP == top) ? R15 : RBP;
+}
+
+static int cache_state()
+{
+        return cached | ((R15 == top) ? CACHE_R15 : 0);
+}
+
+/*      ,   mask */
+static void write_back(int mask)
+{
+        if(cached >= 1 && (mask & 1)) {
+                op_mem(0, 0x89, top, STACK(-1));
+        }
+        if(2 == cached && (mask & 2)) {
+                op_mem(0, 0x89, second(), STACK(-2));
+        }
+}
+
+/*    ;     */
+static void sync_cache()
+{
+        write_back(dirty);
+        dirty = 0;
+}
+
+/*      */
+static void flush_cache()
+{
+        sync_cache();
+        cached = 0;
+}
+
+/*    n    */
+static void load(int n)
+{
+        if(0 == cached && n >= 1) {
+                op_mem(0, 0x8B, top, STACK(-1));
+                cached = 1;
+        }
+        if(1 == cached && 2 == n) {
+                op_mem(0, 0x8B, second(), STACK(-2));
+                cached = 2;
+        }
+}
+
+/*      .    
+ * ,     .
+ */
+static int push()
+{
+        if(0 == cached) {
+                cached = 1;
+                dirty = 1;
+                return top;
+        }
+        if(2 == cached && (dirty & 2)) {
+                op_mem(0, 0x89, second(), STACK(-2));
+        }
+        top = second();
+        cached = 2;
+        dirty = ((dirty & 1) << 1) | 1;
+        return top;
+}
+
+/*  n     */
+static void pop(int n)
+{
+        int i;
+
+        for(i = 0; i < n && cached > 0; ++i) {
+                top = second();
+                --cached;
+                dirty >>= 1;
+        }
+        move_sp(-n);
+}
+
+/*  op r/m32, r32     :
+ *   
+ */
+static void emit_binary(unsigned int op)
+{
+        load(2);
+        op_reg(0, op, top, second());
+        pop(1);
+        dirty |= 1;
+}
+
+/*   32- ,    */
+static void jump_to(fixup_kind kind, unsigned int address)
+{
+        fixups[fixups_count].kind = kind;
+        fixups[fixups_count].position = code_size;
+        fixups[fixups_count].address = address;
+        fixups[fixups_count].cache = cache_state();
+        ++fixups_count;
+        dword(0);
+}
+
+static void jmp(fixup_kind kind, unsigned int address)
+{
+        byte(0xE9);
+        jump_to(kind, address);
+}
+
+static void jcc(int condition, fixup_kind kind, unsigned int address)
+{
+        byte(0x0F);
+        byte(0x80 + condition);
+        jump_to(kind, address);
+}
+
+/*        position */
+static void patch(unsigned int position, unsigned int destination)
+{
+        unsigned int saved = code_size;
+
+        code_size = position;
+        dword(destination - (position + 4));
+        code_size = saved;
+}
+
+/*   C.        
+ *  ,     .
+ */
+static void call(void *function)
+{
+        op_mem(0, 0x89, R_CALLS, RSP, NO_INDEX, 0, 0);  /* mov [rsp], r10d */
+        mov_pointer(RAX, function);
+        op_reg(0, 0xFF, 2, RAX);                        /* call rax */
+        op_mem(0, 0x8B, R_CALLS, RSP, NO_INDEX, 0, 0);  /* mov r10d, [rsp] */
+}
+
+/*   ,      */
+static void save_state(vm_state *vm, unsigned int address)
+{
+        mov_pointer(RCX, &vm->command_pointer);
+        op_mem(0, 0xC7, 0, RCX, NO_INDEX, 0, 0);        /* mov [rcx], address */
+        dword(address);
+        mov_pointer(RCX, &vm->stack_pointer);
+        op_mem(0, 0x89, R_SP, RCX, NO_INDEX, 0, 0);
+        mov_pointer(RCX, &vm->base_pointer);
+        op_mem(0, 0x89, R_BP, RCX, NO_INDEX, 0, 0);
+}
+
+/* :  ,     
+ *  ,     .
+ */
+static void emit_prologue(vm_state *vm)
+{
+        static const int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+        unsigned int i;
+
+        for(i = 0; i < sizeof(saved) / sizeof(saved[0]); ++i) {
+                rex(0, 0, 0, saved[i]);
+                byte(0x50 + (saved[i] & 7));            /* push */
+        }
+        op_reg(1, 0x81, 5, RSP);                        /* sub rsp, 8 */
+        dword(8);
+
+        mov_pointer(R_STACK, vm->stack);
+        mov_pointer(R_MEMORY, vm->memory);
+        mov_pointer(RCX, &vm->stack_pointer);
+        op_mem(0, 0x8B, R_SP, RCX, NO_INDEX, 0, 0);
+        mov_pointer(RCX, &vm->base_pointer);
+        op_mem(0, 0x8B, R_BP, RCX, NO_INDEX, 0, 0);
+        op_reg(0, 0x31, R_CALLS, R_CALLS);              /* xor r10d, r10d */
+
+        op_reg(0, 0x89, RDI, RAX);                      /* mov eax, edi */
+        mov_pointer(RCX, vm->jit_targets);
+        op_mem(0, 0xFF, 4, RCX, RAX, 3, 0);             /* jmp [rcx + rax * 8] */
+}
+
+/*  :  edx  ,  eax  run_jit() */
+static void emit_exit(vm_state *vm)
+{
+        static const int saved[] = { R15, R14, R13, R12, RBP, RBX };
+        unsigned int i;
+
+        mov_pointer(RCX, &vm->command_pointer);
+        op_mem(0, 0x89, RDX, RCX, NO_INDEX, 0, 0);
+        mov_pointer(RCX, &vm->stack_pointer);
+        op_mem(0, 0x89, R_SP, RCX, NO_INDEX, 0, 0);
+        mov_pointer(RCX, &vm->base_pointer);
+        op_mem(0, 0x89, R_BP, RCX, NO_INDEX, 0, 0);
+
+        op_reg(1, 0x81, 0, RSP);                        /* add rsp, 8 */
+        dword(8);
+        for(i = 0; i < sizeof(saved) / sizeof(saved[0]); ++i) {
+                rex(0, 0, 0, saved[i]);
+                byte(0x58 + (saved[i] & 7));            /* pop */
+        }
+        byte(0xC3);                                     /* ret */
+}
+
+/*      address */
+static void emit_stop(unsigned int address)
+{
+        mov_imm(RDX, address);
+        mov_imm(RAX, 1);
+        jmp(FIXUP_EXIT, 0);
+}
+
+/* r11 = vm->calls, ecx = calls * 3:   vm->calls  
+ *  
+ */
+static void frame_index(vm_state *vm)
+{
+        mov_pointer(R_FRAMES, vm->calls);
+        op_mem(0, 0x8D, RCX, R_CALLS, R_CALLS, 1, 0);  /* lea ecx, [r10 + r10 * 2] */
+}
+
+/*     eax,    BP
+ *  CALL   address.    64-
+ * ,   vm_frame_allowed().
+ */
+static void emit_check_frame(const vm_image *image, unsigned int address)
+{
+        int low;
+        int high;
+
+        if(!vm_frame_bounds(image, address, &low, &high)) {
+                return;
+        }
+        op_mem(1, 0x8D, RCX, RAX, NO_INDEX, 0, low);
+        op_reg(1, 0x85, RCX, RCX);
+        jcc(CC_S, FIXUP_DEOPT, address);
+        op_mem(1, 0x8D, RCX, RAX, NO_INDEX, 0, high);
+        op_reg(1, 0x81, 7, RCX);
+        dword(MAX_STACK_SIZE);
+        jcc(CC_GE, FIXUP_DEOPT, address);
+}
+
+/*  n          eax */
+static void emit_copy_arguments(int n)
+{
+        unsigned int loop;
+        int i;
+
+        if(n <= 2) {
+                for(i = 0; i < n; ++i) {
+                        op_mem(0, 0x8B, RCX, STACK(i - n));
+                        op_mem(0, 0x89, RCX, FRAME_AT(i));
+                }
+                return;
+        }
+
+        op_mem(1, 0x8D, RSI, STACK(-n));                /* lea rsi, [sp - n] */
+        op_mem(1, 0x8D, RDI, FRAME_AT(0));              /* lea rdi, [frames + eax] */
+        mov_imm(RCX, n);
+        loop = code_size;
+        op_mem(0, 0x8B, RDX, RSI, RCX, 2, -4);          /* mov edx, [rsi + rcx * 4 - 4] */
+        op_mem(0, 0x89, RDX, RDI, RCX, 2, -4);          /* mov [rdi + rcx * 4 - 4], edx */
+        op_reg(0, 0xFF, 1, RCX);                        /* dec ecx */
+        byte(0x0F);                                     /* jnz loop */
+        byte(0x80 + CC_NE);
+        dword(loop - (code_size + 4));
+}
+
+/*   n      eax */
+static void emit_clear_frame(int n)
+{
+        int i;
+
+        if(n <= 4) {
+                for(i = 0; i < n; ++i) {
+                        op_mem(0, 0xC7, 0, FRAME_AT(i));        /* mov [frames + eax + i], 0 */
+                        dword(0);
+                }
+                return;
+        }
+
+        op_mem(1, 0x8D, RDI, FRAME_AT(0));              /* lea rdi, [frames + eax] */
+        op_reg(0, 0x31, RAX, RAX);                      /* xor eax, eax */
+        mov_imm(RCX, n);
+        byte(0xF3);                                     /* rep stosd */
+        byte(0xAB);
+}
+
+/*   eax (   )    size */
+static void emit_check_address(unsigned int address, unsigned int size)
+{
+        op_reg(0, 0x81, 7, RAX);                        /* cmp eax, size */
+        dword(size);
+        jcc(CC_AE, FIXUP_DEOPT, address);
+}
+
+/*      address */
+static void emit_command(vm_state *vm, unsigned int address)
+{
+        const vm_image *image = vm->image;
+        command cmd = vm_fetch(image, address);
+        int arg = cmd.arg;
+        int arg2 = cmd.arg2;
+        threaded_op op = vm_decode(image, address);
+        opcode_info *info;
+        int value;
+        int k;
+        unsigned int skip;
+
+        switch(op) {
+        case TC_NOP:
+                break;
+
+        case TC_STOP:
+                flush_cache();
+                emit_stop(address);
+                break;
+
+        case TC_LOAD:
+                op_mem(0, 0x8B, push(), MEMORY(arg));
+                move_sp(1);
+                break;
+
+        case TC_STORE:
+                load(1);
+                op_mem(0, 0x89, top, MEMORY(arg));
+                pop(1);
+                break;
+
+        /*        :
+         *    vm->jit_cache   
+         */
+        case TC_BLOAD:
+                load(1);
+                op_mem(0, 0x8D, RAX, top, NO_INDEX, 0, arg);    /* lea eax, [top + arg] */
+                if(!vm->guarded) {
+                        emit_check_address(address, MAX_MEMORY_SIZE);
+                }
+                vm->jit_cache[address] |= cache_state();
+                op_mem(0, 0x8B, top, R_MEMORY, RAX, 2, 0);
+                dirty |= 1;
+                break;
+
+        case TC_BSTORE:
+                load(2);
+                op_mem(0, 0x8D, RAX, top, NO_INDEX, 0, arg);
+                if(!vm->guarded) {
+                        emit_check_address(address, MAX_MEMORY_SIZE);
+                }
+                vm->jit_cache[address] |= cache_state();
+                op_mem(0, 0x89, second(), R_MEMORY, RAX, 2, 0);
+                pop(2);
+                break;
+
+        case TC_PUSH:
+                mov_imm(push(), arg);
+                move_sp(1);
+                break;
+
+        case TC_POP:
+                pop(1);
+                break;
+
+        case TC_DUP:
+                load(1);
+                value = top;
+                op_reg(0, 0x89, value, push());
+                move_sp(1);
+                break;
+
+        case TC_SWAP:
+                load(2);
+                top = second();
+                dirty = 3;
+                break;
+
+        case TC_INVERT:
+                load(1);
+                op_reg(0, 0xF7, 3, top);                /* neg top */
+                dirty |= 1;
+                break;
+
+        case TC_ADD:
+                emit_binary(0x01);
+                break;
+
+        case TC_SUB:
+                emit_binary(0x29);
+                break;
+
+        case TC_MULT:
+                load(2);
+                op_reg(0, 0x0FAF, second(), top);       /* imul second, top */
+                pop(1);
+                dirty |= 1;
+                break;
+
+        case TC_SHL:
+                load(1);
+                op_reg(0, 0xC1, 4, top);                /* shl top, arg */
+                byte(arg & 31);
+                dirty |= 1;
+                break;
+
+        case TC_SHR:
+                load(1);
+                op_reg(0, 0xC1, 7, top);                /* sar top, arg */
+                byte(arg & 31);
+                dirty |= 1;
+                break;
+
+        case TC_AND:
+                emit_binary(0x21);
+                break;
+
+        case TC_OR:
+                emit_binary(0x09);
+                break;
+
+        case TC_XOR:
+                emit_binary(0x31);
+                break;
+
+        /*    vm_bulk()   
+         * .     ,   
+         * ,      .
+         */
+        case TC_VFILL:
+        case TC_VCOPY:
+        case TC_VADDS:
+        case TC_VMULS:
+        case TC_VADD:
+        case TC_VSUM:
+        case TC_VMIN:
+        case TC_VMAX:
+                flush_cache();
+                info = operation_info(cmd.operation);
+                mov_pointer(RDI, vm);
+                mov_imm(RSI, cmd.operation);
+                mov_imm(RDX, arg);
+                op_mem(1, 0x8D, RCX, STACK(-info->pop)); /* lea rcx, [sp - pop] */
+                op_reg(0, 0x89, R_BP, R8);              /* mov r8d, r13d */
+                call((void *)vm_bulk);
+                op_reg(0, 0x81, 7, RAX);                /* cmp eax, -1 */
+                dword(-1);
+                jcc(CC_NE, FIXUP_DEOPT, address);
+                move_sp(info->push - info->pop);
+                break;
+
+        case TC_DIV:
+                load(2);
+                op_reg(0, 0x85, top, top);              /* test top, top */
+                jcc(CC_E, FIXUP_DEOPT, address);
+                op_reg(0, 0x89, second(), RAX);         /* mov eax, second */
+                byte(0x99);                             /* cdq */
+                op_reg(0, 0xF7, 7, top);                /* idiv top */
+                op_reg(0, 0x89, RAX, second());
+                pop(1);
+                dirty |= 1;
+                break;
+
+        case TC_CMP_EQ:
+        case TC_CMP_NE:
+        case TC_CMP_LT:
+        case TC_CMP_GT:
+        case TC_CMP_LE:
+        case TC_CMP_GE:
+                load(2);
+                op_reg(0, 0x39, top, second());         /* cmp second, top */
+                byte(0x0F);                             /* setcc al */
+                byte(0x90 + relations[op - TC_CMP_EQ]);
+                byte(0xC0);
+                op_reg(0, 0x0FB6, second(), RAX);       /* movzx second, al */
+                pop(1);
+                dirty |= 1;
+                break;
+
+        case TC_JUMP:
+                flush_cache();
+                jmp(FIXUP_COMMAND, arg);
+                break;
+
+        /*      ,    
+         * ,     
+         */
+        case TC_JUMP_YES:
+        case TC_JUMP_NO:
+                load(1);
+                value = top;
+                pop(1);
+                sync_cache();
+                op_reg(0, 0x85, value, value);          /* test value, value */
+                jcc((TC_JUMP_YES == op) ? CC_NE : CC_E, FIXUP_COMMAND, arg);
+                break;
+
+        case TC_CALL:
+                flush_cache();
+                op_reg(0, 0x81, 7, R_CALLS);            /* cmp r10d, MAX_STACK_SIZE */
+                dword(MAX_STACK_SIZE);
+                jcc(CC_AE, FIXUP_DEOPT, address);
+                frame_index(vm);
+                op_mem(0, 0xC7, 0, CALL_FRAME(0, return_address));
+                dword(address + 1);
+                op_mem(0, 0x8D, RAX, R_SP, NO_INDEX, 0, vm_call_effect(image, address));
+                op_mem(0, 0x89, RAX, CALL_FRAME(0, stack_pointer));
+                op_reg(0, 0xFF, 0, R_CALLS);            /* inc r10d */
+                jmp(FIXUP_COMMAND, arg);
+                break;
+
+        case TC_CALLF:
+                /*       , 
+                 *       
+                 */
+                flush_cache();
+                op_reg(0, 0x81, 7, R_CALLS);
+                dword(MAX_STACK_SIZE);
+                jcc(CC_AE, FIXUP_DEOPT, address);
+                mov_pointer(RSI, &vm->frame_top);
+                op_mem(0, 0x8B, RAX, RSI, NO_INDEX, 0, 0);     /* mov eax, [rsi] */
+                op_mem(0, 0x8D, RAX, RAX, NO_INDEX, 0, 2);     /* lea eax, [rax + 2] */
+                op_mem(0, 0x8D, RDX, RAX, NO_INDEX, 0, arg2);
+                op_reg(0, 0x81, 7, RDX);                /* cmp edx, MAX_STACK_SIZE + 1 */
+                dword(MAX_STACK_SIZE + 1);
+                jcc(CC_AE, FIXUP_DEOPT, address);
+                emit_check_frame(image, address);
+
+                frame_index(vm);
+                op_mem(0, 0xC7, 0, CALL_FRAME(0, return_address));
+                dword(address + 1);
+                op_mem(0, 0x8D, RDI, R_SP, NO_INDEX, 0, vm_call_effect(image, address));
+                op_mem(0, 0x89, RDI, CALL_FRAME(0, stack_pointer));
+                op_mem(0, 0x89, R_BP, CALL_FRAME(0, base_pointer));
+                op_reg(0, 0xFF, 0, R_CALLS);
+
+                op_mem(0, 0x89, RDX, RSI, NO_INDEX, 0, 0);     /* mov [rsi], edx */
+                op_mem(0, 0xC7, 0, FRAME_AT(-2));
+                dword(address + 1);
+                op_mem(0, 0x89, R_BP, FRAME_AT(-1));
+                op_reg(0, 0x89, RAX, R_BP);             /* mov r13d, eax */
+                emit_copy_arguments(arg2);
+                move_sp(-arg2);
+                jmp(FIXUP_COMMAND, arg);
+                break;
+
+        case TC_RET:
+                /*       :
+                 *    ,    
+                 *     ,   .
+                 *      .
+                 */
+                flush_cache();
+                op_reg(0, 0x85, R_CALLS, R_CALLS);
+                jcc(CC_E, FIXUP_DEOPT, address);
+                op_mem(0, 0x8D, RAX, R_BP, NO_INDEX, 0, -2);
+                op_reg(0, 0x81, 7, RAX);                /* cmp eax, MAX_STACK_SIZE - 1 */
+                dword(MAX_STACK_SIZE - 1);
+                jcc(CC_AE, FIXUP_DEOPT, address);
+                frame_index(vm);
+                op_mem(0, 0x8B, RDX, FRAME_AT(0));
+                op_mem(0, 0x3B, RDX, CALL_FRAME(-1, return_address));
+                jcc(CC_NE, FIXUP_DEOPT, address);
+                op_mem(0, 0x8B, RSI, FRAME_AT(1));
+                op_mem(0, 0x3B, RSI, CALL_FRAME(-1, base_pointer));
+                jcc(CC_NE, FIXUP_DEOPT, address);
+                op_mem(0, 0x3B, R_SP, CALL_FRAME(-1, stack_pointer));
+                jcc(CC_NE, FIXUP_DEOPT, address);
+                op_reg(0, 0xFF, 1, R_CALLS);            /* dec r10d */
+                mov_pointer(RCX, &vm->frame_top);
+                op_mem(0, 0x89, RAX, RCX, NO_INDEX, 0, 0);
+                op_reg(0, 0x89, RSI, R_BP);             /* mov r13d, esi */
+                mov_pointer(RCX, vm->jit_targets);
+                op_mem(0, 0xFF, 4, RCX, RDX, 3, 0);     /* jmp [rcx + rdx * 8] */
+                break;
+
+        case TC_ALLOC:
+                if(arg <= 0) {
+                        break;
+                }
+                mov_pointer(RSI, &vm->frame_top);
+                op_mem(0, 0x8B, RAX, RSI, NO_INDEX, 0, 0);
+                op_mem(0, 0x8D, RDX, RAX, NO_INDEX, 0, arg);
+                op_reg(0, 0x81, 7, RDX);                /* cmp edx, MAX_STACK_SIZE + 1 */
+                dword(MAX_STACK_SIZE + 1);
+                jcc(CC_AE, FIXUP_DEOPT, address);
+                op_mem(0, 0x89, RDX, RSI, NO_INDEX, 0, 0);
+                emit_clear_frame(arg);
+                break;
+
+        /*   rbp  r15   ,    
+         * vm_read()  ,      
+         */
+        case TC_INPUT:
+                sync_cache();
+                save_state(vm, address);
+                mov_pointer(RDI, vm);
+                call((void *)vm_read);
+                op_reg(0, 0x89, RAX, push());
+                move_sp(1);
+                break;
+
+        case TC_PRINT:
+                load(1);
+                op_reg(0, 0x89, top, RSI);              /* mov esi, top */
+                pop(1);
+                mov_pointer(RDI, vm);
+                call((void *)vm_write);
+                break;
+
+        case TC_SLOAD:
+                op_mem(0, 0x8B, push(), FRAME(arg));
+                move_sp(1);
+                break;
+
+        case TC_SSTORE:
+                load(1);
+                op_mem(0, 0x89, top, FRAME(arg));
+                pop(1);
+                break;
+
+        case TC_SJUMP:
+                /*     ,  
+                 *  ,     , 
+                 *  .
+                 */
+                flush_cache();
+                op_mem(0, 0x8B, RAX, STACK(-1));
+                op_reg(0, 0x85, R_CALLS, R_CALLS);
+                jcc(CC_E, FIXUP_DEOPT, address);
+                frame_index(vm);
+                op_mem(0, 0x3B, RAX, CALL_FRAME(-1, return_address));
+                jcc(CC_NE, FIXUP_DEOPT, address);
+                op_mem(0, 0x8D, RDX, R_SP, NO_INDEX, 0, -1);
+                op_mem(0, 0x3B, RDX, CALL_FRAME(-1, stack_pointer));
+                jcc(CC_NE, FIXUP_DEOPT, address);
+                op_reg(0, 0xFF, 1, R_CALLS);            /* dec r10d */
+                move_sp(-1);
+                mov_pointer(RCX, vm->jit_targets);
+                op_mem(0, 0xFF, 4, RCX, RAX, 3, 0);     /* jmp [rcx + rax * 8] */
+                break;
+
+        case TC_BP:
+                op_mem(0, 0x8D, RAX, R_SP, NO_INDEX, 0, arg);
+                emit_check_frame(image, address);
+                op_reg(0, 0x89, RAX, R_BP);
+                break;
+
+        case TC_SBLOAD:
+                load(1);
+                op_mem(0, 0x8D, RAX, top, NO_INDEX, 0, arg);
+                op_reg(0, 0x01, R_BP, RAX);             /* add eax, r13d */
+                if(!vm->guarded) {
+                        emit_check_address(address, MAX_STACK_SIZE);
+                }
+                vm->jit_cache[address] |= cache_state();
+                op_mem(0, 0x8B, top, FRAME_AT(0));
+                dirty |= 1;
+                break;
+
+        case TC_SBSTORE:
+                load(2);
+                op_mem(0, 0x8D, RAX, top, NO_INDEX, 0, arg);
+                op_reg(0, 0x01, R_BP, RAX);
+                if(!vm->guarded) {
+                        emit_check_address(address, MAX_STACK_SIZE);
+                }
+                vm->jit_cache[address] |= cache_state();
+                op_mem(0, 0x89, second(), FRAME_AT(0));
+                pop(2);
+                break;
+
+        case TC_PUSH_ADD:
+                load(1);
+                op_reg(0, 0x81, 0, top);                /* add top, arg */
+                dword(arg);
+                dirty |= 1;
+                break;
+
+        case TC_PUSH_SUB:
+                load(1);
+                op_reg(0, 0x81, 5, top);                /* sub top, arg */
+                dword(arg);
+                dirty |= 1;
+                break;
+
+        case TC_PUSH_MULT:
+                load(1);
+                op_reg(0, 0x69, top, top);              /* imul top, top, arg */
+                dword(arg);
+                dirty |= 1;
+                break;
+
+        case TC_PUSH_DIV:
+                if(0 == arg) {
+                        jmp(FIXUP_DEOPT, address);
+                        cached = 0;
+                        dirty = 0;
+                        break;
+                }
+                if(1 == arg) {
+                        break;
+                }
+                load(1);
+                op_reg(0, 0x89, top, RAX);              /* mov eax, top */
+                byte(0x99);
+                if(arg > 0 && 0 == (arg & (arg - 1))) {
+                        /*   2^k    : 
+                         *    2^k - 1
+                         */
+                        op_reg(0, 0x81, 4, RDX);        /* and edx, arg - 1 */
+                        dword(arg - 1);
+                        op_reg(0, 0x01, RDX, RAX);      /* add eax, edx */
+                        op_reg(0, 0xC1, 7, RAX);        /* sar eax, k */
+                        for(k = 0; (1 << k) != arg; ++k);
+                        byte(k);
+                }
+                else {
+                        mov_imm(RCX, arg);
+                        op_reg(0, 0xF7, 7, RCX);        /* idiv ecx */
+                }
+                op_reg(0, 0x89, RAX, top);
+                dirty |= 1;
+                break;
+
+        case TC_LOAD_ADD:
+                load(1);
+                op_mem(0, 0x03, top, MEMORY(arg));      /* add top, [arg] */
+                dirty |= 1;
+                break;
+
+        case TC_SLOAD_ADD:
+                load(1);
+                op_mem(0, 0x03, top, FRAME(arg));
+                dirty |= 1;
+                break;
+
+        case TC_INC:
+                op_mem(0, 0x81, 0, MEMORY(arg));        /* add [arg], arg2 */
+                dword(arg2);
+                break;
+
+        case TC_SINC:
+                op_mem(0, 0x81, 0, FRAME(arg));
+                dword(arg2);
+                break;
+
+        case TC_CJ_EQ:
+        case TC_CJ_NE:
+        case TC_CJ_LT:
+        case TC_CJ_GT:
+        case TC_CJ_LE:
+        case TC_CJ_GE:
+                load(2);
+                value = second();
+                k = top;
+                pop(2);
+                op_reg(0, 0x39, k, value);              /* cmp second, top */
+                jcc(relations[op - TC_CJ_EQ] ^ 1, FIXUP_COMMAND, arg2);
+                break;
+
+        case TC_LOOP:
+        case TC_SLOOP:
+                /*       
+                 *  ,   .  
+                 *    .   
+                 *   .
+                 */
+                load(2);
+                sync_cache();
+                op_reg(0, 0x89, top, RAX);              /* mov eax, step */
+                if(TC_LOOP == op) {
+                        op_mem(0, 0x8B, RCX, MEMORY(arg));
+                        op_reg(0, 0x01, RAX, RCX);      /* add ecx, eax */
+                        op_mem(0, 0x89, RCX, MEMORY(arg));
+                }
+                else {
+                        op_mem(0, 0x8B, RCX, FRAME(arg));
+                        op_reg(0, 0x01, RAX, RCX);
+                        op_mem(0, 0x89, RCX, FRAME(arg));
+                }
+                byte(0x0F);                                     /* jo next */
+                byte(0x80 + CC_O);
+                skip = code_size;
+                dword(0);
+                op_reg(0, 0xC1, 7, RAX);                /* sar eax, 31 */
+                byte(31);
+                op_reg(0, 0x89, second(), RDX);         /* mov edx, limit */
+                op_reg(0, 0x31, RAX, RCX);              /* xor ecx, eax */
+                op_reg(0, 0x31, RAX, RDX);              /* xor edx, eax */
+                op_reg(0, 0x39, RDX, RCX);              /* cmp ecx, edx */
+                jcc(CC_LE, FIXUP_COMMAND, arg2);
+                patch(skip, code_size);
+                break;
+
+        case TC_JUMP_TABLE:
+                /*       vm->jit_targets */
+                load(1);
+                op_reg(0, 0x89, top, RAX);              /* mov eax, top */
+                pop(1);
+                flush_cache();
+                mov_imm(RCX, arg);
+                op_reg(0, 0x39, RCX, RAX);              /* cmp eax, ecx */
+                op_reg(0, 0x0F43, RAX, RCX);            /* cmovae eax, ecx */
+                mov_pointer(RCX, vm->jit_targets + address + 1);
+                op_mem(0, 0xFF, 4, RCX, RAX, 3, 0);     /* jmp [rcx + rax * 8] */
+                break;
+
+        default:
+                /*  :    */
+                jmp(FIXUP_DEOPT, address);
+                cached = 0;
+                dirty = 0;
+                break;
+        }
+}
+
+#ifdef JIT_TRAP
+
+/* ,       */
+static VM_THREAD_LOCAL vm_state *running;
+
+static struct sigaction previous;
+static pthread_once_t trap_installed = PTHREAD_ONCE_INIT;
+
+/*  ,     , ,
+ *   install_trap().   
+ *  :      .  
+ *    ,  ,   
+ *     ,    .
+ */
+static void chain(int number, siginfo_t *info, void *context)
+{
+        struct sigaction action;
+
+        if(previous.sa_flags & SA_SIGINFO) {
+                previous.sa_sigaction(number, info, context);
+        }
+        else if(SIG_DFL == previous.sa_handler || SIG_IGN == previous.sa_handler) {
+                /* SIGSEGV       */
+                action.sa_handler = SIG_DFL;
+                action.sa_flags = 0;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGSEGV, &action, NULL);
+        }
+        else {
+                previous.sa_handler(number);
+        }
+}
+
+/*      :   
+ *  ,      ( ,  
+ *      ,     
+ *   vm->jit_cache).     
+ * chain().
+ */
+static void trap(int signal, siginfo_t *info, void *context)
+{
+        greg_t *registers = ((ucontext_t*)context)->uc_mcontext.gregs;
+        unsigned char *ip = (unsigned char*)registers[REG_RIP];
+        char *fault = (char*)info->si_addr;
+        vm_state *vm = running;
+        unsigned int low = 0;
+        unsigned int high;
+        unsigned int sp;
+        int state;
+        int tos;
+        int nos;
+
+        if(NULL == vm || NULL == vm->jit_code || !vm->guarded ||
+                        fault < (char*)vm->regions ||
+                        fault >= (char*)vm->regions + vm->regions_size ||
+                        ip < vm->jit_targets[0] ||
+                        ip >= vm->jit_targets[vm->image->size]) {
+                chain(signal, info, context);
+                return;
+        }
+
+        /*  ,      ip */
+        high = vm->image->size;
+        while(high - low > 1) {
+                unsigned int middle = low + (high - low) / 2;
+
+                if(vm->jit_targets[middle] <= ip) {
+                        low = middle;
+                }
+                else {
+                        high = middle;
+                }
+        }
+
+        state = vm->jit_cache[low];
+        sp = (unsigned int)registers[REG_R12];
+        tos = (state & CACHE_R15) ? REG_R15 : REG_RBP;
+        nos = (state & CACHE_R15) ? REG_RBP : REG_R15;
+        if((state & CACHE_COUNT) >= 1) {
+                vm->stack[sp - 1] = (int)registers[tos];
+        }
+        if((state & CACHE_COUNT) == 2) {
+                vm->stack[sp - 2] = (int)registers[nos];
+        }
+
+        registers[REG_RDX] = low;
+        registers[REG_RAX] = 0;
+        registers[REG_RIP] = (greg_t)vm->jit_exit;
+}
+
+static void install_trap()
+{
+        struct sigaction action;
+
+        action.sa_sigaction = trap;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previous);
+}
+
+/*    vm; 0,     */
+static int guard(vm_state *vm)
+{
+        if(!vm_guard_memory(vm)) {
+                return 0;
+        }
+        pthread_once(&trap_installed, install_trap);
+        return 1;
+}
+
+#else
+
+static int guard(vm_state *vm)
+{
+        return 0;
+}
+
+#endif
+
+/*  ,       
+ *  :  ,  ,  
+ *   .        .
+ */
+static void mark_labels(const vm_image *image, unsigned char *states)
+{
+        unsigned int i;
+
+        memset(states, 0, image->size + 1);
+        states[image->entry] = CACHE_LABEL;
+        states[image->size] = CACHE_LABEL;
+        for(i = 0; i < image->size; ++i) {
+                switch(vm_decode(image, i)) {
+                case TC_JUMP:
+                case TC_JUMP_YES:
+                case TC_JUMP_NO:
+                        states[vm_fetch(image, i).arg] = CACHE_LABEL;
+                        break;
+
+                case TC_CALL:
+                case TC_CALLF:
+                        states[vm_fetch(image, i).arg] = CACHE_LABEL;
+                        states[i + 1] = CACHE_LABEL;
+                        break;
+
+                case TC_CJ_EQ:
+                case TC_CJ_NE:
+                case TC_CJ_LT:
+                case TC_CJ_GT:
+                case TC_CJ_LE:
+                case TC_CJ_GE:
+                case TC_LOOP:
+                case TC_SLOOP:
+                        states[vm_fetch(image, i).arg2] = CACHE_LABEL;
+                        break;
+
+                case TC_JUMP_TABLE:
+                        memset(states + i + 1, CACHE_LABEL, vm_fetch(image, i).arg + 1);
+                        break;
+
+                default:
+                        break;
+                }
+        }
+}
+
+/*      .  0,  
+ *     .
+ */
+static int compile(vm_state *vm, void **entry, size_t *capacity)
+{
+        unsigned int size = vm->image->size;
+        unsigned int exit_offset;
+        unsigned int i;
+
+        if(NULL == vm->jit_targets) {
+                vm->jit_targets = (unsigned char**)vm_allocate(vm,
+                        (size + 1) * sizeof(unsigned char*));
+                vm->jit_cache = (unsigned char*)vm_allocate(vm, size + 1);
+        }
+
+        *capacity = (size_t)(size + 1) *
+                (COMMAND_CODE_SIZE + COMMAND_FIXUPS * STUB_SIZE) + 4096;
+        code = mmap(NULL, *capacity, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(MAP_FAILED == code) {
+                return 0;
+        }
+
+        fixups = malloc((size + 1) * COMMAND_FIXUPS * sizeof(fixup));
+        offsets = malloc((size + 1) * sizeof(unsigned int));
+        if(NULL == fixups || NULL == offsets) {
+                free(fixups);
+                free(offsets);
+                munmap(code, *capacity);
+                return 0;
+        }
+
+        code_size = 0;
+        fixups_count = 0;
+        cached = 0;
+        top = RBP;
+        dirty = 0;
+        mark_labels(vm->image, vm->jit_cache);
+
+        /*     ,    ,
+         *      
+         */
+        guard(vm);
+        emit_prologue(vm);
+        exit_offset = code_size;
+        emit_exit(vm);
+
+        for(i = 0; i <= size; ++i) {
+                if(vm->jit_cache[i] & CACHE_LABEL) {
+                        flush_cache();
+                }
+                offsets[i] = code_size;
+                if(i < size) {
+                        emit_command(vm, i);
+                }
+        }
+        emit_stop(size);
+
+        /*   :     , 
+         *   edx,  0
+         */
+        for(i = 0; i < fixups_count; ++i) {
+                switch(fixups[i].kind) {
+                case FIXUP_COMMAND:
+                        patch(fixups[i].position, offsets[fixups[i].address]);
+                        break;
+
+                case FIXUP_EXIT:
+                        patch(fixups[i].position, exit_offset);
+                        break;
+
+                case FIXUP_DEOPT:
+                        patch(fixups[i].position, code_size);
+                        cached = fixups[i].cache & CACHE_COUNT;
+                        top = (fixups[i].cache & CACHE_R15) ? R15 : RBP;
+                        write_back(3);
+                        mov_imm(RDX, fixups[i].address);
+                        op_reg(0, 0x31, RAX, RAX);      /* xor eax, eax */
+                        byte(0xE9);
+                        dword(exit_offset - (code_size + 4));
+                        break;
+                }
+        }
+
+        free(fixups);
+
+        if(0 != mprotect(code, *capacity, PROT_READ | PROT_EXEC)) {
+                free(offsets);
+                munmap(code, *capacity);
+                return 0;
+        }
+
+        for(i = 0; i <= size; ++i) {
+                vm->jit_targets[i] = code + offsets[i];
+        }
+        vm->jit_exit = code + exit_offset;
+        free(offsets);
+
+        *entry = code;
+        return 1;
+}
+
+int run_jit(vm_state *vm)
+{
+        int (*entry)(unsigned int);
+#ifdef JIT_TRAP
+        int result;
+#endif
+
+        if(vm->command_pointer > vm->image->size) {
+                return run_unchecked(vm);
+        }
+        if(NULL == vm->jit_code && !compile(vm, &vm->jit_code, &vm->jit_capacity)) {
+                vm->jit_code = NULL;
+                return run_unchecked(vm);
+        }
+        /*         */
+        if(!(vm->jit_cache[vm->command_pointer] & CACHE_LABEL)) {
+                return run_unchecked(vm);
+        }
+
+        entry = (int (*)(unsigned int))vm->jit_code;
+#ifdef JIT_TRAP
+        running = vm;
+        result = entry(vm->command_pointer);
+        running = NULL;
+        return result;
+#else
+        return entry(vm->command_pointer);
+#endif
+}
+
+void vm_release_jit(vm_state *vm)
+{
+#ifdef JIT_TRAP
+        if(running == vm) {
+                running = NULL;
+        }
+#endif
+        if(NULL != vm->jit_code) {
+                munmap(vm->jit_code, vm->jit_capacity);
+                vm->jit_code = NULL;
+        }
+}
+
+#else
+
+int run_jit(vm_state *vm)
+{
+        return run_unchecked(vm);
+}
+
+void vm_release_jit(vm_state *vm)
+{
+}
+
+#endif
@@ -0,0 +1,892 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "vmint.h"
+
+/*        lockstep (SIMT).
+ *
+ *   - .       :
+ *    a -  VM_LANES  ,   
+ * ,  ,     (ADD, LOAD,
+ * COMPARE  ..),     , 
+ *     .
+ *
+ *         
+ *    ;   ,    
+ * .      SJUMP  
+ * ,  ,     
+ *   .  ,    
+ *   ,    ;  
+ *  goto        .
+ *  ,  RET        
+ * , .
+ *
+ * ,   ,    .
+ * ,     , :   
+ *     ,    
+ *      ,  
+ *  .     
+ *   vm_run()    .
+ */
+
+typedef int lane_word[VM_LANES];
+
+/*      ,   :   
+ * ,     ,  , 
+ *       .
+ */
+#define LANE_MEMORY_SIZE        65536
+#define LANE_STACK_SIZE         8192
+
+/*  .       
+ *  :    ,  ,    
+ * ,        .
+ */
+typedef struct {
+        const vm_image *image;
+        command *program;
+        unsigned int size;
+        FILE **inputs;
+        FILE **outputs;
+        vm_status *status;
+
+        int running[VM_LANES];          /* -1 -  , 0 -  */
+        int mask[VM_LANES];             /* -1     */
+        int taken[VM_LANES];            /* -1,     */
+        unsigned int pc[VM_LANES];      /*      */
+        unsigned int sp[VM_LANES];
+        unsigned int bp[VM_LANES];
+        unsigned int ft[VM_LANES];      /*    */
+
+        lane_word stack[LANE_STACK_SIZE];
+        lane_word frames[LANE_STACK_SIZE];
+        lane_word memory[LANE_MEMORY_SIZE];
+} lanes;
+
+/*   lane,    pc: 
+ *       
+ */
+static void split(lanes *g, unsigned int lane, unsigned int pc, unsigned int sp,
+        unsigned int bp, unsigned int ft, int prompted)
+{
+        vm_state *vm = vm_create(g->image);
+        vm_status status = VM_NO_MEMORY;
+        unsigned int i;
+
+        g->running[lane] = 0;
+        if(NULL == vm) {
+                g->status[lane] = status;
+                return;
+        }
+
+        for(i = 0; i < LANE_MEMORY_SIZE; ++i) {
+                vm->memory[i] = g->memory[i][lane];
+        }
+        for(i = 0; i < LANE_STACK_SIZE; ++i) {
+                vm->stack[i] = g->stack[i][lane];
+                vm->frames[i] = g->frames[i][lane];
+        }
+        vm->stack_pointer = sp;
+        vm->base_pointer = bp;
+        vm->frame_top = ft;
+        vm->command_pointer = pc;
+        vm->prompted = prompted;
+        vm_set_io(vm, g->inputs[lane], g->outputs[lane]);
+
+        status = vm_run_with(vm, NULL);
+        if(VM_RUNTIME_ERROR == status) {
+                vm_print_error(vm, g->outputs[lane]);
+        }
+        g->status[lane] = status;
+        vm_destroy(vm);
+}
+
+/*     :   
+ *        ,  
+ *   .  other -    
+ * ,    (    ,  
+ *  , ,    ).  0,
+ *    .
+ */
+static int select_group(lanes *g, unsigned int *pc, unsigned int *sp,
+        unsigned int *bp, unsigned int *ft, unsigned int *other)
+{
+        unsigned int first = VM_LANES;
+        unsigned int l;
+
+        for(l = 0; l < VM_LANES; ++l) {
+                if(g->running[l] && (VM_LANES == first || g->pc[l] < g->pc[first])) {
+                        first = l;
+                }
+        }
+        if(VM_LANES == first) {
+                return 0;
+        }
+
+        *pc = g->pc[first];
+        *sp = g->sp[first];
+        *bp = g->bp[first];
+        *ft = g->ft[first];
+        *other = UINT_MAX;
+        for(l = 0; l < VM_LANES; ++l) {
+                g->mask[l] = g->running[l] & -(g->pc[l] == *pc && g->sp[l] == *sp &&
+                        g->bp[l] == *bp && g->ft[l] == *ft);
+                if(g->running[l] && !g->mask[l] && g->pc[l] > *pc && g->pc[l] < *other) {
+                        *other = g->pc[l];
+                }
+        }
+        return 1;
+}
+
+/*        */
+static void save_group(lanes *g, unsigned int pc, unsigned int sp,
+        unsigned int bp, unsigned int ft)
+{
+        unsigned int l;
+
+        for(l = 0; l < VM_LANES; ++l) {
+                if(g->mask[l]) {
+                        g->pc[l] = pc;
+                        g->sp[l] = sp;
+                        g->bp[l] = bp;
+                        g->ft[l] = ft;
+                }
+        }
+}
+
+/*   op    l:   
+ *  operands     (. vm_bulk)
+ */
+static int bulk_fits(operation op, int spaces, lane_word *operands,
+        unsigned int bp, unsigned int l)
+{
+        int arrays = vm_bulk_arrays(op);
+        int n = operands[arrays][l];
+        unsigned int start;
+        unsigned int size;
+        int k;
+
+        if(n <= 0) {
+                return VMIN != op && VMAX != op;
+        }
+        for(k = 0; k < arrays; ++k) {
+                start = (unsigned int)operands[k][l];
+                size = LANE_MEMORY_SIZE;
+                if(spaces & (1 << k)) {
+                        start += bp;
+                        size = LANE_STACK_SIZE;
+                }
+                if(start >= size || (unsigned int)n > size - start) {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/*   op   l,    bulk_fits.
+ *     ,   vm_bulk.
+ */
+static void bulk_lane(lanes *g, operation op, int spaces, lane_word *operands,
+        unsigned int bp, unsigned int l)
+{
+        int arrays = vm_bulk_arrays(op);
+        int n = operands[arrays][l];
+        int value = 0;
+        lane_word *a[3];
+        int k;
+        int i;
+
+        for(k = 0; k < arrays; ++k) {
+                a[k] = (spaces & (1 << k)) ? g->frames + (bp + (unsigned int)operands[k][l]) :
+                        g->memory + (unsigned int)operands[k][l];
+        }
+        if(VFILL == op || VADDS == op || VMULS == op) {
+                value = operands[2][l];
+        }
+
+        switch(op) {
+        case VFILL:
+                for(i = 0; i < n; ++i) {
+                        a[0][i][l] = value;
+                }
+                break;
+
+        case VCOPY:
+                for(i = 0; i < n; ++i) {
+                        a[0][i][l] = a[1][i][l];
+                }
+                break;
+
+        case VADDS:
+                for(i = 0; i < n; ++i) {
+                        a[0][i][l] += value;
+                }
+                break;
+
+        case VMULS:
+                for(i = 0; i < n; ++i) {
+                        a[0][i][l] *= value;
+                }
+                break;
+
+        case VADD:
+                for(i = 0; i < n; ++i) {
+                        a[0][i][l] = a[1][i][l] + a[2][i][l];
+                }
+                break;
+
+        case VSUM:
+                for(value = 0, i = 0; i < n; ++i) {
+                        value += a[0][i][l];
+                }
+                operands[0][l] = value;
+                break;
+
+        case VMIN:
+        case VMAX:
+                for(value = a[0][0][l], i = 1; i < n; ++i) {
+                        if((VMAX == op) ? (a[0][i][l] > value) : (a[0][i][l] < value)) {
+                                value = a[0][i][l];
+                        }
+                }
+                operands[0][l] = value;
+                break;
+
+        default:
+                break;
+        }
+}
+
+/*    */
+#define EACH_LANE       for(l = 0; l < VM_LANES; ++l)
+
+/*  value   word (   l)   
+ * .        
+ * :    ,   ,  
+ *  ,    .
+ */
+#define SET(word, value) \
+        do { \
+                EACH_LANE { \
+                        result[l] = (value); \
+                } \
+                EACH_LANE { \
+                        (word) = (result[l] & g->mask[l]) | ((word) & ~g->mask[l]); \
+                } \
+        } while(0)
+
+/*        */
+#define SPLIT_GROUP() \
+        do { \
+                EACH_LANE { \
+                        if(g->mask[l]) { \
+                                split(g, l, pc, sp, bp, ft, 0); \
+                        } \
+                } \
+                goto next_group; \
+        } while(0)
+
+/*   ,    condition (
+ *        )
+ */
+#define SPLIT_LANES(condition) \
+        do { \
+                int left = 0; \
+                EACH_LANE { \
+                        if(g->mask[l] && (condition)) { \
+                                split(g, l, pc, sp, bp, ft, prompted); \
+                                g->mask[l] = 0; \
+                        } \
+                        left |= g->mask[l]; \
+                } \
+                if(!left) { \
+                        goto next_group; \
+                } \
+        } while(0)
+
+#define NEED(condition) \
+        if(!(condition)) { \
+                SPLIT_GROUP(); \
+        }
+
+#define BINARY(relation) \
+        NEED(sp >= 2); \
+        SET(g->stack[sp - 2][l], g->stack[sp - 2][l] relation g->stack[sp - 1][l]); \
+        --sp; \
+        break;
+
+#define COMPARE(cmp, relation) \
+        case cmp: \
+                SET(g->stack[sp - 2][l], g->stack[sp - 2][l] relation g->stack[sp - 1][l]); \
+                break;
+
+#define COMPARE_TAKEN(cmp, relation) \
+        case cmp: \
+                EACH_LANE { \
+                        g->taken[l] = -!(g->stack[sp - 2][l] relation g->stack[sp - 1][l]); \
+                } \
+                break;
+
+/*   LOOP  SLOOP   counter ( ):
+ *       
+ */
+#define LOOP_TAKEN(counter) \
+        EACH_LANE { \
+                g->taken[l] = -LOOP_CONTINUES(counter[l], g->stack[sp - 2][l], \
+                        g->stack[sp - 1][l]); \
+        }
+
+/*  : ,   taken[l]  -1,  
+ *  target,  -   .   do-while:
+ * continue   .
+ */
+#define BRANCH(target) \
+        { \
+                int all = -1; \
+                int any = 0; \
+                EACH_LANE { \
+                        all &= g->taken[l] | ~g->mask[l]; \
+                        any |= g->taken[l] & g->mask[l]; \
+                } \
+                if(all || !any) { \
+                        pc = all ? (unsigned int)(target) : pc + 1; \
+                        continue; \
+                } \
+                EACH_LANE { \
+                        if(g->mask[l]) { \
+                                g->pc[l] = g->taken[l] ? (unsigned int)(target) : pc + 1; \
+                                g->sp[l] = sp; \
+                                g->bp[l] = bp; \
+                                g->ft[l] = ft; \
+                                g->mask[l] = 0; \
+                        } \
+                } \
+                goto next_group; \
+        }
+
+/*       */
+static void run_lanes(lanes *g)
+{
+        unsigned int pc;
+        unsigned int sp;
+        unsigned int bp;
+        unsigned int ft;
+        unsigned int other;
+        unsigned int address;
+        unsigned int next;
+        int first;
+        int prompted = 0;               /*     */
+        lane_word result;
+        command cmd;
+        int l;
+
+        if(!select_group(g, &pc, &sp, &bp, &ft, &other)) {
+                return;
+        }
+
+        for(;;) {
+                /*         */
+                if(pc >= other || pc >= g->size) {
+                        if(pc >= g->size) {
+                                EACH_LANE {
+                                        if(g->mask[l]) {
+                                                g->running[l] = 0;
+                                        }
+                                }
+                        }
+                        goto next_group;
+                }
+
+                cmd = g->program[pc];
+                switch(cmd.operation) {
+                case NOP:
+                        break;
+
+                case STOP:
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->running[l] = 0;
+                                }
+                        }
+                        goto next_group;
+
+                case LOAD:
+                        NEED((unsigned int)cmd.arg < LANE_MEMORY_SIZE && sp < LANE_STACK_SIZE);
+                        SET(g->stack[sp][l], g->memory[cmd.arg][l]);
+                        ++sp;
+                        break;
+
+                case STORE:
+                        NEED((unsigned int)cmd.arg < LANE_MEMORY_SIZE && sp >= 1);
+                        SET(g->memory[cmd.arg][l], g->stack[sp - 1][l]);
+                        --sp;
+                        break;
+
+                case BLOAD:
+                        NEED(sp >= 1);
+                        SPLIT_LANES((unsigned int)cmd.arg + g->stack[sp - 1][l] >= LANE_MEMORY_SIZE);
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->stack[sp - 1][l] = g->memory[(unsigned int)cmd.arg + g->stack[sp - 1][l]][l];
+                                }
+                        }
+                        break;
+
+                case BSTORE:
+                        NEED(sp >= 2);
+                        SPLIT_LANES((unsigned int)cmd.arg + g->stack[sp - 1][l] >= LANE_MEMORY_SIZE);
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->memory[(unsigned int)cmd.arg + g->stack[sp - 1][l]][l] = g->stack[sp - 2][l];
+                                }
+                        }
+                        sp -= 2;
+                        break;
+
+                case PUSH:
+                        NEED(sp < LANE_STACK_SIZE);
+                        SET(g->stack[sp][l], cmd.arg);
+                        ++sp;
+                        break;
+
+                case POP:
+                        NEED(sp >= 1);
+                        --sp;
+                        break;
+
+                case DUP:
+                        NEED(sp >= 1 && sp < LANE_STACK_SIZE);
+                        SET(g->stack[sp][l], g->stack[sp - 1][l]);
+                        ++sp;
+                        break;
+
+                case SWAP:
+                        NEED(sp >= 2);
+                        EACH_LANE {
+                                result[l] = g->stack[sp - 1][l];
+                        }
+                        EACH_LANE {
+                                g->stack[sp - 1][l] = (g->stack[sp - 2][l] & g->mask[l]) |
+                                        (result[l] & ~g->mask[l]);
+                                g->stack[sp - 2][l] = (result[l] & g->mask[l]) |
+                                        (g->stack[sp - 2][l] & ~g->mask[l]);
+                        }
+                        break;
+
+                case INVERT:
+                        NEED(sp >= 1);
+                        SET(g->stack[sp - 1][l], -g->stack[sp - 1][l]);
+                        break;
+
+                case ADD:
+                        BINARY(+)
+
+                case SUB:
+                        BINARY(-)
+
+                case MULT:
+                        BINARY(*)
+
+                case AND:
+                        BINARY(&)
+
+                case OR:
+                        BINARY(|)
+
+                case XOR:
+                        BINARY(^)
+
+                case SHL:
+                        NEED(sp >= 1);
+                        SET(g->stack[sp - 1][l],
+                                (int)((unsigned int)g->stack[sp - 1][l] << (cmd.arg & 31)));
+                        break;
+
+                case SHR:
+                        NEED(sp >= 1);
+                        SET(g->stack[sp - 1][l], g->stack[sp - 1][l] >> (cmd.arg & 31));
+                        break;
+
+                case VFILL:
+                case VCOPY:
+                case VADDS:
+                case VMULS:
+                case VADD:
+                case VSUM:
+                case VMIN:
+                case VMAX:
+                        next = operation_info(cmd.operation)->pop;
+                        NEED(sp >= next);
+                        SPLIT_LANES(!bulk_fits(cmd.operation, cmd.arg, g->stack + sp - next, bp, l));
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        bulk_lane(g, cmd.operation, cmd.arg, g->stack + sp - next, bp, l);
+                                }
+                        }
+                        sp -= next - operation_info(cmd.operation)->push;
+                        break;
+
+                case DIV:
+                        NEED(sp >= 2);
+                        SPLIT_LANES(0 == g->stack[sp - 1][l]);
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->stack[sp - 2][l] /= g->stack[sp - 1][l];
+                                }
+                        }
+                        --sp;
+                        break;
+
+                case COMPARE:
+                        NEED(sp >= 2 && cmd.arg >= EQ && cmd.arg <= GE);
+                        switch(cmd.arg) {
+                        COMPARE(EQ, ==)
+                        COMPARE(NE, !=)
+                        COMPARE(LT, <)
+                        COMPARE(GT, >)
+                        COMPARE(LE, <=)
+                        COMPARE(GE, >=)
+                        }
+                        --sp;
+                        break;
+
+                case JUMP:
+                        NEED((unsigned int)cmd.arg < MAX_PROGRAM_SIZE);
+                        pc = cmd.arg;
+                        continue;
+
+                case JUMP_YES:
+                case JUMP_NO:
+                        NEED((unsigned int)cmd.arg < MAX_PROGRAM_SIZE && sp >= 1);
+                        --sp;
+                        EACH_LANE {
+                                g->taken[l] = -((0 != g->stack[sp][l]) == (JUMP_YES == cmd.operation));
+                        }
+                        BRANCH(cmd.arg);
+
+                case INPUT:
+                        NEED(sp < LANE_STACK_SIZE);
+                        /* ,     , 
+                         *    
+                         */
+                        prompted = 1;
+                        SPLIT_LANES((fprintf(g->outputs[l], "> "), fflush(stdout),
+                                1 != fscanf(g->inputs[l], "%d", &g->stack[sp][l])));
+                        prompted = 0;
+                        ++sp;
+                        break;
+
+                case PRINT:
+                        NEED(sp >= 1);
+                        --sp;
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        fprintf(g->outputs[l], "%d\n", g->stack[sp][l]);
+                                }
+                        }
+                        break;
+
+                case SLOAD:
+                        address = bp + cmd.arg;
+                        NEED(address < LANE_STACK_SIZE && sp < LANE_STACK_SIZE);
+                        SET(g->stack[sp][l], g->frames[address][l]);
+                        ++sp;
+                        break;
+
+                case SSTORE:
+                        address = bp + cmd.arg;
+                        NEED(address < LANE_STACK_SIZE && sp >= 1);
+                        SET(g->frames[address][l], g->stack[sp - 1][l]);
+                        --sp;
+                        break;
+
+                case SJUMP:
+                        NEED((unsigned int)cmd.arg < MAX_PROGRAM_SIZE && sp >= 1);
+                        --sp;
+                        address = UINT_MAX;
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->taken[l] = (UINT_MAX != address &&
+                                                (unsigned int)g->stack[sp][l] != address);
+                                        address = g->stack[sp][l];
+                                }
+                        }
+                        EACH_LANE {
+                                if(g->mask[l] && g->taken[l]) {
+                                        break;
+                                }
+                        }
+                        if(VM_LANES == l) {
+                                pc = address;
+                                continue;
+                        }
+
+                        /*      */
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->pc[l] = g->stack[sp][l];
+                                        g->sp[l] = sp;
+                                        g->bp[l] = bp;
+                                        g->ft[l] = ft;
+                                        g->mask[l] = 0;
+                                }
+                        }
+                        goto next_group;
+
+                case BP:
+                        bp = sp + cmd.arg;
+                        break;
+
+                case SBLOAD:
+                        NEED(sp >= 1);
+                        SPLIT_LANES(bp + cmd.arg + g->stack[sp - 1][l] >= LANE_STACK_SIZE);
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->stack[sp - 1][l] = g->frames[bp + cmd.arg + g->stack[sp - 1][l]][l];
+                                }
+                        }
+                        break;
+
+                case SBSTORE:
+                        NEED(sp >= 2);
+                        SPLIT_LANES(bp + cmd.arg + g->stack[sp - 1][l] >= LANE_STACK_SIZE);
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->frames[bp + cmd.arg + g->stack[sp - 1][l]][l] = g->stack[sp - 2][l];
+                                }
+                        }
+                        sp -= 2;
+                        break;
+
+                case PUSH_ADD:
+                        NEED(sp >= 1);
+                        SET(g->stack[sp - 1][l], g->stack[sp - 1][l] + cmd.arg);
+                        break;
+
+                case PUSH_SUB:
+                        NEED(sp >= 1);
+                        SET(g->stack[sp - 1][l], g->stack[sp - 1][l] - cmd.arg);
+                        break;
+
+                case PUSH_MULT:
+                        NEED(sp >= 1);
+                        SET(g->stack[sp - 1][l], g->stack[sp - 1][l] * cmd.arg);
+                        break;
+
+                case PUSH_DIV:
+                        NEED(sp >= 1 && 0 != cmd.arg);
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->stack[sp - 1][l] /= cmd.arg;
+                                }
+                        }
+                        break;
+
+                case LOAD_ADD:
+                        NEED((unsigned int)cmd.arg < LANE_MEMORY_SIZE && sp >= 1);
+                        SET(g->stack[sp - 1][l], g->stack[sp - 1][l] + g->memory[cmd.arg][l]);
+                        break;
+
+                case SLOAD_ADD:
+                        address = bp + cmd.arg;
+                        NEED(address < LANE_STACK_SIZE && sp >= 1);
+                        SET(g->stack[sp - 1][l], g->stack[sp - 1][l] + g->frames[address][l]);
+                        break;
+
+                case INC:
+                        NEED((unsigned int)cmd.arg < LANE_MEMORY_SIZE);
+                        SET(g->memory[cmd.arg][l], g->memory[cmd.arg][l] + cmd.arg2);
+                        break;
+
+                case SINC:
+                        address = bp + cmd.arg;
+                        NEED(address < LANE_STACK_SIZE);
+                        SET(g->frames[address][l], g->frames[address][l] + cmd.arg2);
+                        break;
+
+                case COMPARE_JUMP_NO:
+                        NEED((unsigned int)cmd.arg2 < MAX_PROGRAM_SIZE && sp >= 2 &&
+                                cmd.arg >= EQ && cmd.arg <= GE);
+                        switch(cmd.arg) {
+                        COMPARE_TAKEN(EQ, ==)
+                        COMPARE_TAKEN(NE, !=)
+                        COMPARE_TAKEN(LT, <)
+                        COMPARE_TAKEN(GT, >)
+                        COMPARE_TAKEN(LE, <=)
+                        COMPARE_TAKEN(GE, >=)
+                        }
+                        sp -= 2;
+                        BRANCH(cmd.arg2);
+
+                case LOOP:
+                        NEED((unsigned int)cmd.arg2 < MAX_PROGRAM_SIZE &&
+                                (unsigned int)cmd.arg < LANE_MEMORY_SIZE && sp >= 2);
+                        SET(g->memory[cmd.arg][l],
+                                LOOP_NEXT(g->memory[cmd.arg][l], g->stack[sp - 1][l]));
+                        LOOP_TAKEN(g->memory[cmd.arg]);
+                        BRANCH(cmd.arg2);
+
+                case SLOOP:
+                        address = bp + cmd.arg;
+                        NEED((unsigned int)cmd.arg2 < MAX_PROGRAM_SIZE &&
+                                address < LANE_STACK_SIZE && sp >= 2);
+                        SET(g->frames[address][l],
+                                LOOP_NEXT(g->frames[address][l], g->stack[sp - 1][l]));
+                        LOOP_TAKEN(g->frames[address]);
+                        BRANCH(cmd.arg2);
+
+                case JUMP_TABLE:
+                        /* ,    ,
+                         *    ,   BRANCH
+                         */
+                        NEED((unsigned int)cmd.arg < MAX_PROGRAM_SIZE - pc - 1 && sp >= 1);
+                        --sp;
+                        first = -1;
+                        EACH_LANE {
+                                result[l] = (int)JUMP_TABLE_ENTRY(g->stack[sp][l], cmd.arg);
+                                if(g->mask[l] && first < 0) {
+                                        first = l;
+                                }
+                        }
+                        next = 0;
+                        EACH_LANE {
+                                next |= g->mask[l] & (result[l] ^ result[first]);
+                        }
+                        if(!next) {
+                                pc += 1 + result[first];
+                                continue;
+                        }
+                        EACH_LANE {
+                                if(g->mask[l]) {
+                                        g->pc[l] = pc + 1 + result[l];
+                                        g->sp[l] = sp;
+                                        g->bp[l] = bp;
+                                        g->ft[l] = ft;
+                                        g->mask[l] = 0;
+                                }
+                        }
+                        goto next_group;
+
+                case CALL:
+                        /*    bp     */
+                        NEED((unsigned int)cmd.arg < MAX_PROGRAM_SIZE &&
+                                (unsigned int)cmd.arg2 <= sp && ft + 2 + cmd.arg2 <= LANE_STACK_SIZE);
+                        SET(g->frames[ft][l], (int)(pc + 1));
+                        SET(g->frames[ft + 1][l], (int)bp);
+                        bp = ft + 2;
+                        ft = bp + cmd.arg2;
+                        sp -= cmd.arg2;
+                        for(next = 0; next < (unsigned int)cmd.arg2; ++next) {
+                                SET(g->frames[bp + next][l], g->stack[sp + next][l]);
+                        }
+                        pc = cmd.arg;
+                        continue;
+
+                case RET:
+                        address = bp - 2;
+                        NEED(cmd.arg >= 0 && cmd.arg <= 1 && (unsigned int)cmd.arg <= sp &&
+                                address < LANE_STACK_SIZE - 1);
+
+                        /* ,     
+                         *   ,    ,
+                         *  
+                         */
+                        first = -1;
+                        EACH_LANE {
+                                if(g->mask[l] && first < 0) {
+                                        first = l;
+                                }
+                        }
+                        SPLIT_LANES(g->frames[address][l] != g->frames[address][first] ||
+                                g->frames[address + 1][l] != g->frames[address + 1][first]);
+                        next = g->frames[address][first];
+                        bp = g->frames[address + 1][first];
+                        ft = address;
+                        pc = next;
+                        continue;
+
+                case ALLOC:
+                        NEED(cmd.arg >= 0 && ft + cmd.arg <= LANE_STACK_SIZE);
+                        for(next = ft; next < ft + cmd.arg; ++next) {
+                                SET(g->frames[next][l], 0);
+                        }
+                        ft += cmd.arg;
+                        break;
+
+                default:
+                        SPLIT_GROUP();
+                }
+
+                ++pc;
+                continue;
+
+next_group:
+                prompted = 0;
+                save_group(g, pc, sp, bp, ft);
+                if(!select_group(g, &pc, &sp, &bp, &ft, &other)) {
+                        return;
+                }
+        }
+}
+
+#undef EACH_LANE
+#undef SET
+#undef SPLIT_GROUP
+#undef SPLIT_LANES
+#undef NEED
+#undef BINARY
+#undef COMPARE
+#undef COMPARE_TAKEN
+#undef BRANCH
+
+void vm_run_lanes(const vm_image *image, unsigned int count, FILE **inputs,
+        FILE **outputs, vm_status *status)
+{
+        command *program = (command*)malloc((image->size + 1) * sizeof(command));
+        unsigned int first;
+        unsigned int i;
+
+        for(i = 0; NULL != program && i < image->size; ++i) {
+                program[i] = vm_fetch(image, i);
+        }
+
+        for(first = 0; first < count; first += VM_LANES) {
+                unsigned int n = (count - first < VM_LANES) ? count - first : VM_LANES;
+                lanes *g = (NULL == program) ? NULL : (lanes*)calloc(1, sizeof(lanes));
+                unsigned int l;
+
+                if(NULL == g) {
+                        for(l = 0; l < n; ++l) {
+                                status[first + l] = VM_NO_MEMORY;
+                        }
+                        continue;
+                }
+
+                g->image = image;
+                g->program = program;
+                g->size = image->size;
+                g->inputs = inputs + first;
+                g->outputs = outputs + first;
+                g->status = status + first;
+
+                /*   calloc()   .  
+                 *     , 
+                 *     vm_create().
+                 */
+                for(i = 0; i < image->data_size; ++i) {
+                        for(l = 0; l < VM_LANES && image->data[2 * i] < LANE_MEMORY_SIZE; ++l) {
+                                g->memory[image->data[2 * i]][l] = (int)image->data[2 * i + 1];
+                        }
+                }
+                for(l = 0; l < n; ++l) {
+                        g->running[l] = -1;
+                        g->pc[l] = image->entry;
+                        g->status[l] = VM_OK;
+                }
+
+                run_lanes(g);
+                free(g);
+        }
+
+        free(program);
+}
@@ -0,0 +1,622 @@
+/*      (. vmthread.c).
+ *
+ *   :
+ *     LOOP_NAME    -  ,
+ *     LOOP_CHECKED - 1,       ;
+ *                    0  ,  vm_image_verify().   
+ *                      ,   
+ *                    (  ,  BLOAD/BSTORE, SBLOAD/SBSTORE),
+ *                          
+ *                      BP, SJUMP, CALL  RET.
+ *
+ *   1,   ,  0,  
+ *       ,  
+ *   .      vm_state,
+ *       
+ *  .
+ *
+ *     (vm_set_quantum()).  
+ * ,     ,  vm_run()
+ *  VM_YIELD; vm_resume()    
+ * .
+ */
+
+#if LOOP_CHECKED
+#define SAVE_CALLS()    (vm->unchecked = 0)
+#define NEED(n)         do { if(sp < (n)) FAIL(STACK_EMPTY); } while(0)
+#define ROOM()          do { if(sp >= MAX_STACK_SIZE) FAIL(STACK_OVERFLOW); } while(0)
+#define CHECK(condition, error) \
+                        do { if(!(condition)) FAIL(error); } while(0)
+#else
+#define SAVE_CALLS()    (vm->unchecked = 1, vm->call_depth = calls)
+#define NEED(n)
+#define ROOM()
+#define CHECK(condition, error)
+#endif
+
+/*       JUMP*.  
+ *      .
+ */
+#if LOOP_CHECKED
+#define BRANCH(address) TARGET(address)
+#else
+#define BRANCH(address) (program + (address))
+#endif
+
+/*    pop     (vmbulk.c) */
+#define BULK(op, pop, push) \
+        CASE(op): \
+                NEED(pop); \
+                data = vm_bulk(vm, op, arg, vm->stack + sp - (pop), bp); \
+                if(data >= 0) FAIL((runtime_error)data); \
+                sp -= (pop) - (push); \
+                NEXT();
+
+/*   pc  target   .  
+ *   .
+ */
+#define TAKE(target) \
+        do { \
+                budget -= pc->cost; \
+                pc = (target); \
+                if(budget < 0) { \
+                        if(vm->quantum) { \
+                                SAVE_STATE(); \
+                                vm_fail(vm, VM_YIELD); \
+                        } \
+                        budget = INT_MAX; \
+                } \
+                JUMP_TO(pc); \
+        } while(0)
+
+static int LOOP_NAME(vm_state *vm)
+{
+        const vm_image *image = vm->image;
+        unsigned int size = image->size;
+        threaded_command *program;
+        threaded_command *pc;
+        unsigned int sp = vm->stack_pointer;
+        unsigned int bp = vm->base_pointer;
+        int budget = vm->budget;
+        unsigned int address;
+        int arg;
+        int data;
+#if !LOOP_CHECKED
+        unsigned int calls = vm->call_depth;
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+        static void *labels[TC_COUNT] = {
+                &&L_NOP, &&L_STOP, &&L_LOAD, &&L_STORE, &&L_BLOAD, &&L_BSTORE,
+                &&L_PUSH, &&L_POP, &&L_DUP, &&L_INVERT, &&L_ADD, &&L_SUB,
+                &&L_MULT, &&L_DIV, &&L_CMP_EQ, &&L_CMP_NE, &&L_CMP_LT,
+                &&L_CMP_GT, &&L_CMP_LE, &&L_CMP_GE, &&L_CMP_BAD, &&L_JUMP,
+                &&L_JUMP_YES, &&L_JUMP_NO, &&L_JUMP_BAD, &&L_CALL, &&L_INPUT, &&L_PRINT,
+                &&L_SLOAD, &&L_SSTORE, &&L_SJUMP, &&L_BP, &&L_SBLOAD,
+                &&L_SBSTORE, &&L_PUSH_ADD, &&L_PUSH_SUB, &&L_PUSH_MULT,
+                &&L_PUSH_DIV, &&L_LOAD_ADD, &&L_SLOAD_ADD, &&L_INC, &&L_SINC,
+                &&L_CJ_EQ, &&L_CJ_NE, &&L_CJ_LT, &&L_CJ_GT, &&L_CJ_LE, &&L_CJ_GE,
+                &&L_CALLF, &&L_RET, &&L_ALLOC, &&L_SWAP, &&L_SHL, &&L_SHR,
+                &&L_AND, &&L_OR, &&L_XOR, &&L_VFILL, &&L_VCOPY, &&L_VADDS,
+                &&L_VMULS, &&L_VADD, &&L_VSUM, &&L_VMIN, &&L_VMAX, &&L_LOOP,
+                &&L_SLOOP, &&L_JUMP_TABLE, &&L_UNKNOWN, &&L_END
+        };
+        unsigned int i;
+#endif
+
+        program = decode_program(vm);
+
+#ifdef VM_COMPUTED_GOTO
+        /*  vm_resume()     */
+        if(vm->threaded_labels != labels) {
+                for(i = 0; i <= size; ++i) {
+                        program[i].handler = labels[program[i].op];
+                }
+                vm->threaded_labels = labels;
+        }
+#endif
+
+        pc = TARGET(vm->command_pointer);
+        arg = pc->arg;
+
+#ifdef VM_COMPUTED_GOTO
+        DISPATCH();
+#else
+dispatch:
+        arg = pc->arg;
+        switch(pc->op) {
+#endif
+
+        CASE(NOP):
+                NEXT();
+
+        CASE(LOAD):
+                CHECK((unsigned int)arg < MAX_MEMORY_SIZE, BAD_DATA_ADDRESS);
+                ROOM();
+                vm->stack[sp++] = vm->memory[arg];
+                NEXT();
+
+        CASE(STORE):
+                NEED(1);
+                CHECK((unsigned int)arg < MAX_MEMORY_SIZE, BAD_DATA_ADDRESS);
+                vm->memory[arg] = vm->stack[--sp];
+                NEXT();
+
+        CASE(BLOAD):
+                NEED(1);
+                address = arg + vm->stack[sp - 1];
+                if(address >= MAX_MEMORY_SIZE) FAIL(BAD_DATA_ADDRESS);
+                vm->stack[sp - 1] = vm->memory[address];
+                NEXT();
+
+        CASE(BSTORE):
+                NEED(2);
+                address = arg + vm->stack[sp - 1];
+                if(address >= MAX_MEMORY_SIZE) FAIL(BAD_DATA_ADDRESS);
+                vm->memory[address] = vm->stack[sp - 2];
+                sp -= 2;
+                NEXT();
+
+        CASE(PUSH):
+                ROOM();
+                vm->stack[sp++] = arg;
+                NEXT();
+
+        CASE(POP):
+                NEED(1);
+                --sp;
+                NEXT();
+
+        CASE(DUP):
+                NEED(1);
+                ROOM();
+                vm->stack[sp] = vm->stack[sp - 1];
+                ++sp;
+                NEXT();
+
+        CASE(SWAP):
+                NEED(2);
+                data = vm->stack[sp - 1];
+                vm->stack[sp - 1] = vm->stack[sp - 2];
+                vm->stack[sp - 2] = data;
+                NEXT();
+
+        CASE(INVERT):
+                NEED(1);
+                vm->stack[sp - 1] = -vm->stack[sp - 1];
+                NEXT();
+
+        CASE(ADD):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] += vm->stack[sp];
+                NEXT();
+
+        CASE(SUB):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] -= vm->stack[sp];
+                NEXT();
+
+        CASE(MULT):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] *= vm->stack[sp];
+                NEXT();
+
+        CASE(DIV):
+                NEED(1);
+                if(0 == vm->stack[sp - 1]) FAIL(DIVISION_BY_ZERO);
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] /= vm->stack[sp];
+                NEXT();
+
+        CASE(CMP_EQ):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] = (vm->stack[sp - 1] == vm->stack[sp]) ? 1 : 0;
+                NEXT();
+
+        CASE(CMP_NE):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] = (vm->stack[sp - 1] != vm->stack[sp]) ? 1 : 0;
+                NEXT();
+
+        CASE(CMP_LT):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] = (vm->stack[sp - 1] < vm->stack[sp]) ? 1 : 0;
+                NEXT();
+
+        CASE(CMP_GT):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] = (vm->stack[sp - 1] > vm->stack[sp]) ? 1 : 0;
+                NEXT();
+
+        CASE(CMP_LE):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] = (vm->stack[sp - 1] <= vm->stack[sp]) ? 1 : 0;
+                NEXT();
+
+        CASE(CMP_GE):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] = (vm->stack[sp - 1] >= vm->stack[sp]) ? 1 : 0;
+                NEXT();
+
+        CASE(CMP_BAD):
+                NEED(1);
+                --sp;
+                FAIL(BAD_RELATION);
+                NEXT();
+
+        CASE(JUMP):
+                TAKE(BRANCH(arg));
+
+        CASE(JUMP_YES):
+                NEED(1);
+                if(vm->stack[--sp]) {
+                        TAKE(BRANCH(arg));
+                }
+                NEXT();
+
+        CASE(JUMP_NO):
+                NEED(1);
+                if(!vm->stack[--sp]) {
+                        TAKE(BRANCH(arg));
+                }
+                NEXT();
+
+        CASE(CALL):
+#if !LOOP_CHECKED
+                if(calls >= MAX_STACK_SIZE) {
+                        SAVE_STATE();
+                        return 0;
+                }
+                vm->calls[calls].return_address = pc - program + 1;
+                vm->calls[calls].stack_pointer =
+                        sp + vm_call_effect(image, pc - program);
+                ++calls;
+#endif
+                TAKE(BRANCH(arg));
+
+        CASE(JUMP_BAD):
+                FAIL(BAD_CODE_ADDRESS);
+                NEXT();
+
+        CASE(INPUT):
+                SAVE_STATE();
+                data = vm_read(vm);
+                ROOM();
+                vm->stack[sp++] = data;
+                NEXT();
+
+        CASE(PRINT):
+                NEED(1);
+                vm_write(vm, vm->stack[--sp]);
+                NEXT();
+
+        CASE(SLOAD):
+                address = bp + arg;
+                CHECK(address < MAX_STACK_SIZE, STACK_CORRUPTED);
+                ROOM();
+                vm->stack[sp++] = vm->frames[address];
+                NEXT();
+
+        CASE(SSTORE):
+                NEED(1);
+                address = bp + arg;
+                CHECK(address < MAX_STACK_SIZE, STACK_CORRUPTED);
+                vm->frames[address] = vm->stack[--sp];
+                NEXT();
+
+        CASE(SJUMP):
+#if LOOP_CHECKED
+                NEED(1);
+                data = vm->stack[--sp];
+                TAKE(TARGET(data));
+#else
+                /*     ,  
+                 *  ,     , 
+                 *  .
+                 */
+                data = vm->stack[sp - 1];
+                if(0 == calls ||
+                                (unsigned int)data != vm->calls[calls - 1].return_address ||
+                                sp - 1 != vm->calls[calls - 1].stack_pointer) {
+                        SAVE_STATE();
+                        return 0;
+                }
+                --calls;
+                --sp;
+                TAKE(program + data);
+#endif
+
+        CASE(BP):
+#if !LOOP_CHECKED
+                if(!vm_frame_allowed(image, pc - program, sp + arg)) {
+                        SAVE_STATE();
+                        return 0;
+                }
+#endif
+                bp = sp + arg;
+                NEXT();
+
+        CASE(SBLOAD):
+                NEED(1);
+                address = bp + (unsigned int)(arg + vm->stack[sp - 1]);
+                if(address >= MAX_STACK_SIZE) FAIL(STACK_CORRUPTED);
+                vm->stack[sp - 1] = vm->frames[address];
+                NEXT();
+
+        CASE(SBSTORE):
+                NEED(2);
+                address = bp + (unsigned int)(arg + vm->stack[sp - 1]);
+                if(address >= MAX_STACK_SIZE) FAIL(STACK_CORRUPTED);
+                vm->frames[address] = vm->stack[sp - 2];
+                sp -= 2;
+                NEXT();
+
+        CASE(PUSH_ADD):
+                NEED(1);
+                vm->stack[sp - 1] += arg;
+                NEXT();
+
+        CASE(PUSH_SUB):
+                NEED(1);
+                vm->stack[sp - 1] -= arg;
+                NEXT();
+
+        CASE(PUSH_MULT):
+                NEED(1);
+                vm->stack[sp - 1] *= arg;
+                NEXT();
+
+        CASE(SHL):
+                NEED(1);
+                vm->stack[sp - 1] = (int)((unsigned int)vm->stack[sp - 1] << (arg & 31));
+                NEXT();
+
+        CASE(SHR):
+                NEED(1);
+                vm->stack[sp - 1] >>= arg & 31;
+                NEXT();
+
+        CASE(AND):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] &= vm->stack[sp];
+                NEXT();
+
+        CASE(OR):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] |= vm->stack[sp];
+                NEXT();
+
+        CASE(XOR):
+                NEED(2);
+                --sp;
+                vm->stack[sp - 1] ^= vm->stack[sp];
+                NEXT();
+
+        BULK(VFILL, 3, 0)
+        BULK(VCOPY, 3, 0)
+        BULK(VADDS, 3, 0)
+        BULK(VMULS, 3, 0)
+        BULK(VADD, 4, 0)
+        BULK(VSUM, 2, 1)
+        BULK(VMIN, 2, 1)
+        BULK(VMAX, 2, 1)
+
+        CASE(PUSH_DIV):
+                if(0 == arg) FAIL(DIVISION_BY_ZERO);
+                NEED(1);
+                vm->stack[sp - 1] /= arg;
+                NEXT();
+
+        CASE(LOAD_ADD):
+                CHECK((unsigned int)arg < MAX_MEMORY_SIZE, BAD_DATA_ADDRESS);
+                NEED(1);
+                vm->stack[sp - 1] += vm->memory[arg];
+                NEXT();
+
+        CASE(SLOAD_ADD):
+                address = bp + arg;
+                CHECK(address < MAX_STACK_SIZE, STACK_CORRUPTED);
+                NEED(1);
+                vm->stack[sp - 1] += vm->frames[address];
+                NEXT();
+
+        CASE(INC):
+                CHECK((unsigned int)arg < MAX_MEMORY_SIZE, BAD_DATA_ADDRESS);
+                vm->memory[arg] += pc->arg2;
+                NEXT();
+
+        CASE(SINC):
+                address = bp + arg;
+                CHECK(address < MAX_STACK_SIZE, STACK_CORRUPTED);
+                vm->frames[address] += pc->arg2;
+                NEXT();
+
+        CASE(CJ_EQ):
+                NEED(2);
+                sp -= 2;
+                if(!(vm->stack[sp] == vm->stack[sp + 1])) {
+                        TAKE(BRANCH(pc->arg2));
+                }
+                NEXT();
+
+        CASE(CJ_NE):
+                NEED(2);
+                sp -= 2;
+                if(!(vm->stack[sp] != vm->stack[sp + 1])) {
+                        TAKE(BRANCH(pc->arg2));
+                }
+                NEXT();
+
+        CASE(CJ_LT):
+                NEED(2);
+                sp -= 2;
+                if(!(vm->stack[sp] < vm->stack[sp + 1])) {
+                        TAKE(BRANCH(pc->arg2));
+                }
+                NEXT();
+
+        CASE(CJ_GT):
+                NEED(2);
+                sp -= 2;
+                if(!(vm->stack[sp] > vm->stack[sp + 1])) {
+                        TAKE(BRANCH(pc->arg2));
+                }
+                NEXT();
+
+        CASE(CJ_LE):
+                NEED(2);
+                sp -= 2;
+                if(!(vm->stack[sp] <= vm->stack[sp + 1])) {
+                        TAKE(BRANCH(pc->arg2));
+                }
+                NEXT();
+
+        CASE(CJ_GE):
+                NEED(2);
+                sp -= 2;
+                if(!(vm->stack[sp] >= vm->stack[sp + 1])) {
+                        TAKE(BRANCH(pc->arg2));
+                }
+                NEXT();
+
+        CASE(LOOP):
+                CHECK((unsigned int)arg < MAX_MEMORY_SIZE, BAD_DATA_ADDRESS);
+                NEED(2);
+                data = LOOP_NEXT(vm->memory[arg], vm->stack[sp - 1]);
+                vm->memory[arg] = data;
+                if(LOOP_CONTINUES(data, vm->stack[sp - 2], vm->stack[sp - 1])) {
+                        TAKE(BRANCH(pc->arg2));
+                }
+                NEXT();
+
+        CASE(SLOOP):
+                address = bp + arg;
+                CHECK(address < MAX_STACK_SIZE, STACK_CORRUPTED);
+                NEED(2);
+                data = LOOP_NEXT(vm->frames[address], vm->stack[sp - 1]);
+                vm->frames[address] = data;
+                if(LOOP_CONTINUES(data, vm->stack[sp - 2], vm->stack[sp - 1])) {
+                        TAKE(BRANCH(pc->arg2));
+                }
+                NEXT();
+
+        CASE(JUMP_TABLE):
+                /*  JUMP      */
+                NEED(1);
+                data = vm->stack[--sp];
+                pc = BRANCH(pc - program + 1 + JUMP_TABLE_ENTRY(data, arg));
+                if(TC_JUMP == pc->op) {
+                        TAKE(BRANCH(pc->arg));
+                }
+                JUMP_TO(pc);
+
+        CASE(CALLF):
+                /*       , 
+                 *       
+                 */
+                data = pc->arg2;
+                NEED((unsigned int)data);
+                address = vm->frame_top;
+                CHECK(address + 2 + data <= MAX_STACK_SIZE, STACK_OVERFLOW);
+#if !LOOP_CHECKED
+                if(calls >= MAX_STACK_SIZE || address + 2 + data > MAX_STACK_SIZE ||
+                                !vm_frame_allowed(image, pc - program, address + 2)) {
+                        SAVE_STATE();
+                        return 0;
+                }
+                vm->calls[calls].return_address = pc - program + 1;
+                vm->calls[calls].stack_pointer =
+                        sp + vm_call_effect(image, pc - program);
+                vm->calls[calls].base_pointer = bp;
+                ++calls;
+#endif
+                vm->frames[address] = pc - program + 1;
+                vm->frames[address + 1] = bp;
+                bp = address + 2;
+                vm->frame_top = bp + data;
+                for(; data > 0; --data) {
+                        vm->frames[bp + data - 1] = vm->stack[--sp];
+                }
+                TAKE(BRANCH(arg));
+
+        CASE(RET):
+                NEED((unsigned int)arg);
+                address = bp - 2;
+#if LOOP_CHECKED
+                CHECK(address < MAX_STACK_SIZE - 1, STACK_CORRUPTED);
+                data = vm->frames[address];
+#else
+                /*       :
+                 *    ,    
+                 *     ,   .
+                 */
+                if(0 == calls || address >= MAX_STACK_SIZE - 1 ||
+                                (unsigned int)vm->frames[address] != vm->calls[calls - 1].return_address ||
+                                (unsigned int)vm->frames[address + 1] != vm->calls[calls - 1].base_pointer ||
+                                sp != vm->calls[calls - 1].stack_pointer) {
+                        SAVE_STATE();
+                        return 0;
+                }
+                --calls;
+                data = vm->frames[address];
+#endif
+                /*       */
+                bp = vm->frames[address + 1];
+                vm->frame_top = address;
+#if LOOP_CHECKED
+                TAKE(TARGET(data));
+#else
+                TAKE(program + data);
+#endif
+
+        CASE(ALLOC):
+                address = vm->frame_top;
+                if((unsigned int)arg > MAX_STACK_SIZE - address) {
+#if LOOP_CHECKED
+                        FAIL(STACK_OVERFLOW);
+#else
+                        SAVE_STATE();
+                        return 0;
+#endif
+                }
+                memset(vm->frames + address, 0, arg * sizeof(int));
+                vm->frame_top = address + arg;
+                NEXT();
+
+        CASE(UNKNOWN):
+                FAIL(UNKNOWN_COMMAND);
+                NEXT();
+
+        CASE(STOP):
+        CASE(END):
+#ifndef VM_COMPUTED_GOTO
+        default:
+                break;
+        }
+#endif
+
+        SAVE_STATE();
+        return 1;
+}
+
+#undef SAVE_CALLS
+#undef TAKE
+#undef NEED
+#undef ROOM
+#undef CHECK
+#undef BRANCH
+#undef BULK
+#undef LOOP_NAME
+#undef LOOP_CHECKED
@@ -0,0 +1,229 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE             /* mremap() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vmint.h"
+
+/*  , ,      .
+ *
+ *       
+ * :         ,
+ *      , 
+ * ,        
+ * MAX_MEMORY_SIZE    MAX_STACK_SIZE    .
+ *
+ *       |  |  |  |   |  |  
+ *
+ *      ,    
+ *     .   : 
+ *    SIGSEGV.  ,   
+ * ,    ,    (vmjit.c)  BLOAD/BSTORE
+ *  SBLOAD/SBSTORE  :  vm_guard_memory()  
+ *        32- , 
+ *       .
+ *
+ *    .     
+ *    ,   C  
+ *        , 
+ *        
+ * ,    ,     .
+ *         .
+ *  ,    32    ,
+ *     .
+ *
+ *    (Windows)     ,
+ *   calloc()   .
+ */
+
+/*     */
+#define STACK_BYTES     ((size_t)2 * MAX_STACK_SIZE * sizeof(int))
+#define MEMORY_BYTES    ((size_t)MAX_MEMORY_SIZE * sizeof(int))
+#define CALLS_BYTES     ((size_t)MAX_STACK_SIZE * sizeof(vm_call_frame))
+
+#if !defined(_WIN32)
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE   0
+#endif
+
+/* ,   0 .. 2^32 - 1    */
+#define FULL_GUARD      ((size_t)4 << 32)
+
+/*      */
+static size_t page_size()
+{
+        return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/*       guard   
+ *  ;   
+ */
+static size_t layout(size_t guard, size_t *stack, size_t *memory, size_t *calls)
+{
+        *stack = page_size();
+        *memory = *stack + STACK_BYTES + guard;
+        *calls = *memory + MEMORY_BYTES + guard;
+        return *calls + CALLS_BYTES;
+}
+
+static void place(vm_state *vm, char *base, size_t size, size_t guard)
+{
+        size_t stack;
+        size_t memory;
+        size_t calls;
+
+        layout(guard, &stack, &memory, &calls);
+        vm->regions = base;
+        vm->regions_size = size;
+        vm->stack = (int*)(base + stack);
+        vm->frames = vm->stack + MAX_STACK_SIZE;
+        vm->memory = (int*)(base + memory);
+        vm->calls = (vm_call_frame*)(base + calls);
+}
+
+/*  size    () */
+static char* reserve(size_t size)
+{
+        void *base = mmap(NULL, size, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        return (MAP_FAILED == base) ? NULL : (char*)base;
+}
+
+/*  ,  ,   size    at */
+static int commit(char *at, size_t size)
+{
+        return MAP_FAILED != mmap(at, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+}
+
+#endif
+
+int vm_map_memory(vm_state *vm)
+{
+#if !defined(_WIN32)
+        size_t stack;
+        size_t memory;
+        size_t calls;
+        size_t size = layout(page_size(), &stack, &memory, &calls);
+        char *base = reserve(size);
+
+        if(NULL != base) {
+                if(commit(base + stack, STACK_BYTES) &&
+                                commit(base + memory, MEMORY_BYTES) &&
+                                commit(base + calls, CALLS_BYTES)) {
+                        place(vm, base, size, page_size());
+                        return 1;
+                }
+                munmap(base, size);
+        }
+#endif
+
+        vm->regions = calloc(1, STACK_BYTES + MEMORY_BYTES + CALLS_BYTES);
+        if(NULL == vm->regions) {
+                return 0;
+        }
+        vm->regions_size = 0;
+        vm->stack = (int*)vm->regions;
+        vm->frames = vm->stack + MAX_STACK_SIZE;
+        vm->memory = (int*)((char*)vm->regions + STACK_BYTES);
+        vm->calls = (vm_call_frame*)((char*)vm->regions + STACK_BYTES + MEMORY_BYTES);
+        return 1;
+}
+
+void vm_clear_memory(vm_state *vm)
+{
+#if !defined(_WIN32)
+        /*    ,   
+         * :        .
+         */
+        if(0 != vm->regions_size && commit((char*)vm->stack, STACK_BYTES) &&
+                        commit((char*)vm->memory, MEMORY_BYTES)) {
+                return;
+        }
+#endif
+        memset(vm->memory, 0, MEMORY_BYTES);
+        memset(vm->stack, 0, STACK_BYTES);
+}
+
+void vm_unmap_memory(vm_state *vm)
+{
+#if !defined(_WIN32)
+        if(0 != vm->regions_size) {
+                munmap(vm->regions, vm->regions_size);
+                return;
+        }
+#endif
+        free(vm->regions);
+}
+
+#if defined(__linux__)
+
+/*  size    from  to   */
+static int move(void *from, void *to, size_t size)
+{
+        return MAP_FAILED != mremap(from, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, to);
+}
+
+int vm_guard_memory(vm_state *vm)
+{
+        size_t stack;
+        size_t memory;
+        size_t calls;
+        size_t size;
+        char *base;
+
+        if(vm->guarded) {
+                return 1;
+        }
+        if(0 == vm->regions_size) {
+                return 0;
+        }
+
+        /*        ;
+         *     ,  .
+         *      ( 32  )
+         *  ,       .
+         */
+        size = layout(FULL_GUARD, &stack, &memory, &calls);
+        base = reserve(size);
+        if(NULL == base) {
+                return 0;
+        }
+
+        if(!move(vm->stack, base + stack, STACK_BYTES)) {
+                munmap(base, size);
+                return 0;
+        }
+        if(!move(vm->memory, base + memory, MEMORY_BYTES)) {
+                move(base + stack, vm->stack, STACK_BYTES);
+                munmap(base, size);
+                return 0;
+        }
+        if(!move(vm->calls, base + calls, CALLS_BYTES)) {
+                move(base + stack, vm->stack, STACK_BYTES);
+                move(base + memory, vm->memory, MEMORY_BYTES);
+                munmap(base, size);
+                return 0;
+        }
+
+        munmap(vm->regions, vm->regions_size);
+        place(vm, base, size, FULL_GUARD);
+        vm->guarded = 1;
+        return 1;
+}
+
+#else
+
+int vm_guard_memory(vm_state *vm)
+{
+        return 0;
+}
+
+#endif
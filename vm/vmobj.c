@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vmint.h"
+
+/*   .
+ *
+ *        ,   
+ *     (. vmint.h),   
+ *           :
+ * ,       
+ *      .  
+ *    ,   .
+ *
+ *          ,
+ *       
+ *  .
+ */
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*   */
+enum {
+        HEADER_MAGIC = 0,
+        HEADER_VERSION,
+        HEADER_ENTRY,
+        HEADER_CODE,
+        HEADER_WIDE,
+        HEADER_DATA
+};
+
+/*     ( Windows -  ).
+ *  NULL,        
+ * ,     size.
+ */
+static unsigned int* map_file(const char *file_name, size_t *size)
+{
+#if !defined(_WIN32)
+        struct stat info;
+        void *base;
+        int fd = open(file_name, O_RDONLY);
+
+        if(fd < 0) {
+                return NULL;
+        }
+
+        if(0 != fstat(fd, &info) || info.st_size < OBJECT_HEADER_WORDS * 4) {
+                close(fd);
+                return NULL;
+        }
+
+        *size = (size_t)info.st_size;
+        base = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        return (MAP_FAILED == base) ? NULL : (unsigned int*)base;
+#else
+        unsigned int *base;
+        long length;
+        FILE *file = fopen(file_name, "rb");
+
+        if(NULL == file) {
+                return NULL;
+        }
+
+        if(0 != fseek(file, 0, SEEK_END) || (length = ftell(file)) < OBJECT_HEADER_WORDS * 4) {
+                fclose(file);
+                return NULL;
+        }
+
+        *size = (size_t)length;
+        base = (unsigned int*)malloc(*size);
+        rewind(file);
+        if(NULL != base && 1 != fread(base, *size, 1, file)) {
+                free(base);
+                base = NULL;
+        }
+        fclose(file);
+
+        return base;
+#endif
+}
+
+/*  ,  map_file() */
+static void unmap_file(void *base, size_t size)
+{
+#if !defined(_WIN32)
+        munmap(base, size);
+#else
+        free(base);
+#endif
+}
+
+vm_status vm_image_load(vm_image *image, void *object, size_t size)
+{
+        unsigned int *header = (unsigned int*)object;
+        packed_command *code;
+        int *wide;
+        unsigned int *data;
+        unsigned int code_size;
+        unsigned int wide_size;
+        unsigned int data_size;
+        unsigned int i;
+
+        if(size < OBJECT_HEADER_WORDS * 4 || 0 != memcmp(header, OBJECT_MAGIC, 4)) {
+                return VM_NOT_OBJECT;
+        }
+
+        /*          */
+        if(OBJECT_VERSION != header[HEADER_VERSION]) {
+                return VM_BAD_VERSION;
+        }
+
+        code_size = header[HEADER_CODE];
+        wide_size = header[HEADER_WIDE];
+        data_size = header[HEADER_DATA];
+        if(code_size > MAX_PROGRAM_SIZE || wide_size > 2 * MAX_PROGRAM_SIZE ||
+                        data_size > MAX_MEMORY_SIZE ||
+                        size != 4 * ((size_t)OBJECT_HEADER_WORDS + code_size +
+                                wide_size + 2 * (size_t)data_size) ||
+                        (header[HEADER_ENTRY] >= code_size && 0 != header[HEADER_ENTRY])) {
+                return VM_BAD_HEADER;
+        }
+
+        code = header + OBJECT_HEADER_WORDS;
+        wide = (int*)(code + code_size);
+        data = (unsigned int*)(wide + wide_size);
+
+        /*        :
+         *     .
+         */
+        for(i = 0; i < code_size; ++i) {
+                if(NULL == operation_info((operation)PACKED_CODE(code[i])) ||
+                                ((code[i] & PACKED_WIDE) &&
+                                 (PACKED_FIELD(code[i]) < 0 ||
+                                  (unsigned int)PACKED_FIELD(code[i]) + 1 >= wide_size))) {
+                        return VM_BAD_OBJECT_COMMAND;
+                }
+        }
+
+        for(i = 0; i < data_size; ++i) {
+                if(data[2 * i] >= MAX_MEMORY_SIZE) {
+                        return VM_BAD_OBJECT_DATA;
+                }
+        }
+
+        /* ,    ,  */
+        if(image->code_capacity) {
+                free(image->code);
+        }
+        if(image->wide_capacity) {
+                free(image->wide);
+        }
+        if(image->data_capacity) {
+                free(image->data);
+        }
+
+        image->code = code;
+        image->size = code_size;
+        image->code_capacity = 0;
+        image->wide = wide;
+        image->wide_size = wide_size;
+        image->wide_capacity = 0;
+        image->data = data;
+        image->data_size = data_size;
+        image->data_capacity = 0;
+        image->entry = header[HEADER_ENTRY];
+        image->verified = 0;
+        return VM_OK;
+}
+
+vm_status vm_image_load_file(vm_image *image, const char *file_name)
+{
+        size_t size;
+        unsigned int *object = map_file(file_name, &size);
+        vm_status status;
+
+        if(NULL == object) {
+                return VM_NOT_OBJECT;
+        }
+
+        status = vm_image_load(image, object, size);
+        if(VM_OK != status) {
+                unmap_file(object, size);
+                return status;
+        }
+
+        vm_release_object(image);
+        image->mapping = object;
+        image->mapping_size = size;
+        return VM_OK;
+}
+
+void vm_release_object(vm_image *image)
+{
+        if(NULL != image->mapping) {
+                unmap_file(image->mapping, image->mapping_size);
+                image->mapping = NULL;
+        }
+}
@@ -38,10 +38,39 @@ void yyerror(char const *);
 %token T_BP
 %token T_SBLOAD
 %token T_SBSTORE
+%token T_PUSH_ADD
+%token T_PUSH_SUB
+%token T_PUSH_MULT
+%token T_PUSH_DIV
+%token T_LOAD_ADD
+%token T_SLOAD_ADD
+%token T_INC
+%token T_SINC
+%token T_COMPARE_JUMP_NO
+%token T_CALL
+%token T_RET
+%token T_ALLOC
+%token T_SWAP
+%token T_SHL
+%token T_SHR
+%token T_AND
+%token T_OR
+%token T_XOR
+%token T_VFILL
+%token T_VCOPY
+%token T_VADDS
+%token T_VMULS
+%token T_VADD
+%token T_VSUM
+%token T_VMIN
+%token T_VMAX
+%token T_LOOP
+%token T_SLOOP
+%token T_JUMP_TABLE
 
 %%
 
-program         : line program
+program         : program line
                 | line
                 ;
 
@@ -72,6 +101,36 @@ line            : T_INT T_COLON T_NOP                    { put_command($1, NOP,
                 | T_INT T_COLON T_BP        T_INT        { put_command($1, BP,   		 $4); }
                 | T_INT T_COLON T_SBLOAD    T_INT        { put_command($1, SBLOAD,    $4); }
                 | T_INT T_COLON T_SBSTORE   T_INT        { put_command($1, SBSTORE,   $4); }
+                | T_INT T_COLON T_PUSH_ADD  T_INT        { put_command($1, PUSH_ADD,  $4); }
+                | T_INT T_COLON T_PUSH_SUB  T_INT        { put_command($1, PUSH_SUB,  $4); }
+                | T_INT T_COLON T_PUSH_MULT T_INT        { put_command($1, PUSH_MULT, $4); }
+                | T_INT T_COLON T_PUSH_DIV  T_INT        { put_command($1, PUSH_DIV,  $4); }
+                | T_INT T_COLON T_LOAD_ADD  T_INT        { put_command($1, LOAD_ADD,  $4); }
+                | T_INT T_COLON T_SLOAD_ADD T_INT        { put_command($1, SLOAD_ADD, $4); }
+                | T_INT T_COLON T_INC       T_INT T_INT  { put_command2($1, INC,  $4, $5); }
+                | T_INT T_COLON T_SINC      T_INT T_INT  { put_command2($1, SINC, $4, $5); }
+                | T_INT T_COLON T_COMPARE_JUMP_NO T_INT T_INT
+                                                         { put_command2($1, COMPARE_JUMP_NO, $4, $5); }
+                | T_INT T_COLON T_CALL      T_INT T_INT  { put_command2($1, CALL, $4, $5); }
+                | T_INT T_COLON T_RET       T_INT        { put_command($1, RET,       $4); }
+                | T_INT T_COLON T_ALLOC     T_INT        { put_command($1, ALLOC,     $4); }
+                | T_INT T_COLON T_SWAP                   { put_command($1, SWAP,      0);  }
+                | T_INT T_COLON T_SHL       T_INT        { put_command($1, SHL,       $4); }
+                | T_INT T_COLON T_SHR       T_INT        { put_command($1, SHR,       $4); }
+                | T_INT T_COLON T_AND                    { put_command($1, AND,       0);  }
+                | T_INT T_COLON T_OR                     { put_command($1, OR,        0);  }
+                | T_INT T_COLON T_XOR                    { put_command($1, XOR,       0);  }
+                | T_INT T_COLON T_VFILL     T_INT        { put_command($1, VFILL,     $4); }
+                | T_INT T_COLON T_VCOPY     T_INT        { put_command($1, VCOPY,     $4); }
+                | T_INT T_COLON T_VADDS     T_INT        { put_command($1, VADDS,     $4); }
+                | T_INT T_COLON T_VMULS     T_INT        { put_command($1, VMULS,     $4); }
+                | T_INT T_COLON T_VADD      T_INT        { put_command($1, VADD,      $4); }
+                | T_INT T_COLON T_VSUM      T_INT        { put_command($1, VSUM,      $4); }
+                | T_INT T_COLON T_VMIN      T_INT        { put_command($1, VMIN,      $4); }
+                | T_INT T_COLON T_VMAX      T_INT        { put_command($1, VMAX,      $4); }
+                | T_INT T_COLON T_LOOP      T_INT T_INT  { put_command2($1, LOOP,  $4, $5); }
+                | T_INT T_COLON T_SLOOP     T_INT T_INT  { put_command2($1, SLOOP, $4, $5); }
+                | T_INT T_COLON T_JUMP_TABLE T_INT       { put_command($1, JUMP_TABLE, $4); }
                 ;
 %%
 
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vmint.h"
+
+/*      (quickening).
+ *
+ *     vm->quick_code.  
+ *    vm_run_command()    
+ *  ,        
+ * (. QUICK()  vmint.h). ,    
+ * ( LOAD/STORE,  ,  , 
+ * PUSH_DIV),      ,   
+ *        ,  
+ *      .
+ *
+ * ,    ( ,  BLOAD/SLOAD,
+ *   ),     ,  -
+ * .    ,   
+ * vm_run_command()   ,   
+ * ,       .
+ *
+ *     :     
+ * .     ,  
+ *   ,   NOP    .
+ */
+
+/*    vm->quick_code   .
+ *      ,    
+ *    .     .
+ */
+static void quick_prepare(vm_state *vm)
+{
+        const vm_image *image = vm->image;
+        unsigned int i;
+
+        if(NULL != vm->quick_code) {
+                return;
+        }
+        vm->quick_code = (packed_command*)vm_allocate(vm,
+                (image->size + 1) * sizeof(packed_command));
+        for(i = 0; i < image->size; ++i) {
+                vm->quick_code[i] = image->code[i];
+        }
+}
+
+#define NEXT()          ++cp; continue
+
+/*   :    0    
+ * ,    (, CALL  )
+ */
+#define ARG2()          ((word & PACKED_WIDE) ? wide[PACKED_FIELD(word) + 1] : 0)
+
+/*   COMPARE  COMPARE_JUMP_NO */
+#define COMPARE(cmp, relation) \
+        case QUICK_COMPARE(cmp): \
+                if(sp < 2) break; \
+                --sp; \
+                stack[sp - 1] = (stack[sp - 1] relation stack[sp]) ? 1 : 0; \
+                NEXT();
+
+#define COMPARE_JUMP_NO(cmp, relation) \
+        case QUICK_COMPARE_JUMP_NO(cmp): \
+                if(sp < 2) break; \
+                sp -= 2; \
+                cp = (stack[sp] relation stack[sp + 1]) ? cp + 1 : (unsigned int)arg; \
+                continue;
+
+void run_quick(vm_state *vm)
+{
+        const packed_command *code;
+        const int *wide = vm->image->wide;
+        unsigned int size = vm->image->size;
+        int *stack = vm->stack;
+        int *frames = vm->frames;
+        int *memory = vm->memory;
+        unsigned int sp;
+        unsigned int bp;
+        unsigned int cp;
+        unsigned int address;
+        unsigned int n;
+        int data;
+        packed_command word;
+        int arg;
+
+        quick_prepare(vm);
+        code = vm->quick_code;
+
+        sp = vm->stack_pointer;
+        bp = vm->base_pointer;
+        cp = vm->command_pointer;
+
+        while(cp < size) {
+                word = code[cp];
+                arg = (word & PACKED_WIDE) ? wide[PACKED_FIELD(word)] : PACKED_FIELD(word);
+
+                switch(PACKED_CODE(word)) {
+                case QUICK(NOP):
+                        NEXT();
+
+                case QUICK(LOAD):
+                        if(sp >= MAX_STACK_SIZE) break;
+                        stack[sp++] = memory[arg];
+                        NEXT();
+
+                case QUICK(STORE):
+                        if(sp < 1) break;
+                        memory[arg] = stack[--sp];
+                        NEXT();
+
+                case QUICK(BLOAD):
+                        if(sp < 1) break;
+                        address = arg + stack[sp - 1];
+                        if(address >= MAX_MEMORY_SIZE) break;
+                        stack[sp - 1] = memory[address];
+                        NEXT();
+
+                case QUICK(BSTORE):
+                        if(sp < 2) break;
+                        address = arg + stack[sp - 1];
+                        if(address >= MAX_MEMORY_SIZE) break;
+                        memory[address] = stack[sp - 2];
+                        sp -= 2;
+                        NEXT();
+
+                case QUICK(PUSH):
+                        if(sp >= MAX_STACK_SIZE) break;
+                        stack[sp++] = arg;
+                        NEXT();
+
+                case QUICK(POP):
+                        if(sp < 1) break;
+                        --sp;
+                        NEXT();
+
+                case QUICK(DUP):
+                        if(sp < 1 || sp >= MAX_STACK_SIZE) break;
+                        stack[sp] = stack[sp - 1];
+                        ++sp;
+                        NEXT();
+
+                case QUICK(SWAP):
+                        if(sp < 2) break;
+                        data = stack[sp - 1];
+                        stack[sp - 1] = stack[sp - 2];
+                        stack[sp - 2] = data;
+                        NEXT();
+
+                case QUICK(INVERT):
+                        if(sp < 1) break;
+                        stack[sp - 1] = -stack[sp - 1];
+                        NEXT();
+
+                case QUICK(ADD):
+                        if(sp < 2) break;
+                        --sp;
+                        stack[sp - 1] += stack[sp];
+                        NEXT();
+
+                case QUICK(SUB):
+                        if(sp < 2) break;
+                        --sp;
+                        stack[sp - 1] -= stack[sp];
+                        NEXT();
+
+                case QUICK(MULT):
+                        if(sp < 2) break;
+                        --sp;
+                        stack[sp - 1] *= stack[sp];
+                        NEXT();
+
+                case QUICK(DIV):
+                        if(sp < 2 || 0 == stack[sp - 1]) break;
+                        --sp;
+                        stack[sp - 1] /= stack[sp];
+                        NEXT();
+
+                case QUICK(SHL):
+                        if(sp < 1) break;
+                        stack[sp - 1] = (int)((unsigned int)stack[sp - 1] << (arg & 31));
+                        NEXT();
+
+                case QUICK(SHR):
+                        if(sp < 1) break;
+                        stack[sp - 1] >>= arg & 31;
+                        NEXT();
+
+                case QUICK(AND):
+                        if(sp < 2) break;
+                        --sp;
+                        stack[sp - 1] &= stack[sp];
+                        NEXT();
+
+                case QUICK(OR):
+                        if(sp < 2) break;
+                        --sp;
+                        stack[sp - 1] |= stack[sp];
+                        NEXT();
+
+                case QUICK(XOR):
+                        if(sp < 2) break;
+                        --sp;
+                        stack[sp - 1] ^= stack[sp];
+                        NEXT();
+
+                /*  .     ,
+                 *    ,   
+                 *   .
+                 */
+                case QUICK(VFILL):
+                case QUICK(VCOPY):
+                case QUICK(VADDS):
+                case QUICK(VMULS):
+                case QUICK(VADD):
+                case QUICK(VSUM):
+                case QUICK(VMIN):
+                case QUICK(VMAX):
+                        data = PACKED_CODE(word) - QUICK(NOP);
+                        n = operation_info((operation)data)->pop;
+                        if(sp < n || vm_bulk(vm, (operation)data, arg, stack + sp - n, bp) >= 0) break;
+                        sp -= n - operation_info((operation)data)->push;
+                        NEXT();
+
+                COMPARE(EQ, ==)
+                COMPARE(NE, !=)
+                COMPARE(LT, <)
+                COMPARE(GT, >)
+                COMPARE(LE, <=)
+                COMPARE(GE, >=)
+
+                case QUICK(JUMP):
+                        cp = arg;
+                        continue;
+
+                case QUICK(JUMP_YES):
+                        if(sp < 1) break;
+                        cp = stack[--sp] ? (unsigned int)arg : cp + 1;
+                        continue;
+
+                case QUICK(JUMP_NO):
+                        if(sp < 1) break;
+                        cp = stack[--sp] ? cp + 1 : (unsigned int)arg;
+                        continue;
+
+                case QUICK(PRINT):
+                        if(sp < 1) break;
+                        vm_write(vm, stack[--sp]);
+                        NEXT();
+
+                case QUICK(SLOAD):
+                        address = bp + arg;
+                        if(address >= MAX_STACK_SIZE || sp >= MAX_STACK_SIZE) break;
+                        stack[sp++] = frames[address];
+                        NEXT();
+
+                case QUICK(SSTORE):
+                        address = bp + arg;
+                        if(address >= MAX_STACK_SIZE || sp < 1) break;
+                        frames[address] = stack[--sp];
+                        NEXT();
+
+                case QUICK(SJUMP):
+                        if(sp < 1) break;
+                        cp = stack[--sp];
+                        continue;
+
+                case QUICK(BP):
+                        bp = sp + arg;
+                        NEXT();
+
+                case QUICK(SBLOAD):
+                        if(sp < 1) break;
+                        address = bp + (unsigned int)(arg + stack[sp - 1]);
+                        if(address >= MAX_STACK_SIZE) break;
+                        stack[sp - 1] = frames[address];
+                        NEXT();
+
+                case QUICK(SBSTORE):
+                        if(sp < 2) break;
+                        address = bp + (unsigned int)(arg + stack[sp - 1]);
+                        if(address >= MAX_STACK_SIZE) break;
+                        frames[address] = stack[sp - 2];
+                        sp -= 2;
+                        NEXT();
+
+                case QUICK(PUSH_ADD):
+                        if(sp < 1) break;
+                        stack[sp - 1] += arg;
+                        NEXT();
+
+                case QUICK(PUSH_SUB):
+                        if(sp < 1) break;
+                        stack[sp - 1] -= arg;
+                        NEXT();
+
+                case QUICK(PUSH_MULT):
+                        if(sp < 1) break;
+                        stack[sp - 1] *= arg;
+                        NEXT();
+
+                case QUICK(PUSH_DIV):
+                        if(sp < 1) break;
+                        stack[sp - 1] /= arg;
+                        NEXT();
+
+                case QUICK(LOAD_ADD):
+                        if(sp < 1) break;
+                        stack[sp - 1] += memory[arg];
+                        NEXT();
+
+                case QUICK(SLOAD_ADD):
+                        address = bp + arg;
+                        if(address >= MAX_STACK_SIZE || sp < 1) break;
+                        stack[sp - 1] += frames[address];
+                        NEXT();
+
+                case QUICK(INC):
+                        memory[arg] += ARG2();
+                        NEXT();
+
+                case QUICK(SINC):
+                        address = bp + arg;
+                        if(address >= MAX_STACK_SIZE) break;
+                        frames[address] += ARG2();
+                        NEXT();
+
+                case QUICK(LOOP):
+                        if(sp < 2) break;
+                        data = LOOP_NEXT(memory[arg], stack[sp - 1]);
+                        memory[arg] = data;
+                        cp = LOOP_CONTINUES(data, stack[sp - 2], stack[sp - 1]) ?
+                                (unsigned int)ARG2() : cp + 1;
+                        continue;
+
+                case QUICK(SLOOP):
+                        address = bp + arg;
+                        if(address >= MAX_STACK_SIZE || sp < 2) break;
+                        data = LOOP_NEXT(frames[address], stack[sp - 1]);
+                        frames[address] = data;
+                        cp = LOOP_CONTINUES(data, stack[sp - 2], stack[sp - 1]) ?
+                                (unsigned int)ARG2() : cp + 1;
+                        continue;
+
+                case QUICK(JUMP_TABLE):
+                        if(sp < 1) break;
+                        data = stack[--sp];
+                        cp += 1 + JUMP_TABLE_ENTRY(data, arg);
+                        continue;
+
+                case QUICK(CALL):
+                        n = ARG2();
+                        address = vm->frame_top;
+                        if(n > sp || address + 2 + n > MAX_STACK_SIZE) break;
+                        sp -= n;
+                        memcpy(frames + address + 2, stack + sp, n * sizeof(int));
+                        frames[address] = cp + 1;
+                        frames[address + 1] = bp;
+                        bp = address + 2;
+                        vm->frame_top = bp + n;
+                        cp = arg;
+                        continue;
+
+                case QUICK(RET):
+                        if((unsigned int)arg > sp || bp < 2 || bp > MAX_STACK_SIZE) break;
+                        address = bp - 2;
+                        cp = frames[address];
+                        bp = frames[address + 1];
+                        vm->frame_top = address;
+                        continue;
+
+                case QUICK(ALLOC):
+                        address = vm->frame_top;
+                        if(address + arg > MAX_STACK_SIZE) break;
+                        memset(frames + address, 0, arg * sizeof(int));
+                        vm->frame_top = address + arg;
+                        NEXT();
+
+                COMPARE_JUMP_NO(EQ, ==)
+                COMPARE_JUMP_NO(NE, !=)
+                COMPARE_JUMP_NO(LT, <)
+                COMPARE_JUMP_NO(GT, >)
+                COMPARE_JUMP_NO(LE, <=)
+                COMPARE_JUMP_NO(GE, >=)
+
+                default:
+                        break;
+                }
+
+                /*    ,    
+                 * (STOP, INPUT)    .
+                 */
+                vm->stack_pointer = sp;
+                vm->base_pointer = bp;
+                vm->command_pointer = cp;
+
+                if(!vm_run_command(vm)) {
+                        return;
+                }
+
+                sp = vm->stack_pointer;
+                bp = vm->base_pointer;
+                cp = vm->command_pointer;
+        }
+
+        vm->stack_pointer = sp;
+        vm->base_pointer = bp;
+        vm->command_pointer = cp;
+}
@@ -0,0 +1,1423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vmint.h"
+
+/*   .
+ *
+ * ,  vm_image_verify(),    
+ *      .    k -
+ *   stack[fp + k],  fp -     
+ *   (   0).  
+ *     ,   :
+ *       vm_image_verify().
+ *         
+ *      R_SLOADX, R_SSTOREX  . .
+ *
+ *       , 
+ *   : PUSH, DUP  SWAP ,  
+ *       ,  
+ *     .  "SLOAD 1; PUSH 2;
+ * COMPARE_JUMP_NO 2 L"    "SLOADX r0, 1;
+ * BGEI r0, 2, L".      ,
+ *      .
+ *
+ * ,   ,   ,   
+ *   (vmloop.h).    , 
+ *  ,   , 
+ *  ,      
+ * ,     .
+ */
+
+/*   . r -   . */
+typedef enum {
+        R_MOV = 0,      /* r[a] = r[b] */
+        R_MOVI,         /* r[a] = b */
+        R_SWAP,         /*  r[a]  r[b] */
+        R_LOAD,         /* r[a] = memory[b] */
+        R_STORE,        /* memory[a] = r[b] */
+        R_STOREI,       /* memory[a] = b */
+        R_LOADX,        /* r[a] = memory[c + r[b]] */
+        R_STOREX,       /* memory[c + r[b]] = r[a] */
+        R_NEG,          /* r[a] = -r[b] */
+        R_ADD,          /* r[a] = r[b] + r[c] */
+        R_SUB,          /* r[a] = r[b] - r[c] */
+        R_MUL,          /* r[a] = r[b] * r[c] */
+        R_DIV,          /* r[a] = r[b] / r[c] */
+        R_ADDI,         /* r[a] = r[b] + c */
+        R_MULI,         /* r[a] = r[b] * c */
+        R_DIVI,         /* r[a] = r[b] / c, c != 0 */
+        R_SHLI,         /* r[a] = r[b] << c, 0 <= c < 32 */
+        R_SHRI,         /* r[a] = r[b] >> c, 0 <= c < 32 */
+        R_AND,          /* r[a] = r[b] & r[c] */
+        R_OR,
+        R_XOR,
+        R_ADDM,         /* r[a] = r[b] + memory[c] */
+        R_EQ,           /* r[a] = (r[b] == r[c]) */
+        R_NE,
+        R_LT,
+        R_GT,
+        R_LE,
+        R_GE,
+        R_JMP,          /*   c */
+        R_JTAB,         /*       
+                         * c + JUMP_TABLE_ENTRY(r[a], b) */
+        R_JZ,           /*   c,  r[a] == 0 */
+        R_JNZ,          /*   c,  r[a] != 0 */
+        R_BEQ,          /*   c,  r[a] == r[b] */
+        R_BNE,
+        R_BLT,
+        R_BGT,
+        R_BLE,
+        R_BGE,
+        R_BEQI,         /*   c,  r[a] == b */
+        R_BNEI,
+        R_BLTI,
+        R_BGTI,
+        R_BLEI,
+        R_BGEI,
+        R_INC,          /* memory[a] += b */
+        R_LOOP,         /* memory[a] += r[b + 1];   c, 
+                         *      r[b] */
+        R_IN,           /* r[a] = vm_read() */
+        R_OUT,          /* vm_write(r[a]) */
+        R_SETBP,        /* bp = fp + a */
+        R_SLOADX,       /* r[a] = frames[bp + c] */
+        R_SSTOREX,      /* frames[bp + c] = r[a] */
+        R_SADDX,        /* r[a] = r[b] + frames[bp + c] */
+        R_SINCX,        /* frames[bp + c] += b */
+        R_SLOOPX,       /* R_LOOP   frames[bp + a] */
+        R_SBLOAD,       /* r[a] = frames[bp + (c + r[b])] */
+        R_SBSTORE,      /* frames[bp + (c + r[b])] = r[a] */
+        R_CALL,         /*  c    a, fp += b */
+        R_RET,          /*    r[a] */
+        R_CALLF,        /* CALL:  c   r[a] .. r[a + b - 1] */
+        R_RETF,         /* RET: ;     r[0] */
+        R_ALLOC,        /* ALLOC a */
+        R_BULK,         /*   b  r[a] ..   c */
+        R_DEOPT,        /*     */
+        R_STOP,         /*   */
+        R_COUNT
+} register_op;
+
+typedef struct {
+#ifdef VM_COMPUTED_GOTO
+        void *handler;          /*   */
+#endif
+        register_op op;
+        int a;
+        int b;
+        int c;
+        int exit;               /*      -1 */
+} register_command;
+
+/*         address */
+typedef struct {
+        unsigned int address;
+        int depth;              /*    fp */
+        unsigned int fixes;     /*    */
+        unsigned int fixes_count;
+} register_exit;
+
+/*     slot:   value 
+ *  value.
+ */
+typedef struct {
+        int slot;
+        int copy;
+        int value;
+} register_fix;
+
+/*  :    fp  ,   CALL
+ *  bp        ,  
+ * CALL   
+ */
+typedef struct {
+        unsigned int return_address;
+        unsigned int frame_pointer;
+        unsigned int base_pointer;
+        unsigned int header;
+} register_frame;
+
+/*    (vm->registers).   
+ *     vm_destroy().
+ */
+typedef struct register_code {
+        register_command *program;
+        unsigned int program_size;
+        unsigned int program_capacity;
+
+        register_exit *exits;
+        unsigned int exits_size;
+        unsigned int exits_capacity;
+
+        register_fix *fixes;
+        unsigned int fixes_size;
+        unsigned int fixes_capacity;
+
+        /*        */
+        unsigned int *targets;
+
+        int translated;                 /* program  */
+
+        register_frame call_stack[MAX_STACK_SIZE];
+} register_code;
+
+/*      */
+static VM_THREAD_LOCAL const vm_image *image;
+static VM_THREAD_LOCAL register_code *code;
+
+/*       */
+static VM_THREAD_LOCAL int failed;
+
+/*       *items */
+static int grow(void **items, unsigned int size, unsigned int *capacity,
+                size_t item_size)
+{
+        unsigned int bigger = *capacity ? 2 * *capacity : 1024;
+        void *moved;
+
+        if(size < *capacity) {
+                return 1;
+        }
+
+        moved = realloc(*items, bigger * item_size);
+        if(NULL == moved) {
+                failed = 1;
+                return 0;
+        }
+        *items = moved;
+        *capacity = bigger;
+        return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/*                                                              */
+
+/*     */
+typedef enum {
+        VALUE_REGISTER = 0,     /*     */
+        VALUE_COPY,             /*   value,   */
+        VALUE_CONST             /*   value,   */
+} value_kind;
+
+typedef struct {
+        value_kind kind;
+        int value;
+} value;
+
+/*      0 .. TRACKED_SLOTS - 1.
+ * ,    ,    
+ * :        (clobber()).
+ */
+#define TRACKED_SLOTS   8192
+#define TRACKED(slot)   ((slot) >= 0 && (slot) < TRACKED_SLOTS)
+
+static VM_THREAD_LOCAL value values[TRACKED_SLOTS];
+static VM_THREAD_LOCAL char listed[TRACKED_SLOTS];
+static VM_THREAD_LOCAL int pending[TRACKED_SLOTS];
+static VM_THREAD_LOCAL unsigned int pending_count;
+
+static VM_THREAD_LOCAL int depth;       /*    fp */
+
+static int emit(register_op op, int a, int b, int c, int exit)
+{
+        register_command *cmd;
+
+        if(!grow((void **)&code->program, code->program_size, &code->program_capacity,
+                                sizeof(register_command))) {
+                return -1;
+        }
+
+        cmd = &code->program[code->program_size];
+        cmd->op = op;
+        cmd->a = a;
+        cmd->b = b;
+        cmd->c = c;
+        cmd->exit = exit;
+        return code->program_size++;
+}
+
+/*      slot */
+static void materialize(int slot)
+{
+        value *v;
+
+        if(!TRACKED(slot) || VALUE_REGISTER == values[slot].kind) {
+                return;
+        }
+
+        v = &values[slot];
+        emit((VALUE_COPY == v->kind) ? R_MOV : R_MOVI, slot, v->value, 0, -1);
+        v->kind = VALUE_REGISTER;
+}
+
+/*     */
+static void flush()
+{
+        unsigned int i;
+
+        for(i = 0; i < pending_count; ++i) {
+                materialize(pending[i]);
+                listed[pending[i]] = 0;
+        }
+        pending_count = 0;
+}
+
+/*      ,    */
+static void discard()
+{
+        unsigned int i;
+
+        for(i = 0; i < pending_count; ++i) {
+                values[pending[i]].kind = VALUE_REGISTER;
+                listed[pending[i]] = 0;
+        }
+        pending_count = 0;
+}
+
+/*      slot:    
+ * ,      .
+ */
+static void clobber(int slot)
+{
+        unsigned int i;
+
+        for(i = 0; i < pending_count; ++i) {
+                int other = pending[i];
+
+                if(VALUE_COPY == values[other].kind && values[other].value == slot) {
+                        materialize(other);
+                }
+        }
+        if(TRACKED(slot)) {
+                values[slot].kind = VALUE_REGISTER;
+        }
+}
+
+/*    slot:   ,  
+ *  .
+ */
+static value resolve(int slot)
+{
+        value v;
+
+        if(TRACKED(slot) && VALUE_REGISTER != values[slot].kind) {
+                return values[slot];
+        }
+        v.kind = VALUE_COPY;
+        v.value = slot;
+        return v;
+}
+
+static value constant(int n)
+{
+        value v;
+
+        v.kind = VALUE_CONST;
+        v.value = n;
+        return v;
+}
+
+/*   slot = v */
+static void assign(int slot, value v)
+{
+        clobber(slot);
+
+        if(VALUE_COPY == v.kind && v.value == slot) {
+                return;
+        }
+
+        if(!TRACKED(slot)) {
+                emit((VALUE_COPY == v.kind) ? R_MOV : R_MOVI, slot, v.value, 0, -1);
+                return;
+        }
+
+        values[slot] = v;
+        if(!listed[slot]) {
+                listed[slot] = 1;
+                pending[pending_count++] = slot;
+        }
+}
+
+/*      slot.  
+ *    slot.
+ */
+static int operand(int slot)
+{
+        value v = resolve(slot);
+
+        if(VALUE_CONST == v.kind) {
+                materialize(slot);
+                return slot;
+        }
+        return v.value;
+}
+
+/*      address   .
+ *   ,     .
+ */
+static int make_exit(unsigned int address)
+{
+        register_exit *e;
+        unsigned int i;
+
+        if(!grow((void **)&code->exits, code->exits_size, &code->exits_capacity,
+                                sizeof(register_exit))) {
+                return -1;
+        }
+
+        e = &code->exits[code->exits_size];
+        e->address = address;
+        e->depth = depth;
+        e->fixes = code->fixes_size;
+        e->fixes_count = 0;
+
+        for(i = 0; i < pending_count; ++i) {
+                value *v = &values[pending[i]];
+
+                if(VALUE_REGISTER == v->kind) {
+                        continue;
+                }
+                if(!grow((void **)&code->fixes, code->fixes_size, &code->fixes_capacity,
+                                        sizeof(register_fix))) {
+                        return -1;
+                }
+                code->fixes[code->fixes_size].slot = pending[i];
+                code->fixes[code->fixes_size].copy = (VALUE_COPY == v->kind);
+                code->fixes[code->fixes_size].value = v->value;
+                ++code->fixes_size;
+                ++e->fixes_count;
+        }
+
+        return code->exits_size++;
+}
+
+/* ADD, SUB  MULT    ,    */
+static int fold(threaded_op op, int a, int b)
+{
+        switch(op) {
+        case TC_SUB:    return (int)((unsigned int)a - (unsigned int)b);
+        case TC_MULT:   return (int)((unsigned int)a * (unsigned int)b);
+        default:        return (int)((unsigned int)a + (unsigned int)b);
+        }
+}
+
+/* slot = left op right  op  ADD, SUB, MULT */
+static void arithmetic(threaded_op op, int slot, int left, value right)
+{
+        value l = resolve(left);
+        int a;
+
+        if(VALUE_CONST == right.kind && VALUE_CONST == l.kind) {
+                assign(slot, constant(fold(op, l.value, right.value)));
+                return;
+        }
+
+        if(VALUE_CONST == right.kind) {
+                a = operand(left);
+                clobber(slot);
+                if(TC_MULT == op) {
+                        emit(R_MULI, slot, a, right.value, -1);
+                }
+                else {
+                        emit(R_ADDI, slot, a, (TC_SUB == op) ?
+                                fold(TC_SUB, 0, right.value) : right.value, -1);
+                }
+                return;
+        }
+
+        if(VALUE_CONST == l.kind && TC_SUB != op) {
+                clobber(slot);
+                emit((TC_MULT == op) ? R_MULI : R_ADDI, slot, right.value, l.value, -1);
+                return;
+        }
+
+        a = operand(left);
+        clobber(slot);
+        emit((TC_ADD == op) ? R_ADD : (TC_SUB == op) ? R_SUB : R_MUL,
+                slot, a, right.value, -1);
+}
+
+/*  COMPARE_JUMP_NO ,    */
+static const register_op negated_branch[] = {
+        R_BNE, R_BEQ, R_BGE, R_BLE, R_BGT, R_BLT
+};
+
+static void translate_command(unsigned int address)
+{
+        command cmd = vm_fetch(image, address);
+        threaded_op op = vm_decode(image, address);
+        int arg = cmd.arg;
+        int top = depth - 1;
+        int exit;
+        int a;
+        int b;
+        value v;
+        value w;
+        opcode_info *info;
+
+        switch(op) {
+        case TC_NOP:
+                break;
+
+        case TC_STOP:
+                emit(R_STOP, 0, 0, 0, make_exit(address));
+                break;
+
+        case TC_LOAD:
+                clobber(depth);
+                emit(R_LOAD, depth, arg, 0, -1);
+                ++depth;
+                break;
+
+        case TC_STORE:
+                v = resolve(top);
+                emit((VALUE_CONST == v.kind) ? R_STOREI : R_STORE, arg, v.value, 0, -1);
+                --depth;
+                break;
+
+        case TC_BLOAD:
+                exit = make_exit(address);
+                a = operand(top);
+                clobber(top);
+                emit(R_LOADX, top, a, arg, exit);
+                break;
+
+        case TC_BSTORE:
+                exit = make_exit(address);
+                a = operand(top - 1);
+                b = operand(top);
+                emit(R_STOREX, a, b, arg, exit);
+                depth -= 2;
+                break;
+
+        case TC_PUSH:
+                assign(depth, constant(arg));
+                ++depth;
+                break;
+
+        case TC_POP:
+                --depth;
+                break;
+
+        case TC_DUP:
+                assign(depth, resolve(top));
+                ++depth;
+                break;
+
+        case TC_SWAP:
+                /*           ,
+                 *     : 
+                 *  ,    
+                 * .
+                 */
+                v = resolve(top - 1);
+                w = resolve(top);
+                if(VALUE_COPY != v.kind || v.value != top - 1) {
+                        assign(top - 1, w);
+                        assign(top, v);
+                }
+                else if(VALUE_COPY != w.kind || w.value != top) {
+                        assign(top, v);
+                        assign(top - 1, w);
+                }
+                else {
+                        clobber(top - 1);
+                        clobber(top);
+                        emit(R_SWAP, top - 1, top, 0, -1);
+                }
+                break;
+
+        case TC_INVERT:
+                v = resolve(top);
+                if(VALUE_CONST == v.kind) {
+                        assign(top, constant(fold(TC_SUB, 0, v.value)));
+                        break;
+                }
+                clobber(top);
+                emit(R_NEG, top, v.value, 0, -1);
+                break;
+
+        case TC_ADD:
+        case TC_SUB:
+        case TC_MULT:
+                arithmetic(op, top - 1, top - 1, resolve(top));
+                --depth;
+                break;
+
+        case TC_DIV:
+                v = resolve(top);
+                if(VALUE_CONST == v.kind && 0 != v.value) {
+                        a = operand(top - 1);
+                        clobber(top - 1);
+                        emit(R_DIVI, top - 1, a, v.value, -1);
+                }
+                else {
+                        exit = make_exit(address);
+                        a = operand(top - 1);
+                        b = operand(top);
+                        clobber(top - 1);
+                        emit(R_DIV, top - 1, a, b, exit);
+                }
+                --depth;
+                break;
+
+        case TC_CMP_EQ:
+        case TC_CMP_NE:
+        case TC_CMP_LT:
+        case TC_CMP_GT:
+        case TC_CMP_LE:
+        case TC_CMP_GE:
+                a = operand(top - 1);
+                b = operand(top);
+                clobber(top - 1);
+                emit(R_EQ + (op - TC_CMP_EQ), top - 1, a, b, -1);
+                --depth;
+                break;
+
+        case TC_JUMP:
+                flush();
+                emit(R_JMP, 0, 0, arg, -1);
+                break;
+
+        case TC_JUMP_YES:
+        case TC_JUMP_NO:
+                v = resolve(top);
+                --depth;
+                flush();
+                if(VALUE_CONST != v.kind) {
+                        emit((TC_JUMP_YES == op) ? R_JNZ : R_JZ, v.value, 0, arg, -1);
+                }
+                else if((0 != v.value) == (TC_JUMP_YES == op)) {
+                        emit(R_JMP, 0, 0, arg, -1);
+                }
+                break;
+
+        /*    ,   -  */
+        case TC_JUMP_TABLE:
+                v = resolve(top);
+                --depth;
+                flush();
+                if(VALUE_CONST == v.kind) {
+                        emit(R_JMP, 0, 0, address + 1 + JUMP_TABLE_ENTRY(v.value, arg), -1);
+                }
+                else {
+                        emit(R_JTAB, v.value, arg, address + 1, -1);
+                }
+                break;
+
+        case TC_CALL:
+                flush();
+                emit(R_CALL, address + 1, depth, arg, make_exit(address));
+                break;
+
+        case TC_INPUT:
+                exit = make_exit(address);
+                clobber(depth);
+                emit(R_IN, depth, 0, 0, exit);
+                ++depth;
+                break;
+
+        case TC_PRINT:
+                emit(R_OUT, operand(top), 0, 0, -1);
+                --depth;
+                break;
+
+        /*      ,  ,
+         *   ,    
+         */
+        case TC_SLOAD:
+                clobber(depth);
+                emit(R_SLOADX, depth, 0, arg, -1);
+                ++depth;
+                break;
+
+        case TC_SSTORE:
+                emit(R_SSTOREX, operand(top), 0, arg, -1);
+                --depth;
+                break;
+
+        case TC_SJUMP:
+                a = operand(top);
+                flush();
+                emit(R_RET, a, 0, 0, make_exit(address));
+                break;
+
+        case TC_CALLF:
+                flush();
+                emit(R_CALLF, depth - cmd.arg2, cmd.arg2, arg, make_exit(address));
+                break;
+
+        case TC_RET:
+                /*       0 */
+                flush();
+                emit(R_RETF, 0, 0, 0, make_exit(address));
+                break;
+
+        case TC_ALLOC:
+                emit(R_ALLOC, arg, 0, 0, make_exit(address));
+                break;
+
+        /*        */
+        case TC_VFILL:
+        case TC_VCOPY:
+        case TC_VADDS:
+        case TC_VMULS:
+        case TC_VADD:
+        case TC_VSUM:
+        case TC_VMIN:
+        case TC_VMAX:
+                info = operation_info(cmd.operation);
+                exit = make_exit(address);
+                flush();
+                clobber(depth - info->pop);
+                emit(R_BULK, depth - info->pop, cmd.operation, arg, exit);
+                depth += info->push - info->pop;
+                break;
+
+        case TC_BP:
+                emit(R_SETBP, depth + arg, 0, 0, make_exit(address));
+                break;
+
+        case TC_SBLOAD:
+                exit = make_exit(address);
+                a = operand(top);
+                clobber(top);
+                emit(R_SBLOAD, top, a, arg, exit);
+                break;
+
+        case TC_SBSTORE:
+                exit = make_exit(address);
+                a = operand(top - 1);
+                b = operand(top);
+                emit(R_SBSTORE, a, b, arg, exit);
+                depth -= 2;
+                break;
+
+        case TC_PUSH_ADD:
+                arithmetic(TC_ADD, top, top, constant(arg));
+                break;
+
+        case TC_PUSH_SUB:
+                arithmetic(TC_SUB, top, top, constant(arg));
+                break;
+
+        case TC_PUSH_MULT:
+                arithmetic(TC_MULT, top, top, constant(arg));
+                break;
+
+        case TC_SHL:
+        case TC_SHR:
+                a = operand(top);
+                clobber(top);
+                emit((TC_SHL == op) ? R_SHLI : R_SHRI, top, a, arg & 31, -1);
+                break;
+
+        case TC_AND:
+        case TC_OR:
+        case TC_XOR:
+                a = operand(top - 1);
+                b = operand(top);
+                clobber(top - 1);
+                emit((TC_AND == op) ? R_AND : (TC_OR == op) ? R_OR : R_XOR,
+                        top - 1, a, b, -1);
+                --depth;
+                break;
+
+        case TC_PUSH_DIV:
+                if(0 == arg) {
+                        emit(R_DEOPT, 0, 0, 0, make_exit(address));
+                        break;
+                }
+                a = operand(top);
+                clobber(top);
+                emit(R_DIVI, top, a, arg, -1);
+                break;
+
+        case TC_LOAD_ADD:
+                a = operand(top);
+                clobber(top);
+                emit(R_ADDM, top, a, arg, -1);
+                break;
+
+        case TC_SLOAD_ADD:
+                a = operand(top);
+                clobber(top);
+                emit(R_SADDX, top, a, arg, -1);
+                break;
+
+        case TC_INC:
+                emit(R_INC, arg, cmd.arg2, 0, -1);
+                break;
+
+        case TC_SINC:
+                emit(R_SINCX, 0, cmd.arg2, arg, -1);
+                break;
+
+        case TC_CJ_EQ:
+        case TC_CJ_NE:
+        case TC_CJ_LT:
+        case TC_CJ_GT:
+        case TC_CJ_LE:
+        case TC_CJ_GE:
+                v = resolve(top);
+                a = operand(top - 1);
+                if(VALUE_CONST == v.kind) {
+                        depth -= 2;
+                        flush();
+                        emit(negated_branch[op - TC_CJ_EQ] + (R_BEQI - R_BEQ),
+                                a, v.value, cmd.arg2, -1);
+                        break;
+                }
+                b = operand(top);
+                depth -= 2;
+                flush();
+                emit(negated_branch[op - TC_CJ_EQ], a, b, cmd.arg2, -1);
+                break;
+
+        /*            */
+        case TC_LOOP:
+        case TC_SLOOP:
+                flush();
+                emit((TC_LOOP == op) ? R_LOOP : R_SLOOPX, arg, top - 1, cmd.arg2, -1);
+                break;
+
+        default:
+                /*      */
+                emit(R_DEOPT, 0, 0, 0, make_exit(address));
+                break;
+        }
+}
+
+/*       */
+static int falls_through(threaded_op op)
+{
+        return TC_STOP != op && TC_JUMP != op && TC_CALL != op && TC_SJUMP != op &&
+                TC_CALLF != op && TC_RET != op && TC_JUMP_TABLE != op;
+}
+
+/*      code   
+ *  label.
+ */
+static void translate_program(char *label)
+{
+        unsigned int i;
+        int falls = 0;
+
+        code->program_size = 0;
+        code->exits_size = 0;
+        code->fixes_size = 0;
+        pending_count = 0;
+        failed = 0;
+
+        for(i = 0; i < TRACKED_SLOTS; ++i) {
+                values[i].kind = VALUE_REGISTER;
+                listed[i] = 0;
+        }
+
+        /*  :  ,   ,   */
+        for(i = 0; i <= image->size; ++i) {
+                label[i] = 0;
+        }
+        for(i = 0; i < image->size; ++i) {
+                switch(vm_decode(image, i)) {
+                case TC_JUMP:
+                case TC_JUMP_YES:
+                case TC_JUMP_NO:
+                        label[vm_fetch(image, i).arg] = 1;
+                        break;
+
+                case TC_CALL:
+                case TC_CALLF:
+                        label[vm_fetch(image, i).arg] = 1;
+                        label[i + 1] = 1;
+                        break;
+
+                case TC_CJ_EQ:
+                case TC_CJ_NE:
+                case TC_CJ_LT:
+                case TC_CJ_GT:
+                case TC_CJ_LE:
+                case TC_CJ_GE:
+                case TC_LOOP:
+                case TC_SLOOP:
+                        label[vm_fetch(image, i).arg2] = 1;
+                        break;
+
+                case TC_JUMP_TABLE:
+                        memset(label + i + 1, 1, vm_fetch(image, i).arg + 1);
+                        break;
+
+                default:
+                        break;
+                }
+        }
+
+        for(i = 0; i < image->size; ++i) {
+                threaded_op op = vm_decode(image, i);
+                int reachable = 1;
+
+                if(label[i] || !falls) {
+                        if(falls) {
+                                flush();
+                        }
+                        else {
+                                discard();
+                        }
+                        reachable = vm_stack_depth(image, i, &depth);
+                }
+
+                code->targets[i] = code->program_size;
+
+                if(!reachable) {
+                        depth = 0;
+                        emit(R_DEOPT, 0, 0, 0, make_exit(i));
+                        falls = 0;
+                        continue;
+                }
+
+                translate_command(i);
+                falls = falls_through(op);
+        }
+
+        /*   */
+        if(falls) {
+                flush();
+        }
+        else {
+                discard();
+                depth = 0;
+        }
+        code->targets[image->size] = code->program_size;
+        emit(R_STOP, 0, 0, 0, make_exit(image->size));
+
+        if(failed) {
+                return;
+        }
+
+        for(i = 0; i < code->program_size; ++i) {
+                register_command *cmd = &code->program[i];
+
+                if(R_JMP == cmd->op || R_CALL == cmd->op || R_CALLF == cmd->op ||
+                                R_LOOP == cmd->op || R_SLOOPX == cmd->op ||
+                                (cmd->op >= R_JZ && cmd->op <= R_BGEI)) {
+                        cmd->c = code->targets[cmd->c];
+                }
+        }
+}
+
+/*    vm    vm->registers.
+ *  0,    .
+ */
+static int translate(vm_state *vm)
+{
+        unsigned int size = vm->image->size;
+        char *label;
+
+        if(NULL == vm->registers) {
+                vm->registers = (register_code*)calloc(1, sizeof(register_code));
+                if(NULL == vm->registers) {
+                        return 0;
+                }
+        }
+        if(NULL == vm->registers->targets) {
+                vm->registers->targets = (unsigned int*)malloc((size + 1) * sizeof(unsigned int));
+                if(NULL == vm->registers->targets) {
+                        return 0;
+                }
+        }
+
+        image = vm->image;
+        code = vm->registers;
+        failed = 0;
+
+        label = (char*)malloc(size + 1);
+        if(NULL != label) {
+                translate_program(label);
+        }
+        else {
+                failed = 1;
+        }
+
+        free(label);
+        code->translated = !failed;
+        return !failed;
+}
+
+void vm_release_registers(vm_state *vm)
+{
+        register_code *registers = vm->registers;
+
+        if(NULL == registers) {
+                return;
+        }
+
+        free(registers->program);
+        free(registers->exits);
+        free(registers->fixes);
+        free(registers->targets);
+        free(registers);
+        vm->registers = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/*                                                           */
+
+#ifdef VM_COMPUTED_GOTO
+#define CASE(name)      L_##name
+#define NEXT()          do { ++pc; goto *pc->handler; } while(0)
+#define JUMP_TO(target) do { pc = (target); goto *pc->handler; } while(0)
+#else
+#define CASE(name)      case R_##name
+#define NEXT()          do { ++pc; goto dispatch; } while(0)
+#define JUMP_TO(target) do { pc = (target); goto dispatch; } while(0)
+#endif
+
+/*      */
+#define LEAVE()         do { leave(vm, &exits[pc->exit], fp, bp); return 0; } while(0)
+
+/*     e   
+ *   vm.
+ */
+static void leave(vm_state *vm, register_exit *e, unsigned int fp, unsigned int bp)
+{
+        register_fix *fixes = vm->registers->fixes;
+        int *r = vm->stack + fp;
+        unsigned int i;
+
+        for(i = e->fixes; i < e->fixes + e->fixes_count; ++i) {
+                r[fixes[i].slot] = fixes[i].copy ? r[fixes[i].value] : fixes[i].value;
+        }
+
+        vm->stack_pointer = fp + e->depth;
+        vm->base_pointer = bp;
+        vm->command_pointer = e->address;
+}
+
+int run_register(vm_state *vm)
+{
+        const vm_image *image = vm->image;
+        register_command *program;
+        register_exit *exits;
+        unsigned int *targets;
+        register_frame *call_stack;
+        register_command *pc;
+        unsigned int fp = 0;
+        unsigned int bp = vm->base_pointer;
+        unsigned int calls = 0;
+        unsigned int address;
+        int n;
+        int *r = vm->stack;
+        int *frames = vm->frames;
+
+#ifdef VM_COMPUTED_GOTO
+        static void *labels[R_COUNT] = {
+                &&L_MOV, &&L_MOVI, &&L_SWAP, &&L_LOAD, &&L_STORE, &&L_STOREI,
+                &&L_LOADX, &&L_STOREX, &&L_NEG, &&L_ADD, &&L_SUB, &&L_MUL,
+                &&L_DIV, &&L_ADDI, &&L_MULI, &&L_DIVI, &&L_SHLI, &&L_SHRI,
+                &&L_AND, &&L_OR, &&L_XOR, &&L_ADDM, &&L_EQ, &&L_NE, &&L_LT,
+                &&L_GT, &&L_LE, &&L_GE, &&L_JMP, &&L_JTAB, &&L_JZ, &&L_JNZ,
+                &&L_BEQ, &&L_BNE, &&L_BLT, &&L_BGT, &&L_BLE, &&L_BGE, &&L_BEQI,
+                &&L_BNEI, &&L_BLTI, &&L_BGTI, &&L_BLEI, &&L_BGEI, &&L_INC,
+                &&L_LOOP, &&L_IN, &&L_OUT, &&L_SETBP, &&L_SLOADX, &&L_SSTOREX,
+                &&L_SADDX, &&L_SINCX, &&L_SLOOPX, &&L_SBLOAD, &&L_SBSTORE,
+                &&L_CALL, &&L_RET, &&L_CALLF, &&L_RETF, &&L_ALLOC, &&L_BULK,
+                &&L_DEOPT, &&L_STOP
+        };
+        unsigned int i;
+#endif
+
+        /*        */
+        if(0 != vm->command_pointer || 0 != vm->stack_pointer) {
+                return run_unchecked(vm);
+        }
+        if(NULL == vm->registers || !vm->registers->translated) {
+                if(!translate(vm)) {
+                        return run_unchecked(vm);
+                }
+#ifdef VM_COMPUTED_GOTO
+                for(i = 0; i < vm->registers->program_size; ++i) {
+                        vm->registers->program[i].handler = labels[vm->registers->program[i].op];
+                }
+#endif
+        }
+
+        program = vm->registers->program;
+        exits = vm->registers->exits;
+        targets = vm->registers->targets;
+        call_stack = vm->registers->call_stack;
+
+        pc = program;
+
+#ifdef VM_COMPUTED_GOTO
+        goto *pc->handler;
+#else
+dispatch:
+        switch(pc->op) {
+#endif
+
+        CASE(MOV):
+                r[pc->a] = r[pc->b];
+                NEXT();
+
+        CASE(SWAP):
+                n = r[pc->a];
+                r[pc->a] = r[pc->b];
+                r[pc->b] = n;
+                NEXT();
+
+        CASE(MOVI):
+                r[pc->a] = pc->b;
+                NEXT();
+
+        CASE(LOAD):
+                r[pc->a] = vm->memory[pc->b];
+                NEXT();
+
+        CASE(STORE):
+                vm->memory[pc->a] = r[pc->b];
+                NEXT();
+
+        CASE(STOREI):
+                vm->memory[pc->a] = pc->b;
+                NEXT();
+
+        CASE(LOADX):
+                address = pc->c + r[pc->b];
+                if(address >= MAX_MEMORY_SIZE) LEAVE();
+                r[pc->a] = vm->memory[address];
+                NEXT();
+
+        CASE(STOREX):
+                address = pc->c + r[pc->b];
+                if(address >= MAX_MEMORY_SIZE) LEAVE();
+                vm->memory[address] = r[pc->a];
+                NEXT();
+
+        CASE(NEG):
+                r[pc->a] = -r[pc->b];
+                NEXT();
+
+        CASE(ADD):
+                r[pc->a] = r[pc->b] + r[pc->c];
+                NEXT();
+
+        CASE(SUB):
+                r[pc->a] = r[pc->b] - r[pc->c];
+                NEXT();
+
+        CASE(MUL):
+                r[pc->a] = r[pc->b] * r[pc->c];
+                NEXT();
+
+        CASE(DIV):
+                if(0 == r[pc->c]) LEAVE();
+                r[pc->a] = r[pc->b] / r[pc->c];
+                NEXT();
+
+        CASE(ADDI):
+                r[pc->a] = r[pc->b] + pc->c;
+                NEXT();
+
+        CASE(MULI):
+                r[pc->a] = r[pc->b] * pc->c;
+                NEXT();
+
+        CASE(DIVI):
+                r[pc->a] = r[pc->b] / pc->c;
+                NEXT();
+
+        CASE(SHLI):
+                r[pc->a] = (int)((unsigned int)r[pc->b] << pc->c);
+                NEXT();
+
+        CASE(SHRI):
+                r[pc->a] = r[pc->b] >> pc->c;
+                NEXT();
+
+        CASE(AND):
+                r[pc->a] = r[pc->b] & r[pc->c];
+                NEXT();
+
+        CASE(OR):
+                r[pc->a] = r[pc->b] | r[pc->c];
+                NEXT();
+
+        CASE(XOR):
+                r[pc->a] = r[pc->b] ^ r[pc->c];
+                NEXT();
+
+        CASE(ADDM):
+                r[pc->a] = r[pc->b] + vm->memory[pc->c];
+                NEXT();
+
+        CASE(EQ):
+                r[pc->a] = (r[pc->b] == r[pc->c]) ? 1 : 0;
+                NEXT();
+
+        CASE(NE):
+                r[pc->a] = (r[pc->b] != r[pc->c]) ? 1 : 0;
+                NEXT();
+
+        CASE(LT):
+                r[pc->a] = (r[pc->b] < r[pc->c]) ? 1 : 0;
+                NEXT();
+
+        CASE(GT):
+                r[pc->a] = (r[pc->b] > r[pc->c]) ? 1 : 0;
+                NEXT();
+
+        CASE(LE):
+                r[pc->a] = (r[pc->b] <= r[pc->c]) ? 1 : 0;
+                NEXT();
+
+        CASE(GE):
+                r[pc->a] = (r[pc->b] >= r[pc->c]) ? 1 : 0;
+                NEXT();
+
+        CASE(JMP):
+                JUMP_TO(program + pc->c);
+
+        /*  JUMP      */
+        CASE(JTAB):
+                pc = program + targets[pc->c + JUMP_TABLE_ENTRY(r[pc->a], pc->b)];
+                if(R_JMP == pc->op) {
+                        pc = program + pc->c;
+                }
+                JUMP_TO(pc);
+
+        CASE(JZ):
+                if(0 == r[pc->a]) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(JNZ):
+                if(0 != r[pc->a]) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BEQ):
+                if(r[pc->a] == r[pc->b]) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BNE):
+                if(r[pc->a] != r[pc->b]) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BLT):
+                if(r[pc->a] < r[pc->b]) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BGT):
+                if(r[pc->a] > r[pc->b]) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BLE):
+                if(r[pc->a] <= r[pc->b]) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BGE):
+                if(r[pc->a] >= r[pc->b]) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BEQI):
+                if(r[pc->a] == pc->b) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BNEI):
+                if(r[pc->a] != pc->b) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BLTI):
+                if(r[pc->a] < pc->b) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BGTI):
+                if(r[pc->a] > pc->b) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BLEI):
+                if(r[pc->a] <= pc->b) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(BGEI):
+                if(r[pc->a] >= pc->b) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(INC):
+                vm->memory[pc->a] += pc->b;
+                NEXT();
+
+        CASE(LOOP):
+                n = LOOP_NEXT(vm->memory[pc->a], r[pc->b + 1]);
+                vm->memory[pc->a] = n;
+                if(LOOP_CONTINUES(n, r[pc->b], r[pc->b + 1])) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(IN):
+                /* vm_error()      INPUT */
+                vm->command_pointer = exits[pc->exit].address;
+                r[pc->a] = vm_read(vm);
+                NEXT();
+
+        CASE(OUT):
+                vm_write(vm, r[pc->a]);
+                NEXT();
+
+        CASE(SETBP):
+                if(!vm_frame_allowed(image, exits[pc->exit].address, fp + pc->a)) LEAVE();
+                bp = fp + pc->a;
+                NEXT();
+
+        CASE(SLOADX):
+                r[pc->a] = frames[bp + pc->c];
+                NEXT();
+
+        CASE(SSTOREX):
+                frames[bp + pc->c] = r[pc->a];
+                NEXT();
+
+        CASE(SADDX):
+                r[pc->a] = r[pc->b] + frames[bp + pc->c];
+                NEXT();
+
+        CASE(SINCX):
+                frames[bp + pc->c] += pc->b;
+                NEXT();
+
+        CASE(SLOOPX):
+                n = LOOP_NEXT(frames[bp + pc->a], r[pc->b + 1]);
+                frames[bp + pc->a] = n;
+                if(LOOP_CONTINUES(n, r[pc->b], r[pc->b + 1])) {
+                        JUMP_TO(program + pc->c);
+                }
+                NEXT();
+
+        CASE(SBLOAD):
+                address = bp + (unsigned int)(pc->c + r[pc->b]);
+                if(address >= MAX_STACK_SIZE) LEAVE();
+                r[pc->a] = frames[address];
+                NEXT();
+
+        CASE(SBSTORE):
+                address = bp + (unsigned int)(pc->c + r[pc->b]);
+                if(address >= MAX_STACK_SIZE) LEAVE();
+                frames[address] = r[pc->a];
+                NEXT();
+
+        CASE(CALL):
+                if(calls >= MAX_STACK_SIZE) LEAVE();
+                call_stack[calls].return_address = pc->a;
+                call_stack[calls].frame_pointer = fp;
+                ++calls;
+                fp += pc->b;
+                r = vm->stack + fp;
+                JUMP_TO(program + pc->c);
+
+        CASE(RET):
+                if(0 == calls ||
+                                (unsigned int)r[pc->a] != call_stack[calls - 1].return_address) {
+                        LEAVE();
+                }
+                --calls;
+                fp = call_stack[calls].frame_pointer;
+                r = vm->stack + fp;
+                JUMP_TO(program + targets[call_stack[calls].return_address]);
+
+        CASE(CALLF):
+                /*       , 
+                 *       
+                 */
+                address = vm->frame_top;
+                if(calls >= MAX_STACK_SIZE || address + 2 + pc->b > MAX_STACK_SIZE ||
+                                !vm_frame_allowed(image, exits[pc->exit].address, address + 2)) {
+                        LEAVE();
+                }
+                call_stack[calls].return_address = exits[pc->exit].address + 1;
+                call_stack[calls].frame_pointer = fp;
+                call_stack[calls].base_pointer = bp;
+                call_stack[calls].header = address;
+                ++calls;
+                frames[address] = exits[pc->exit].address + 1;
+                frames[address + 1] = bp;
+                bp = address + 2;
+                vm->frame_top = bp + pc->b;
+                for(n = 0; n < pc->b; ++n) {
+                        frames[bp + n] = r[pc->a + n];
+                }
+                fp += pc->a;
+                r = vm->stack + fp;
+                JUMP_TO(program + pc->c);
+
+        CASE(RETF):
+                /*       
+                 * (. vmloop.h).  0  -  
+                 *     ,  
+                 *   .
+                 */
+                address = bp - 2;
+                if(0 == calls || address != call_stack[calls - 1].header ||
+                                (unsigned int)frames[address] != call_stack[calls - 1].return_address ||
+                                (unsigned int)frames[address + 1] != call_stack[calls - 1].base_pointer) {
+                        LEAVE();
+                }
+                --calls;
+                vm->frame_top = address;
+                bp = call_stack[calls].base_pointer;
+                fp = call_stack[calls].frame_pointer;
+                r = vm->stack + fp;
+                JUMP_TO(program + targets[call_stack[calls].return_address]);
+
+        CASE(ALLOC):
+                address = vm->frame_top;
+                if((unsigned int)pc->a > MAX_STACK_SIZE - address) LEAVE();
+                memset(frames + address, 0, pc->a * sizeof(int));
+                vm->frame_top = address + pc->a;
+                NEXT();
+
+        CASE(BULK):
+                if(vm_bulk(vm, (operation)pc->b, pc->c, r + pc->a, bp) >= 0) LEAVE();
+                NEXT();
+
+        CASE(DEOPT):
+                LEAVE();
+
+        CASE(STOP):
+#ifndef VM_COMPUTED_GOTO
+        default:
+                break;
+        }
+#endif
+
+        leave(vm, &exits[pc->exit], fp, bp);
+        return 1;
+}
@@ -0,0 +1,661 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vmint.h"
+
+/*   :      .
+ *
+ *       .    
+ *          (VM_YIELD),
+ *        .   
+ *      , , SJUMP  RET (.
+ * vmloop.h),        .
+ *
+ *  INPUT     . 
+ *      ,    
+ * VM_WAIT_INPUT      . 
+ *        ,  
+ *   -     
+ *     .
+ */
+
+#if !defined(_WIN32)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+/*     */
+typedef struct green_task {
+        vm_state *vm;
+        const char *input;              /*     */
+        int fd;                         /* -1    */
+        int fifo;                       /* fd -   */
+        char buffer[64];                /* ,     */
+        int length;
+        int eof;
+        void (*done)(vm_state *vm, vm_status status, void *data);
+        void *data;
+        struct green_task *next;        /*     */
+        struct green_task *prev;
+        int started;                    /* vm_run()   */
+        vm_status status;
+
+        /*  */
+        unsigned long slices;           /*   */
+        unsigned long preemptions;      /*   */
+        unsigned long parks;            /*   */
+        double run;                     /*  ,  */
+        double wait;                    /*   ,  */
+        double max_wait;
+        double parked;                  /*   ,  */
+        double queued_at;
+        double parked_at;
+} green_task;
+
+/*      */
+typedef struct {
+        vm_scheduler *scheduler;
+        pthread_mutex_t lock;
+        green_task *head;
+        green_task *tail;
+        unsigned long slices;
+        unsigned long steals;           /* ,     */
+        unsigned long polls;            /*    */
+        double idle;                    /*   ,  */
+        pthread_t thread;
+} green_worker;
+
+struct vm_scheduler {
+        int quantum;
+        unsigned int worker_count;
+        green_worker *workers;
+        unsigned int next_worker;       /*     */
+
+        green_task **tasks;             /*      */
+        unsigned int count;
+        unsigned int capacity;
+
+        /*    lock */
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+        green_task *parked;             /*   */
+        unsigned int parked_count;
+        unsigned int live;              /* ,     */
+        int polling;                    /* -    */
+
+        /*  ,     */
+        struct pollfd *poll_fds;
+        green_task **poll_tasks;
+
+        double start;
+        double end;
+};
+
+/*     */
+static double now()
+{
+        struct timespec t;
+
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void push_back(green_worker *w, green_task *t)
+{
+        t->next = NULL;
+        t->prev = w->tail;
+        if(NULL != w->tail) {
+                w->tail->next = t;
+        }
+        else {
+                w->head = t;
+        }
+        w->tail = t;
+}
+
+static green_task* pop_front(green_worker *w)
+{
+        green_task *t = w->head;
+
+        if(NULL != t) {
+                w->head = t->next;
+                if(NULL != w->head) {
+                        w->head->prev = NULL;
+                }
+                else {
+                        w->tail = NULL;
+                }
+        }
+        return t;
+}
+
+static green_task* pop_back(green_worker *w)
+{
+        green_task *t = w->tail;
+
+        if(NULL != t) {
+                w->tail = t->prev;
+                if(NULL != w->tail) {
+                        w->tail->next = NULL;
+                }
+                else {
+                        w->head = NULL;
+                }
+        }
+        return t;
+}
+
+/*      w */
+static void enqueue(green_worker *w, green_task *t)
+{
+        t->queued_at = now();
+        pthread_mutex_lock(&w->lock);
+        push_back(w, t);
+        pthread_mutex_unlock(&w->lock);
+}
+
+/*    INPUT:  ,  fscanf("%d"),    
+ *    ,    
+ * VM_WAIT_INPUT.   ,    
+ *     .   fscanf,   strtol()
+ *    int,       
+ * ,     .
+ */
+static int read_input(vm_state *vm, int *n)
+{
+        green_task *t = (green_task*)vm->reader;
+
+        for(;;) {
+                int i = 0;
+                int digits = 0;
+                char number[sizeof(t->buffer) + 1];
+                ssize_t got;
+                struct stat info;
+
+                /*       */
+                while(i < t->length && isspace((unsigned char)t->buffer[i])) {
+                        ++i;
+                }
+                memmove(t->buffer, t->buffer + i, t->length - i);
+                t->length -= i;
+
+                i = 0;
+                if(i < t->length && ('-' == t->buffer[i] || '+' == t->buffer[i])) {
+                        ++i;
+                }
+                while(i < t->length && t->buffer[i] >= '0' && t->buffer[i] <= '9') {
+                        ++i;
+                        ++digits;
+                }
+
+                if(digits && (i < t->length || t->eof || t->length == (int)sizeof(t->buffer))) {
+                        memcpy(number, t->buffer, i);
+                        number[i] = '\0';
+                        *n = (int)strtol(number, NULL, 10);
+                        memmove(t->buffer, t->buffer + i, t->length - i);
+                        t->length -= i;
+                        return 1;
+                }
+                if(i < t->length) {
+                        /*   */
+                        return 0;
+                }
+                if(t->eof) {
+                        return t->length ? 0 : EOF;
+                }
+
+                if(t->fd < 0) {
+                        t->fd = open(t->input, O_RDONLY | O_NONBLOCK);
+                        if(t->fd < 0) {
+                                t->eof = 1;
+                                continue;
+                        }
+                        t->fifo = (0 == fstat(t->fd, &info) && S_ISFIFO(info.st_mode));
+                }
+
+                got = read(t->fd, t->buffer + t->length, sizeof(t->buffer) - t->length);
+                if(got > 0) {
+                        t->length += (int)got;
+                }
+                else if(0 == got) {
+                        struct pollfd hangup;
+
+                        /* ,      ,  
+                         *  ,  poll()    
+                         *  ,   
+                         */
+                        hangup.fd = t->fd;
+                        hangup.events = POLLIN;
+                        hangup.revents = 0;
+                        if(t->fifo && 0 == poll(&hangup, 1, 0)) {
+                                vm_fail(vm, VM_WAIT_INPUT);
+                        }
+                        t->eof = 1;
+                }
+                else if(EAGAIN == errno || EWOULDBLOCK == errno) {
+                        vm_fail(vm, VM_WAIT_INPUT);
+                }
+                else if(EINTR != errno) {
+                        t->eof = 1;
+                }
+        }
+}
+
+vm_scheduler* vm_scheduler_create(unsigned int workers, int quantum)
+{
+        vm_scheduler *s;
+        unsigned int i;
+
+        if(0 == workers) {
+                long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+                workers = (count > 0) ? (unsigned int)count : 1;
+        }
+
+        s = (vm_scheduler*)calloc(1, sizeof(vm_scheduler));
+        if(NULL == s) {
+                return NULL;
+        }
+
+        s->workers = (green_worker*)calloc(workers, sizeof(green_worker));
+        if(NULL == s->workers) {
+                free(s);
+                return NULL;
+        }
+
+        s->quantum = (quantum > 0) ? quantum : 0;
+        s->worker_count = workers;
+        for(i = 0; i < workers; ++i) {
+                s->workers[i].scheduler = s;
+                pthread_mutex_init(&s->workers[i].lock, NULL);
+        }
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->wake, NULL);
+        return s;
+}
+
+int vm_scheduler_add(vm_scheduler *s, vm_state *vm, const char *input,
+        void (*done)(vm_state *vm, vm_status status, void *data), void *data)
+{
+        green_task *t;
+
+        if(s->count == s->capacity) {
+                unsigned int bigger = s->capacity ? 2 * s->capacity : 64;
+                green_task **moved = (green_task**)realloc(s->tasks,
+                        bigger * sizeof(green_task*));
+
+                if(NULL == moved) {
+                        return 0;
+                }
+                s->tasks = moved;
+                s->capacity = bigger;
+        }
+
+        t = (green_task*)calloc(1, sizeof(green_task));
+        if(NULL == t) {
+                return 0;
+        }
+
+        t->vm = vm;
+        t->input = input;
+        t->fd = -1;
+        t->done = done;
+        t->data = data;
+
+        /*        */
+        vm_set_engine(vm, ENGINE_THREADED);
+        vm_set_quantum(vm, s->quantum);
+        vm->read_input = read_input;
+        vm->reader = t;
+
+        s->tasks[s->count++] = t;
+        enqueue(&s->workers[s->next_worker], t);
+        s->next_worker = (s->next_worker + 1) % s->worker_count;
+        return 1;
+}
+
+/*     t  w */
+static void run_slice(green_worker *w, green_task *t)
+{
+        vm_scheduler *s = w->scheduler;
+        double start = now();
+        double waited = start - t->queued_at;
+        vm_status status;
+
+        t->wait += waited;
+        if(waited > t->max_wait) {
+                t->max_wait = waited;
+        }
+
+        if(t->started) {
+                status = vm_resume(t->vm);
+        }
+        else {
+                t->started = 1;
+                status = vm_run(t->vm);
+        }
+
+        t->run += now() - start;
+        ++t->slices;
+        ++w->slices;
+
+        if(VM_YIELD == status) {
+                ++t->preemptions;
+                enqueue(w, t);
+                pthread_cond_signal(&s->wake);
+                return;
+        }
+
+        if(VM_WAIT_INPUT == status) {
+                ++t->parks;
+                t->parked_at = now();
+                pthread_mutex_lock(&s->lock);
+                t->prev = NULL;
+                t->next = s->parked;
+                if(NULL != s->parked) {
+                        s->parked->prev = t;
+                }
+                s->parked = t;
+                ++s->parked_count;
+                pthread_mutex_unlock(&s->lock);
+                return;
+        }
+
+        t->status = status;
+        if(t->fd >= 0) {
+                close(t->fd);
+                t->fd = -1;
+        }
+        if(NULL != t->done) {
+                t->done(t->vm, status, t->data);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        if(0 == --s->live) {
+                pthread_cond_broadcast(&s->wake);
+        }
+        pthread_mutex_unlock(&s->lock);
+}
+
+/*    :    
+ *  w.     .  1, 
+ * -   .
+ */
+static int poll_parked(green_worker *w, int timeout)
+{
+        vm_scheduler *s = w->scheduler;
+        unsigned int count = 0;
+        int ready = 0;
+        green_task *t;
+        unsigned int i;
+
+        pthread_mutex_lock(&s->lock);
+        if(s->polling || 0 == s->parked_count) {
+                pthread_mutex_unlock(&s->lock);
+                return 0;
+        }
+        s->polling = 1;
+        for(t = s->parked; NULL != t; t = t->next) {
+                s->poll_fds[count].fd = t->fd;
+                s->poll_fds[count].events = POLLIN;
+                s->poll_fds[count].revents = 0;
+                s->poll_tasks[count++] = t;
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        ++w->polls;
+        if(poll(s->poll_fds, count, timeout) > 0) {
+                pthread_mutex_lock(&s->lock);
+                for(i = 0; i < count; ++i) {
+                        if(0 == s->poll_fds[i].revents) {
+                                continue;
+                        }
+
+                        t = s->poll_tasks[i];
+                        if(NULL != t->prev) {
+                                t->prev->next = t->next;
+                        }
+                        else {
+                                s->parked = t->next;
+                        }
+                        if(NULL != t->next) {
+                                t->next->prev = t->prev;
+                        }
+                        --s->parked_count;
+                        t->parked += now() - t->parked_at;
+                        enqueue(w, t);
+                        ready = 1;
+                }
+                pthread_mutex_unlock(&s->lock);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        s->polling = 0;
+        pthread_mutex_unlock(&s->lock);
+        return ready;
+}
+
+/*     w:    ,  
+ * ,     
+ */
+static green_task* next_task(green_worker *w)
+{
+        vm_scheduler *s = w->scheduler;
+        unsigned int self = (unsigned int)(w - s->workers);
+        green_task *t;
+        unsigned int i;
+
+        pthread_mutex_lock(&w->lock);
+        t = pop_front(w);
+        pthread_mutex_unlock(&w->lock);
+        if(NULL != t) {
+                return t;
+        }
+
+        for(i = 1; i < s->worker_count; ++i) {
+                green_worker *victim = &s->workers[(self + i) % s->worker_count];
+
+                pthread_mutex_lock(&victim->lock);
+                t = pop_back(victim);
+                pthread_mutex_unlock(&victim->lock);
+                if(NULL != t) {
+                        ++w->steals;
+                        return t;
+                }
+        }
+        return NULL;
+}
+
+static void* work(void *worker)
+{
+        green_worker *w = (green_worker*)worker;
+        vm_scheduler *s = w->scheduler;
+
+        for(;;) {
+                green_task *t = next_task(w);
+                double idle;
+
+                if(NULL != t) {
+                        run_slice(w, t);
+                        continue;
+                }
+
+                idle = now();
+                if(!poll_parked(w, 10)) {
+                        struct timespec deadline;
+
+                        pthread_mutex_lock(&s->lock);
+                        if(0 == s->live) {
+                                pthread_mutex_unlock(&s->lock);
+                                w->idle += now() - idle;
+                                break;
+                        }
+                        clock_gettime(CLOCK_REALTIME, &deadline);
+                        deadline.tv_nsec += 10000000;
+                        if(deadline.tv_nsec >= 1000000000) {
+                                deadline.tv_nsec -= 1000000000;
+                                ++deadline.tv_sec;
+                        }
+                        pthread_cond_timedwait(&s->wake, &s->lock, &deadline);
+                        pthread_mutex_unlock(&s->lock);
+                }
+                w->idle += now() - idle;
+        }
+        return NULL;
+}
+
+void vm_scheduler_run(vm_scheduler *s)
+{
+        unsigned int started = 0;
+        struct rlimit limit;
+        unsigned int i;
+
+        /*        */
+        if(0 == getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < limit.rlim_max) {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        s->poll_fds = (struct pollfd*)malloc((s->count + 1) * sizeof(struct pollfd));
+        s->poll_tasks = (green_task**)malloc((s->count + 1) * sizeof(green_task*));
+        s->live = s->count;
+        s->start = now();
+
+        if(NULL != s->poll_fds && NULL != s->poll_tasks) {
+                for(i = 0; i < s->worker_count; ++i) {
+                        if(0 != pthread_create(&s->workers[i].thread, NULL, work, &s->workers[i])) {
+                                break;
+                        }
+                        ++started;
+                }
+        }
+
+        /*      ,    */
+        if(0 == started) {
+                work(&s->workers[0]);
+        }
+        for(i = 0; i < started; ++i) {
+                pthread_join(s->workers[i].thread, NULL);
+        }
+
+        s->end = now();
+}
+
+void vm_scheduler_print_stats(const vm_scheduler *s, FILE *out)
+{
+        unsigned long slices = 0;
+        unsigned long preemptions = 0;
+        unsigned long parks = 0;
+        unsigned long steals = 0;
+        unsigned int failed = 0;
+        double run = 0;
+        double sum = 0;
+        double squares = 0;
+        double wall = s->end - s->start;
+        unsigned int i;
+
+        fprintf(out, "\n%-40s %-10s %8s %9s %7s %10s %10s %12s\n", "Input", "Status",
+                "Slices", "Preempted", "Parked", "Run, ms", "Wait, ms", "Max wait, ms");
+        for(i = 0; i < s->count; ++i) {
+                const green_task *t = s->tasks[i];
+                double share = (t->run + t->wait > 0) ? t->run / (t->run + t->wait) : 1;
+
+                fprintf(out, "%-40s %-10s %8lu %9lu %7lu %10.3f %10.3f %12.3f\n", t->input,
+                        (VM_OK == t->status) ? "OK" : vm_status_text(t->status),
+                        t->slices, t->preemptions, t->parks, t->run * 1000,
+                        t->wait * 1000, t->max_wait * 1000);
+
+                slices += t->slices;
+                preemptions += t->preemptions;
+                parks += t->parks;
+                run += t->run;
+                if(VM_OK != t->status) {
+                        ++failed;
+                }
+
+                /*  -     , 
+                 *  
+                 */
+                sum += share;
+                squares += share * share;
+        }
+
+        fprintf(out, "\n%-10s %10s %10s %10s %10s\n", "Worker", "Slices", "Steals",
+                "Polls", "Idle, ms");
+        for(i = 0; i < s->worker_count; ++i) {
+                const green_worker *w = &s->workers[i];
+
+                fprintf(out, "%-10u %10lu %10lu %10lu %10.3f\n", i, w->slices, w->steals,
+                        w->polls, w->idle * 1000);
+                steals += w->steals;
+        }
+
+        fprintf(out, "\n%u contexts, %u failed, %u workers, quantum %d\n", s->count, failed,
+                s->worker_count, s->quantum);
+        fprintf(out, "%lu slices, %lu preemptions, %lu parks, %lu steals\n", slices,
+                preemptions, parks, steals);
+        fprintf(out, "Wall time %.3f s, %.1f contexts/s, run time %.3f s, %.3f ms per slice\n",
+                wall, (wall > 0) ? s->count / wall : 0.0, run,
+                slices ? run * 1000 / slices : 0.0);
+        if(0 != s->count && squares > 0) {
+                fprintf(out, "Fairness (Jain) %.3f\n", sum * sum / (s->count * squares));
+        }
+}
+
+void vm_scheduler_destroy(vm_scheduler *s)
+{
+        unsigned int i;
+
+        for(i = 0; i < s->count; ++i) {
+                if(s->tasks[i]->fd >= 0) {
+                        close(s->tasks[i]->fd);
+                }
+                s->tasks[i]->vm->read_input = NULL;
+                s->tasks[i]->vm->reader = NULL;
+                free(s->tasks[i]);
+        }
+        for(i = 0; i < s->worker_count; ++i) {
+                pthread_mutex_destroy(&s->workers[i].lock);
+        }
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->wake);
+        free(s->poll_fds);
+        free(s->poll_tasks);
+        free(s->tasks);
+        free(s->workers);
+        free(s);
+}
+
+#else
+
+vm_scheduler* vm_scheduler_create(unsigned int workers, int quantum)
+{
+        return NULL;
+}
+
+int vm_scheduler_add(vm_scheduler *s, vm_state *vm, const char *input,
+        void (*done)(vm_state *vm, vm_status status, void *data), void *data)
+{
+        return 0;
+}
+
+void vm_scheduler_run(vm_scheduler *s)
+{
+}
+
+void vm_scheduler_print_stats(const vm_scheduler *s, FILE *out)
+{
+}
+
+void vm_scheduler_destroy(vm_scheduler *s)
+{
+}
+
+#endif
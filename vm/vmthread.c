@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "vmint.h"
+
+/*    .
+ *
+ *        
+ *   :     
+ *  ( COMPARE -     ),
+ *  ,     ( ,
+ *  ),  .   
+ *    ,     
+ *   .
+ *
+ *      (labels as values, GCC
+ *  ),     
+ *  goto.   switch   .
+ *
+ *       vm.c, 
+ *  :   vm_error()  
+ *    vm_state.
+ *
+ *     vmloop.h   :  
+ *       -  ,  
+ *   (vmverify.c).
+ */
+
+/*  .      
+ *  (vm->threaded).
+ */
+typedef struct threaded_command {
+#ifdef VM_COMPUTED_GOTO
+        void *handler;          /*   */
+#endif
+        threaded_op op;
+        int arg;
+        int arg2;
+        int cost;               /*     */
+} threaded_command;
+
+/*       */
+threaded_op vm_decode(const vm_image *image, unsigned int address)
+{
+        command cmd = vm_fetch(image, address);
+        unsigned int arg = cmd.arg;
+        unsigned int arg2 = cmd.arg2;
+
+        if(vm_is_call(image, address)) {
+                return TC_CALL;
+        }
+
+        switch(cmd.operation) {
+        case NOP:       return TC_NOP;
+        case STOP:      return TC_STOP;
+        case LOAD:      return TC_LOAD;
+        case STORE:     return TC_STORE;
+        case BLOAD:     return TC_BLOAD;
+        case BSTORE:    return TC_BSTORE;
+        case PUSH:      return TC_PUSH;
+        case POP:       return TC_POP;
+        case DUP:       return TC_DUP;
+        case SWAP:      return TC_SWAP;
+        case SHL:       return TC_SHL;
+        case SHR:       return TC_SHR;
+        case AND:       return TC_AND;
+        case OR:        return TC_OR;
+        case XOR:       return TC_XOR;
+        case VFILL:     return TC_VFILL;
+        case VCOPY:     return TC_VCOPY;
+        case VADDS:     return TC_VADDS;
+        case VMULS:     return TC_VMULS;
+        case VADD:      return TC_VADD;
+        case VSUM:      return TC_VSUM;
+        case VMIN:      return TC_VMIN;
+        case VMAX:      return TC_VMAX;
+        case INVERT:    return TC_INVERT;
+        case ADD:       return TC_ADD;
+        case SUB:       return TC_SUB;
+        case MULT:      return TC_MULT;
+        case DIV:       return TC_DIV;
+
+        case COMPARE:
+                switch(arg) {
+                case EQ: return TC_CMP_EQ;
+                case NE: return TC_CMP_NE;
+                case LT: return TC_CMP_LT;
+                case GT: return TC_CMP_GT;
+                case LE: return TC_CMP_LE;
+                case GE: return TC_CMP_GE;
+                default: return TC_CMP_BAD;
+                }
+
+        case JUMP:
+                return (arg < MAX_PROGRAM_SIZE) ? TC_JUMP : TC_JUMP_BAD;
+
+        case JUMP_YES:
+                return (arg < MAX_PROGRAM_SIZE) ? TC_JUMP_YES : TC_JUMP_BAD;
+
+        case JUMP_NO:
+                return (arg < MAX_PROGRAM_SIZE) ? TC_JUMP_NO : TC_JUMP_BAD;
+
+        case INPUT:     return TC_INPUT;
+        case PRINT:     return TC_PRINT;
+        case SLOAD:     return TC_SLOAD;
+        case SSTORE:    return TC_SSTORE;
+        case SJUMP:
+                return (arg < MAX_PROGRAM_SIZE) ? TC_SJUMP : TC_JUMP_BAD;
+
+        case BP:        return TC_BP;
+        case SBLOAD:    return TC_SBLOAD;
+        case SBSTORE:   return TC_SBSTORE;
+        case PUSH_ADD:  return TC_PUSH_ADD;
+        case PUSH_SUB:  return TC_PUSH_SUB;
+        case PUSH_MULT: return TC_PUSH_MULT;
+        case PUSH_DIV:  return TC_PUSH_DIV;
+        case LOAD_ADD:  return TC_LOAD_ADD;
+        case SLOAD_ADD: return TC_SLOAD_ADD;
+        case INC:       return TC_INC;
+        case SINC:      return TC_SINC;
+
+        case COMPARE_JUMP_NO:
+                if(arg2 >= MAX_PROGRAM_SIZE) {
+                        return TC_JUMP_BAD;
+                }
+                switch(arg) {
+                case EQ: return TC_CJ_EQ;
+                case NE: return TC_CJ_NE;
+                case LT: return TC_CJ_LT;
+                case GT: return TC_CJ_GT;
+                case LE: return TC_CJ_LE;
+                case GE: return TC_CJ_GE;
+                default: return TC_CMP_BAD;
+                }
+
+        case LOOP:
+                return (arg2 < MAX_PROGRAM_SIZE) ? TC_LOOP : TC_JUMP_BAD;
+
+        case SLOOP:
+                return (arg2 < MAX_PROGRAM_SIZE) ? TC_SLOOP : TC_JUMP_BAD;
+
+        case JUMP_TABLE:
+                return (arg < MAX_PROGRAM_SIZE - address - 1) ? TC_JUMP_TABLE : TC_JUMP_BAD;
+
+        case CALL:
+                return (arg < MAX_PROGRAM_SIZE) ? TC_CALLF : TC_JUMP_BAD;
+
+        case RET:
+                return (arg <= 1) ? TC_RET : TC_UNKNOWN;
+
+        case ALLOC:
+                return TC_ALLOC;
+
+        default:
+                return TC_UNKNOWN;
+        }
+}
+
+/*     .    
+ *     NOP,   
+ *     .
+ */
+#define TARGET(address) \
+        (program + (((unsigned int)(address) < size) ? (unsigned int)(address) : size))
+
+/*    op   address   
+ * target:    ,    
+ *  ,     . SJUMP  RET 
+ *  ,        
+ *  ,     .
+ */
+static int branch_cost(threaded_op op, unsigned int address, int target)
+{
+        switch(op) {
+        case TC_JUMP:
+        case TC_JUMP_YES:
+        case TC_JUMP_NO:
+        case TC_CALL:
+        case TC_CALLF:
+        case TC_CJ_EQ:
+        case TC_CJ_NE:
+        case TC_CJ_LT:
+        case TC_CJ_GT:
+        case TC_CJ_LE:
+        case TC_CJ_GE:
+        case TC_LOOP:
+        case TC_SLOOP:
+                return ((unsigned int)target <= address) ? (int)(address - target + 1) : 0;
+        case TC_SJUMP:
+        case TC_RET:
+                return 1;
+        default:
+                return 0;
+        }
+}
+
+/*       (  
+ * :  vm_run()  vm_resume()  ).
+ *      .
+ */
+static threaded_command* decode_program(vm_state *vm)
+{
+        const vm_image *image = vm->image;
+        threaded_command *program = vm->threaded;
+        unsigned int i;
+
+        if(NULL == program) {
+                program = (threaded_command*)vm_allocate(vm,
+                        (image->size + 1) * sizeof(threaded_command));
+                vm->threaded = program;
+        }
+        else if(vm->threaded_decoded) {
+                return program;
+        }
+
+        for(i = 0; i < image->size; ++i) {
+                command cmd = vm_fetch(image, i);
+                threaded_op op = vm_decode(image, i);
+
+                program[i].op = op;
+                program[i].arg = cmd.arg;
+                program[i].arg2 = cmd.arg2;
+                program[i].cost = branch_cost(op, i,
+                        ((op >= TC_CJ_EQ && op <= TC_CJ_GE) || TC_LOOP == op || TC_SLOOP == op) ?
+                        cmd.arg2 : cmd.arg);
+        }
+        program[image->size].op = TC_END;
+        program[image->size].arg = 0;
+        program[image->size].arg2 = 0;
+        program[image->size].cost = 0;
+        vm->threaded_decoded = 1;
+        vm->threaded_labels = NULL;
+        return program;
+}
+
+#ifdef VM_COMPUTED_GOTO
+#define CASE(name)      L_##name
+#define NEXT()          do { arg = (++pc)->arg; goto *pc->handler; } while(0)
+#define JUMP_TO(target) do { pc = (target); arg = pc->arg; goto *pc->handler; } while(0)
+#define DISPATCH()      goto *pc->handler
+#else
+#define CASE(name)      case TC_##name
+#define NEXT()          do { ++pc; goto dispatch; } while(0)
+#define JUMP_TO(target) do { pc = (target); goto dispatch; } while(0)
+#define DISPATCH()      goto dispatch
+#endif
+
+/*     */
+#define SAVE_STATE() \
+        do { \
+                vm->stack_pointer = sp; \
+                vm->base_pointer = bp; \
+                vm->command_pointer = pc - program; \
+                vm->budget = budget; \
+                SAVE_CALLS(); \
+        } while(0)
+
+/*      */
+#define FAIL(error)     do { SAVE_STATE(); vm_error(vm, error); } while(0)
+
+/*       */
+#define LOOP_NAME       run_checked_loop
+#define LOOP_CHECKED    1
+#include "vmloop.h"
+
+/*   ,   vm_image_verify() */
+#define LOOP_NAME       run_unchecked_loop
+#define LOOP_CHECKED    0
+#include "vmloop.h"
+
+void run_threaded(vm_state *vm)
+{
+        run_checked_loop(vm);
+}
+
+int run_unchecked(vm_state *vm)
+{
+        return run_unchecked_loop(vm);
+}
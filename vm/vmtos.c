@@ -0,0 +1,602 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vmint.h"
+
+/*       .
+ *
+ *   ,  vm_image_verify().  
+ *       tos,   -
+ *   .     :  , 
+ *     (0),   ,    tos (1).
+ * ,     (STORE, SSTORE, JUMP_YES, PRINT
+ *  . .),     0     
+ *  ;  ,   ,  
+ *   tos.  ADD, SUB, MULT, COMPARE    
+ *      .
+ *
+ * ,    (SLOAD, SBLOAD, SINC),  
+ *      tos:      .
+ * BP, SJUMP, CALL  RET       , 
+ *     vmloop.h;    ,
+ * tos ,     
+ * .
+ */
+
+/*  :     .
+ *        (vm->tos)
+ *    ,   .
+ */
+typedef struct tos_command {
+#ifdef VM_COMPUTED_GOTO
+        void *handler[2];
+#endif
+        threaded_op op;
+        int arg;
+        int arg2;
+} tos_command;
+
+#ifdef VM_COMPUTED_GOTO
+#define CASE0(name)     S0_##name
+#define CASE1(name)     S1_##name
+#define NEXT0()         do { ++pc; goto *pc->handler[0]; } while(0)
+#define NEXT1()         do { ++pc; goto *pc->handler[1]; } while(0)
+#define JUMP0(target)   do { pc = (target); goto *pc->handler[0]; } while(0)
+#define JUMP1(target)   do { pc = (target); goto *pc->handler[1]; } while(0)
+#define AGAIN1()        goto *pc->handler[1]
+#else
+#define CASE0(name)     case 2 * TC_##name
+#define CASE1(name)     case 2 * TC_##name + 1
+#define NEXT0()         do { ++pc; state = 0; goto dispatch; } while(0)
+#define NEXT1()         do { ++pc; state = 1; goto dispatch; } while(0)
+#define JUMP0(target)   do { pc = (target); state = 0; goto dispatch; } while(0)
+#define JUMP1(target)   do { pc = (target); state = 1; goto dispatch; } while(0)
+#define AGAIN1()        do { state = 1; goto dispatch; } while(0)
+#endif
+
+/*    tos      1 */
+#define FILL()          do { tos = vm->stack[sp - 1]; AGAIN1(); } while(0)
+
+/*  tos   */
+#define SPILL()         (vm->stack[sp - 1] = tos)
+
+#define SAVE_STATE() \
+        do { \
+                vm->stack_pointer = sp; \
+                vm->base_pointer = bp; \
+                vm->command_pointer = pc - tos_program; \
+        } while(0)
+
+/*    1 */
+#define FAIL1(error)    do { SPILL(); SAVE_STATE(); vm_error(vm, error); } while(0)
+
+/*      */
+#define LEAVE0()        do { SAVE_STATE(); return 0; } while(0)
+#define LEAVE1()        do { SPILL(); SAVE_STATE(); return 0; } while(0)
+
+/*       bp (   i) */
+#define RETURN_ALLOWED() \
+        (0 != calls && bp - 2 < MAX_STACK_SIZE - 1 && \
+         (unsigned int)vm->frames[bp - 2] == vm->calls[calls - 1].return_address && \
+         (unsigned int)vm->frames[bp - 1] == vm->calls[calls - 1].base_pointer && \
+         sp == vm->calls[calls - 1].stack_pointer)
+
+#define RETURN() \
+        do { \
+                --calls; \
+                address = bp - 2; \
+                i = vm->frames[address]; \
+                bp = vm->frames[address + 1]; \
+                vm->frame_top = address; \
+        } while(0)
+
+/*    ALLOC */
+#define ALLOC_ALLOWED() \
+        ((unsigned int)pc->arg <= MAX_STACK_SIZE - vm->frame_top)
+
+#define ALLOC() \
+        do { \
+                memset(vm->frames + vm->frame_top, 0, pc->arg * sizeof(int)); \
+                vm->frame_top += pc->arg; \
+        } while(0)
+
+/*   :   tos,     */
+#define BINARY(name, expression) \
+        CASE0(name): \
+                FILL(); \
+        CASE1(name): \
+                --sp; \
+                tos = (expression); \
+                NEXT1();
+
+/*       */
+#define UNARY(name, expression) \
+        CASE0(name): \
+                FILL(); \
+        CASE1(name): \
+                tos = (expression); \
+                NEXT1();
+
+/*    pop  (vmbulk.c): 
+ *   ,   
+ */
+#define BULK(name, pop, push) \
+        CASE1(name): \
+                SPILL(); \
+        CASE0(name): \
+                error = vm_bulk(vm, name, pc->arg, vm->stack + sp - (pop), bp); \
+                if(error >= 0) { \
+                        SAVE_STATE(); \
+                        vm_error(vm, (runtime_error)error); \
+                } \
+                sp -= (pop) - (push); \
+                NEXT0();
+
+/*   ,    (COMPARE_JUMP_NO) */
+#define COMPARE_JUMP(name, relation) \
+        CASE0(name): \
+                FILL(); \
+        CASE1(name): \
+                sp -= 2; \
+                if(!(vm->stack[sp] relation tos)) { \
+                        JUMP0(tos_program + pc->arg2); \
+                } \
+                NEXT0();
+
+/*  :     ,  -   */
+#define COUNTED_LOOP(name, counter) \
+        CASE0(name): \
+                FILL(); \
+        CASE1(name): \
+                value = LOOP_NEXT(counter, tos); \
+                counter = value; \
+                if(LOOP_CONTINUES(value, vm->stack[sp - 2], tos)) { \
+                        JUMP1(tos_program + pc->arg2); \
+                } \
+                NEXT1();
+
+int run_tos(vm_state *vm)
+{
+        const vm_image *image = vm->image;
+        unsigned int size = image->size;
+        tos_command *tos_program = vm->tos;
+        tos_command *pc;
+        unsigned int sp = vm->stack_pointer;
+        unsigned int bp = vm->base_pointer;
+        unsigned int calls = 0;
+        unsigned int address;
+        int tos = 0;
+        int value;
+        int error;
+        unsigned int i;
+
+#ifdef VM_COMPUTED_GOTO
+#define HANDLERS(name)  { &&S0_##name, &&S1_##name }
+        static void *labels[TC_COUNT][2] = {
+                HANDLERS(NOP), HANDLERS(STOP), HANDLERS(LOAD), HANDLERS(STORE),
+                HANDLERS(BLOAD), HANDLERS(BSTORE), HANDLERS(PUSH), HANDLERS(POP),
+                HANDLERS(DUP), HANDLERS(INVERT), HANDLERS(ADD), HANDLERS(SUB),
+                HANDLERS(MULT), HANDLERS(DIV), HANDLERS(CMP_EQ), HANDLERS(CMP_NE),
+                HANDLERS(CMP_LT), HANDLERS(CMP_GT), HANDLERS(CMP_LE),
+                HANDLERS(CMP_GE), HANDLERS(CMP_BAD), HANDLERS(JUMP),
+                HANDLERS(JUMP_YES), HANDLERS(JUMP_NO), HANDLERS(JUMP_BAD),
+                HANDLERS(CALL), HANDLERS(INPUT), HANDLERS(PRINT), HANDLERS(SLOAD),
+                HANDLERS(SSTORE), HANDLERS(SJUMP), HANDLERS(BP), HANDLERS(SBLOAD),
+                HANDLERS(SBSTORE), HANDLERS(PUSH_ADD), HANDLERS(PUSH_SUB),
+                HANDLERS(PUSH_MULT), HANDLERS(PUSH_DIV), HANDLERS(LOAD_ADD),
+                HANDLERS(SLOAD_ADD), HANDLERS(INC), HANDLERS(SINC), HANDLERS(CJ_EQ),
+                HANDLERS(CJ_NE), HANDLERS(CJ_LT), HANDLERS(CJ_GT), HANDLERS(CJ_LE),
+                HANDLERS(CJ_GE), HANDLERS(CALLF), HANDLERS(RET), HANDLERS(ALLOC),
+                HANDLERS(SWAP), HANDLERS(SHL), HANDLERS(SHR), HANDLERS(AND),
+                HANDLERS(OR), HANDLERS(XOR), HANDLERS(VFILL), HANDLERS(VCOPY),
+                HANDLERS(VADDS), HANDLERS(VMULS), HANDLERS(VADD), HANDLERS(VSUM),
+                HANDLERS(VMIN), HANDLERS(VMAX), HANDLERS(LOOP), HANDLERS(SLOOP),
+                HANDLERS(JUMP_TABLE), HANDLERS(UNKNOWN),
+                HANDLERS(END)
+        };
+#undef HANDLERS
+#else
+        int state = 0;
+#endif
+
+        /*       */
+        if(NULL == tos_program) {
+                tos_program = (tos_command*)vm_allocate(vm,
+                        (size + 1) * sizeof(tos_command));
+
+                for(i = 0; i < size; ++i) {
+                        command cmd = vm_fetch(image, i);
+
+                        tos_program[i].op = vm_decode(image, i);
+                        tos_program[i].arg = cmd.arg;
+                        tos_program[i].arg2 = cmd.arg2;
+                }
+                tos_program[size].op = TC_END;
+                tos_program[size].arg = 0;
+                tos_program[size].arg2 = 0;
+
+#ifdef VM_COMPUTED_GOTO
+                for(i = 0; i <= size; ++i) {
+                        tos_program[i].handler[0] = labels[tos_program[i].op][0];
+                        tos_program[i].handler[1] = labels[tos_program[i].op][1];
+                }
+#endif
+                vm->tos = tos_program;
+        }
+
+        pc = tos_program + vm->command_pointer;
+
+#ifdef VM_COMPUTED_GOTO
+        goto *pc->handler[0];
+#else
+dispatch:
+        switch(2 * pc->op + state) {
+#endif
+
+        CASE0(NOP):
+                NEXT0();
+
+        CASE1(NOP):
+                NEXT1();
+
+        CASE0(LOAD):
+                tos = vm->memory[pc->arg];
+                ++sp;
+                NEXT1();
+
+        CASE1(LOAD):
+                SPILL();
+                tos = vm->memory[pc->arg];
+                ++sp;
+                NEXT1();
+
+        CASE0(STORE):
+                FILL();
+
+        CASE1(STORE):
+                vm->memory[pc->arg] = tos;
+                --sp;
+                NEXT0();
+
+        CASE0(BLOAD):
+                FILL();
+
+        CASE1(BLOAD):
+                address = pc->arg + tos;
+                if(address >= MAX_MEMORY_SIZE) FAIL1(BAD_DATA_ADDRESS);
+                tos = vm->memory[address];
+                NEXT1();
+
+        CASE0(BSTORE):
+                FILL();
+
+        CASE1(BSTORE):
+                address = pc->arg + tos;
+                if(address >= MAX_MEMORY_SIZE) FAIL1(BAD_DATA_ADDRESS);
+                vm->memory[address] = vm->stack[sp - 2];
+                sp -= 2;
+                NEXT0();
+
+        CASE0(PUSH):
+                tos = pc->arg;
+                ++sp;
+                NEXT1();
+
+        CASE1(PUSH):
+                SPILL();
+                tos = pc->arg;
+                ++sp;
+                NEXT1();
+
+        CASE0(POP):
+        CASE1(POP):
+                --sp;
+                NEXT0();
+
+        CASE0(DUP):
+                FILL();
+
+        CASE1(DUP):
+                SPILL();
+                ++sp;
+                NEXT1();
+
+        /*      ,   
+         *  
+         */
+        CASE0(SWAP):
+                FILL();
+
+        CASE1(SWAP):
+                vm->stack[sp - 1] = vm->stack[sp - 2];
+                vm->stack[sp - 2] = tos;
+                NEXT0();
+
+        CASE0(INVERT):
+                FILL();
+
+        CASE1(INVERT):
+                tos = -tos;
+                NEXT1();
+
+        BINARY(ADD, vm->stack[sp - 1] + tos)
+        BINARY(SUB, vm->stack[sp - 1] - tos)
+        BINARY(MULT, vm->stack[sp - 1] * tos)
+        BINARY(AND, vm->stack[sp - 1] & tos)
+        BINARY(OR, vm->stack[sp - 1] | tos)
+        BINARY(XOR, vm->stack[sp - 1] ^ tos)
+
+        BULK(VFILL, 3, 0)
+        BULK(VCOPY, 3, 0)
+        BULK(VADDS, 3, 0)
+        BULK(VMULS, 3, 0)
+        BULK(VADD, 4, 0)
+        BULK(VSUM, 2, 1)
+        BULK(VMIN, 2, 1)
+        BULK(VMAX, 2, 1)
+        BINARY(CMP_EQ, (vm->stack[sp - 1] == tos) ? 1 : 0)
+        BINARY(CMP_NE, (vm->stack[sp - 1] != tos) ? 1 : 0)
+        BINARY(CMP_LT, (vm->stack[sp - 1] < tos) ? 1 : 0)
+        BINARY(CMP_GT, (vm->stack[sp - 1] > tos) ? 1 : 0)
+        BINARY(CMP_LE, (vm->stack[sp - 1] <= tos) ? 1 : 0)
+        BINARY(CMP_GE, (vm->stack[sp - 1] >= tos) ? 1 : 0)
+
+        CASE0(DIV):
+                FILL();
+
+        CASE1(DIV):
+                if(0 == tos) FAIL1(DIVISION_BY_ZERO);
+                --sp;
+                tos = vm->stack[sp - 1] / tos;
+                NEXT1();
+
+        CASE0(JUMP):
+                JUMP0(tos_program + pc->arg);
+
+        CASE1(JUMP):
+                JUMP1(tos_program + pc->arg);
+
+        CASE0(JUMP_YES):
+                FILL();
+
+        CASE1(JUMP_YES):
+                --sp;
+                if(tos) {
+                        JUMP0(tos_program + pc->arg);
+                }
+                NEXT0();
+
+        CASE0(JUMP_NO):
+                FILL();
+
+        CASE1(JUMP_NO):
+                --sp;
+                if(!tos) {
+                        JUMP0(tos_program + pc->arg);
+                }
+                NEXT0();
+
+        CASE0(CALL):
+                if(calls >= MAX_STACK_SIZE) LEAVE0();
+                vm->calls[calls].return_address = pc - tos_program + 1;
+                vm->calls[calls].stack_pointer = sp + vm_call_effect(image, pc - tos_program);
+                ++calls;
+                JUMP0(tos_program + pc->arg);
+
+        CASE1(CALL):
+                if(calls >= MAX_STACK_SIZE) LEAVE1();
+                vm->calls[calls].return_address = pc - tos_program + 1;
+                vm->calls[calls].stack_pointer = sp + vm_call_effect(image, pc - tos_program);
+                ++calls;
+                JUMP1(tos_program + pc->arg);
+
+        CASE0(INPUT):
+                SAVE_STATE();
+                tos = vm_read(vm);
+                ++sp;
+                NEXT1();
+
+        CASE1(INPUT):
+                SPILL();
+                SAVE_STATE();
+                tos = vm_read(vm);
+                ++sp;
+                NEXT1();
+
+        CASE0(PRINT):
+                FILL();
+
+        CASE1(PRINT):
+                vm_write(vm, tos);
+                --sp;
+                NEXT0();
+
+        CASE1(SLOAD):
+                SPILL();
+
+        CASE0(SLOAD):
+                tos = vm->frames[bp + pc->arg];
+                ++sp;
+                NEXT1();
+
+        CASE0(SSTORE):
+                FILL();
+
+        CASE1(SSTORE):
+                vm->frames[bp + pc->arg] = tos;
+                --sp;
+                NEXT0();
+
+        CASE0(SJUMP):
+                FILL();
+
+        CASE1(SJUMP):
+                if(0 == calls ||
+                                (unsigned int)tos != vm->calls[calls - 1].return_address ||
+                                sp - 1 != vm->calls[calls - 1].stack_pointer) {
+                        LEAVE1();
+                }
+                --calls;
+                --sp;
+                JUMP0(tos_program + tos);
+
+        CASE0(BP):
+                if(!vm_frame_allowed(image, pc - tos_program, sp + pc->arg)) LEAVE0();
+                bp = sp + pc->arg;
+                NEXT0();
+
+        CASE1(BP):
+                if(!vm_frame_allowed(image, pc - tos_program, sp + pc->arg)) LEAVE1();
+                bp = sp + pc->arg;
+                NEXT1();
+
+        CASE0(SBLOAD):
+                FILL();
+
+        CASE1(SBLOAD):
+                address = bp + (unsigned int)(pc->arg + tos);
+                if(address >= MAX_STACK_SIZE) FAIL1(STACK_CORRUPTED);
+                tos = vm->frames[address];
+                NEXT1();
+
+        CASE0(SBSTORE):
+                FILL();
+
+        CASE1(SBSTORE):
+                address = bp + (unsigned int)(pc->arg + tos);
+                if(address >= MAX_STACK_SIZE) FAIL1(STACK_CORRUPTED);
+                vm->frames[address] = vm->stack[sp - 2];
+                sp -= 2;
+                NEXT0();
+
+        UNARY(PUSH_ADD, tos + pc->arg)
+        UNARY(PUSH_SUB, tos - pc->arg)
+        UNARY(PUSH_MULT, tos * pc->arg)
+        UNARY(SHL, (int)((unsigned int)tos << (pc->arg & 31)))
+        UNARY(SHR, tos >> (pc->arg & 31))
+        UNARY(LOAD_ADD, tos + vm->memory[pc->arg])
+
+        CASE0(PUSH_DIV):
+                FILL();
+
+        CASE1(PUSH_DIV):
+                if(0 == pc->arg) FAIL1(DIVISION_BY_ZERO);
+                tos /= pc->arg;
+                NEXT1();
+
+        UNARY(SLOAD_ADD, tos + vm->frames[bp + pc->arg])
+
+        CASE0(INC):
+                vm->memory[pc->arg] += pc->arg2;
+                NEXT0();
+
+        CASE1(INC):
+                vm->memory[pc->arg] += pc->arg2;
+                NEXT1();
+
+        CASE0(SINC):
+                vm->frames[bp + pc->arg] += pc->arg2;
+                NEXT0();
+
+        CASE1(SINC):
+                vm->frames[bp + pc->arg] += pc->arg2;
+                NEXT1();
+
+        COMPARE_JUMP(CJ_EQ, ==)
+        COMPARE_JUMP(CJ_NE, !=)
+        COMPARE_JUMP(CJ_LT, <)
+        COMPARE_JUMP(CJ_GT, >)
+        COMPARE_JUMP(CJ_LE, <=)
+        COMPARE_JUMP(CJ_GE, >=)
+
+        COUNTED_LOOP(LOOP, vm->memory[pc->arg])
+        COUNTED_LOOP(SLOOP, vm->frames[bp + pc->arg])
+
+        /*        JUMP */
+        CASE0(JUMP_TABLE):
+                FILL();
+
+        CASE1(JUMP_TABLE):
+                --sp;
+                pc += 1 + JUMP_TABLE_ENTRY(tos, pc->arg);
+                if(TC_JUMP == pc->op) {
+                        JUMP0(tos_program + pc->arg);
+                }
+                JUMP0(pc);
+
+        CASE1(CALLF):
+                SPILL();
+
+        CASE0(CALLF):
+                /*       , 
+                 *       
+                 */
+                address = vm->frame_top;
+                if(calls >= MAX_STACK_SIZE || address + 2 + pc->arg2 > MAX_STACK_SIZE ||
+                                !vm_frame_allowed(image, pc - tos_program, address + 2)) {
+                        LEAVE0();
+                }
+                vm->calls[calls].return_address = pc - tos_program + 1;
+                vm->calls[calls].stack_pointer = sp + vm_call_effect(image, pc - tos_program);
+                vm->calls[calls].base_pointer = bp;
+                ++calls;
+                vm->frames[address] = pc - tos_program + 1;
+                vm->frames[address + 1] = bp;
+                bp = address + 2;
+                vm->frame_top = bp + pc->arg2;
+                sp -= pc->arg2;
+                for(i = 0; i < (unsigned int)pc->arg2; ++i) {
+                        vm->frames[bp + i] = vm->stack[sp + i];
+                }
+                JUMP0(tos_program + pc->arg);
+
+        /*       
+         * (. vmloop.h).     , 
+         *    .
+         */
+        CASE0(RET):
+                if(!RETURN_ALLOWED()) LEAVE0();
+                RETURN();
+                JUMP0(tos_program + i);
+
+        CASE1(RET):
+                if(!RETURN_ALLOWED()) LEAVE1();
+                RETURN();
+                JUMP1(tos_program + i);
+
+        CASE0(ALLOC):
+                if(!ALLOC_ALLOWED()) LEAVE0();
+                ALLOC();
+                NEXT0();
+
+        CASE1(ALLOC):
+                if(!ALLOC_ALLOWED()) LEAVE1();
+                ALLOC();
+                NEXT1();
+
+        /*      */
+        CASE0(CMP_BAD):
+        CASE0(JUMP_BAD):
+        CASE0(UNKNOWN):
+                LEAVE0();
+
+        CASE1(CMP_BAD):
+        CASE1(JUMP_BAD):
+        CASE1(UNKNOWN):
+                LEAVE1();
+
+        CASE1(STOP):
+        CASE1(END):
+                SPILL();
+
+        CASE0(STOP):
+        CASE0(END):
+#ifndef VM_COMPUTED_GOTO
+        default:
+                break;
+        }
+#endif
+
+        SAVE_STATE();
+        return 1;
+}
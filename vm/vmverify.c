@@ -0,0 +1,614 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "vmint.h"
+
+/*    .
+ *
+ *  ,      
+ *  :
+ *     -      ,
+ *     -  LOAD/STORE (   LOAD_ADD, INC, LOOP) 
+ *         ,
+ *     -   JUMP*, COMPARE_JUMP_NO, LOOP  SLOOP,  
+ *          JUMP_TABLE   ,
+ *     -         ,
+ *             ,    ,
+ *           .
+ *
+ *    :   ( 
+ *  )  .     CALL,
+ *    JUMP,    BP (  
+ *   );  - RET  SJUMP .
+ *        
+ *           
+ *   SJUMP   ,   RET. ,
+ *  CALL,      (
+ *    )   RET    
+ *  .        ,
+ *       . ,
+ *           ,
+ *    ,  .
+ *
+ *  SLOAD/SSTORE (  SLOAD_ADD, SINC, SLOOP)     ,
+ *       BP  CALL.
+ *        
+ * ,       , 
+ *          - 
+ *  BP  CALL.
+ */
+
+/*    */
+enum {
+        FUNCTION_UNKNOWN = 0,   /*     */
+        FUNCTION_ACTIVE,        /*   */
+        FUNCTION_DONE           /*   */
+};
+
+/*   ,        */
+typedef struct {
+        int state;      /*   */
+        int frame;      /*    RET */
+        int net;        /*         SJUMP,
+                         *  RET -    */
+        int min;        /*      */
+        int max;        /*      */
+        int returns;    /*      */
+} function_info;
+
+/*   SLOAD/SSTORE    */
+typedef struct {
+        int used;       /* ,     */
+        int low;
+        int high;
+} frame_range;
+
+/*       (  
+ *  )
+ */
+struct vm_analysis {
+        const vm_image *image;
+
+        int *depth;             /*     */
+        int *region;            /*  , 0 -   */
+        int *region_entry;      /*        */
+        int regions_count;
+
+        function_info *functions;
+
+        /*  ,   , -   ,
+         *  -1.       
+         * next_return.
+         */
+        int *return_owner;
+        int *next_return;
+
+        frame_range *frames;
+
+        unsigned int *worklist;
+        unsigned int worklist_top;
+        unsigned int *visited;
+        unsigned int visit_stamp;
+};
+
+/*   : JUMP   BP */
+static int is_call(const vm_image *image, unsigned int address)
+{
+        return JUMP == PACKED_CODE(image->code[address]) && address > 0 &&
+                BP == PACKED_CODE(image->code[address - 1]);
+}
+
+/*    target   id    d */
+static int follow(vm_analysis *a, int id, unsigned int target, int d)
+{
+        if(target >= a->image->size) {
+                /*   */
+                return 1;
+        }
+
+        if(0 == a->region[target]) {
+                a->region[target] = id;
+                a->depth[target] = d;
+                a->worklist[a->worklist_top++] = target;
+                return 1;
+        }
+
+        return a->region[target] == id && a->depth[target] == d;
+}
+
+static int analyze(vm_analysis *a, unsigned int entry, function_info *function);
+
+/*      entry */
+static function_info* analyze_call(vm_analysis *a, unsigned int entry)
+{
+        function_info *callee = &a->functions[entry];
+
+        if(FUNCTION_UNKNOWN == callee->state) {
+                callee->state = FUNCTION_ACTIVE;
+                callee->returns = -1;
+                if(!analyze(a, entry, callee)) {
+                        return NULL;
+                }
+                callee->state = FUNCTION_DONE;
+        }
+
+        /*   */
+        return (FUNCTION_DONE == callee->state) ? callee : NULL;
+}
+
+/*  ,    entry.  
+ *  function  NULL.
+ */
+static int analyze(vm_analysis *a, unsigned int entry, function_info *function)
+{
+        unsigned int base = a->worklist_top;
+        int id = ++a->regions_count;
+        int min = 0;
+        int max = 0;
+        int net = 0;
+        int has_net = 0;
+        int results = 0;
+        int has_results = 0;
+        int n;
+
+        if(entry >= a->image->size || 0 != a->region[entry]) {
+                return 0;
+        }
+
+        a->region_entry[id] = entry;
+        follow(a, id, entry, 0);
+
+        while(a->worklist_top > base) {
+                unsigned int i = a->worklist[--a->worklist_top];
+                command cmd = vm_fetch(a->image, i);
+                opcode_info *info = operation_info(cmd.operation);
+                unsigned int arg = cmd.arg;
+                function_info *callee;
+                int d = a->depth[i];
+                int after;
+
+                if(NULL == info) {
+                        return 0;
+                }
+
+                after = d - info->pop;
+                if(after < min) {
+                        min = after;
+                }
+                after += info->push;
+                if(after > max) {
+                        max = after;
+                }
+
+                switch(cmd.operation) {
+                case STOP:
+                        continue;
+
+                case LOAD:
+                case STORE:
+                case LOAD_ADD:
+                case INC:
+                        if(arg >= MAX_MEMORY_SIZE) {
+                                return 0;
+                        }
+                        break;
+
+                case COMPARE:
+                        if(arg > GE) {
+                                return 0;
+                        }
+                        break;
+
+                case JUMP_YES:
+                case JUMP_NO:
+                        if(arg >= a->image->size || !follow(a, id, arg, after)) {
+                                return 0;
+                        }
+                        break;
+
+                case COMPARE_JUMP_NO:
+                        if(arg > GE || (unsigned int)cmd.arg2 >= a->image->size ||
+                                        !follow(a, id, cmd.arg2, after)) {
+                                return 0;
+                        }
+                        break;
+
+                case LOOP:
+                case SLOOP:
+                        if((LOOP == cmd.operation && arg >= MAX_MEMORY_SIZE) ||
+                                        (unsigned int)cmd.arg2 >= a->image->size ||
+                                        !follow(a, id, cmd.arg2, after)) {
+                                return 0;
+                        }
+                        break;
+
+                case JUMP_TABLE:
+                        /*       */
+                        if(arg >= a->image->size - i - 1) {
+                                return 0;
+                        }
+                        for(n = 0; n <= (int)arg; ++n) {
+                                if(!follow(a, id, i + 1 + n, after)) {
+                                        return 0;
+                                }
+                        }
+                        continue;
+
+                case JUMP:
+                        if(arg >= a->image->size) {
+                                return 0;
+                        }
+
+                        if(!is_call(a->image, i)) {
+                                if(!follow(a, id, arg, after)) {
+                                        return 0;
+                                }
+                                continue;
+                        }
+
+                        callee = analyze_call(a, arg);
+                        if(NULL == callee || callee->frame || i + 1 >= a->image->size) {
+                                return 0;
+                        }
+
+                        if(d + callee->min < min) {
+                                min = d + callee->min;
+                        }
+                        if(d + callee->max > max) {
+                                max = d + callee->max;
+                        }
+
+                        a->return_owner[i + 1] = arg;
+                        a->next_return[i + 1] = callee->returns;
+                        callee->returns = i + 1;
+
+                        if(!follow(a, id, i + 1, d + callee->net)) {
+                                return 0;
+                        }
+                        continue;
+
+                case CALL:
+                        /*      ,  
+                         *    d - n
+                         */
+                        n = cmd.arg2;
+                        if(arg >= a->image->size || n < 0 || i + 1 >= a->image->size) {
+                                return 0;
+                        }
+
+                        callee = analyze_call(a, arg);
+                        if(NULL == callee || !callee->frame) {
+                                return 0;
+                        }
+
+                        if(d - n < min) {
+                                min = d - n;
+                        }
+                        if(d - n + callee->max > max) {
+                                max = d - n + callee->max;
+                        }
+
+                        if(!follow(a, id, i + 1, d - n + callee->net)) {
+                                return 0;
+                        }
+                        continue;
+
+                case RET:
+                        if(NULL == function || arg > 1 || d != (int)arg ||
+                                        (has_results && results != (int)arg)) {
+                                return 0;
+                        }
+                        has_results = 1;
+                        results = arg;
+                        continue;
+
+                case ALLOC:
+                        if((int)arg < 0) {
+                                return 0;
+                        }
+                        break;
+
+                case SJUMP:
+                        if(NULL == function || arg >= MAX_PROGRAM_SIZE) {
+                                return 0;
+                        }
+                        if(has_net && net != after) {
+                                return 0;
+                        }
+                        has_net = 1;
+                        net = after;
+                        continue;
+
+                default:
+                        break;
+                }
+
+                if(!follow(a, id, i + 1, after)) {
+                        return 0;
+                }
+        }
+
+        if(NULL == function) {
+                return min >= 0 && max <= MAX_STACK_SIZE;
+        }
+
+        /*     SJUMP,   RET.
+         *   RET   ,  .
+         */
+        if(has_net == has_results || (has_results && min < 0)) {
+                return 0;
+        }
+
+        function->frame = has_results;
+        function->net = has_results ? results : net;
+        function->min = min;
+        function->max = max;
+        return 1;
+}
+
+/*   SLOAD/SSTORE,    ,
+ *    start.  CALL   
+ *   ,  ,   , 
+ * .
+ */
+static void collect_frame(vm_analysis *a, unsigned int start, frame_range *frame)
+{
+        int returns;
+        int k;
+
+        frame->used = 0;
+        ++a->visit_stamp;
+        a->worklist_top = 0;
+
+        if(start < a->image->size) {
+                a->visited[start] = a->visit_stamp;
+                a->worklist[a->worklist_top++] = start;
+        }
+
+#define VISIT(address) \
+        do { \
+                unsigned int next = (address); \
+                if(next < a->image->size && a->visited[next] != a->visit_stamp) { \
+                        a->visited[next] = a->visit_stamp; \
+                        a->worklist[a->worklist_top++] = next; \
+                } \
+        } while(0)
+
+        while(a->worklist_top > 0) {
+                unsigned int i = a->worklist[--a->worklist_top];
+                command cmd = vm_fetch(a->image, i);
+
+                switch(cmd.operation) {
+                case BP:
+                case STOP:
+                case RET:
+                        break;
+
+                case CALL:
+                        VISIT(i + 1);
+                        break;
+
+                case SLOAD:
+                case SSTORE:
+                case SLOAD_ADD:
+                case SINC:
+                case SLOOP:
+                        if(!frame->used || cmd.arg < frame->low) {
+                                frame->low = cmd.arg;
+                        }
+                        if(!frame->used || cmd.arg > frame->high) {
+                                frame->high = cmd.arg;
+                        }
+                        frame->used = 1;
+                        if(SLOOP == cmd.operation) {
+                                VISIT(cmd.arg2);
+                        }
+                        VISIT(i + 1);
+                        break;
+
+                case JUMP:
+                        VISIT(cmd.arg);
+                        break;
+
+                case JUMP_YES:
+                case JUMP_NO:
+                        VISIT(cmd.arg);
+                        VISIT(i + 1);
+                        break;
+
+                case COMPARE_JUMP_NO:
+                case LOOP:
+                        VISIT(cmd.arg2);
+                        VISIT(i + 1);
+                        break;
+
+                case JUMP_TABLE:
+                        for(k = 0; k <= cmd.arg; ++k) {
+                                VISIT(i + 1 + k);
+                        }
+                        break;
+
+                case SJUMP:
+                        returns = a->functions[a->region_entry[a->region[i]]].returns;
+                        while(returns >= 0) {
+                                VISIT(returns);
+                                returns = a->next_return[returns];
+                        }
+                        break;
+
+                default:
+                        VISIT(i + 1);
+                }
+        }
+
+#undef VISIT
+}
+
+static void free_analysis(vm_analysis *a)
+{
+        if(NULL == a) {
+                return;
+        }
+
+        free(a->depth);
+        free(a->region);
+        free(a->region_entry);
+        free(a->functions);
+        free(a->return_owner);
+        free(a->next_return);
+        free(a->frames);
+        free(a->worklist);
+        free(a->visited);
+        free(a);
+}
+
+/*       image */
+static vm_analysis* create_analysis(const vm_image *image)
+{
+        unsigned int size = image->size;
+        vm_analysis *a = (vm_analysis*)calloc(1, sizeof(vm_analysis));
+
+        if(NULL == a) {
+                return NULL;
+        }
+
+        a->image = image;
+        a->depth = (int*)malloc(size * sizeof(int));
+        a->region = (int*)malloc(size * sizeof(int));
+        a->region_entry = (int*)malloc((size + 1) * sizeof(int));
+        a->functions = (function_info*)malloc(size * sizeof(function_info));
+        a->return_owner = (int*)malloc(size * sizeof(int));
+        a->next_return = (int*)malloc(size * sizeof(int));
+        a->frames = (frame_range*)calloc(size, sizeof(frame_range));
+        a->worklist = (unsigned int*)malloc(size * sizeof(unsigned int));
+        a->visited = (unsigned int*)calloc(size, sizeof(unsigned int));
+
+        if(NULL == a->depth || NULL == a->region || NULL == a->region_entry ||
+                        NULL == a->functions || NULL == a->return_owner ||
+                        NULL == a->next_return || NULL == a->frames ||
+                        NULL == a->worklist || NULL == a->visited) {
+                free_analysis(a);
+                return NULL;
+        }
+        return a;
+}
+
+int vm_image_verify(vm_image *image)
+{
+        vm_analysis *a;
+        frame_range entry_frame;
+        unsigned int i;
+
+        vm_release_analysis(image);
+
+        if(0 == image->size) {
+                return 0;
+        }
+
+        a = create_analysis(image);
+        if(NULL == a) {
+                return 0;
+        }
+        image->analysis = a;
+
+        for(i = 0; i < image->size; ++i) {
+                a->region[i] = 0;
+                a->return_owner[i] = -1;
+                a->functions[i].state = FUNCTION_UNKNOWN;
+        }
+
+        if(!analyze(a, image->entry, NULL)) {
+                vm_release_analysis(image);
+                return 0;
+        }
+
+        /*    BP    0 */
+        collect_frame(a, image->entry, &entry_frame);
+        if(entry_frame.used &&
+                        (entry_frame.low < 0 || entry_frame.high >= MAX_STACK_SIZE)) {
+                vm_release_analysis(image);
+                return 0;
+        }
+
+        for(i = 0; i < image->size; ++i) {
+                if(0 == a->region[i]) {
+                        continue;
+                }
+                if(BP == PACKED_CODE(image->code[i])) {
+                        collect_frame(a, i + 1, &a->frames[i]);
+                }
+                else if(CALL == PACKED_CODE(image->code[i])) {
+                        collect_frame(a, vm_fetch(image, i).arg, &a->frames[i]);
+                }
+        }
+
+        /*        */
+        free(a->worklist);
+        free(a->visited);
+        a->worklist = NULL;
+        a->visited = NULL;
+
+        image->verified = 1;
+        return 1;
+}
+
+void vm_release_analysis(vm_image *image)
+{
+        free_analysis(image->analysis);
+        image->analysis = NULL;
+        image->verified = 0;
+}
+
+int vm_frame_allowed(const vm_image *image, unsigned int address,
+        unsigned int base_pointer)
+{
+        frame_range *frame = &image->analysis->frames[address];
+
+        return !frame->used ||
+                ((long long)base_pointer + frame->low >= 0 &&
+                 (long long)base_pointer + frame->high < MAX_STACK_SIZE);
+}
+
+int vm_frame_bounds(const vm_image *image, unsigned int address,
+        int *low, int *high)
+{
+        frame_range *frame = &image->analysis->frames[address];
+
+        *low = frame->low;
+        *high = frame->high;
+        return frame->used;
+}
+
+int vm_stack_depth(const vm_image *image, unsigned int address,
+        int *stack_depth)
+{
+        vm_analysis *a = image->analysis;
+
+        if(address >= image->size || 0 == a->region[address]) {
+                return 0;
+        }
+        *stack_depth = a->depth[address];
+        return 1;
+}
+
+unsigned int vm_region_entry(const vm_image *image, unsigned int address)
+{
+        vm_analysis *a = image->analysis;
+
+        return a->region_entry[a->region[address]];
+}
+
+int vm_call_effect(const vm_image *image, unsigned int address)
+{
+        command cmd = vm_fetch(image, address);
+
+        if(CALL == cmd.operation) {
+                return image->analysis->functions[cmd.arg].net - cmd.arg2;
+        }
+        return is_call(image, address) ? image->analysis->functions[cmd.arg].net : 0;
+}
+
+int vm_is_call(const vm_image *image, unsigned int address)
+{
+        return image->verified && 0 != image->analysis->region[address] &&
+                is_call(image, address);
+}